@@ -50,10 +50,21 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 /************Private include**********************************************/
 #include "kma_page.h"
 #include "kma.h"
+#include "kma_bench.h"
+#ifdef KMA_RM
+#include "kma_rm.h"
+#endif
+#ifdef KMA_P2FL
+#include "kma_p2fl.h"
+#endif
+#ifdef KMA_MCK2
+#include "kma_mck2.h"
+#endif
 
 /************Defines and Typedefs*****************************************/
 /*  #defines and typedefs should have their names in all caps.
@@ -62,10 +73,25 @@
  *  structures and arrays, line everything up in neat columns.
  */
 
+#define DEFAULT_RUNS 5
+
+// percentiles reported by the tail latency pass
+#define N_TAILS 4
+
 enum REQ_STATE
   {
     FREE,
-    USED
+    USED,
+    REFUSED // NULL under the page limit, its FREE is skipped
+  };
+
+enum OP_TYPE
+  {
+    OP_REQUEST,
+    OP_FREE,
+    OP_REALLOC,
+    OP_CALLOC,
+    OP_ALIGNED
   };
 
 typedef struct mem
@@ -76,15 +102,61 @@ typedef struct mem
   enum REQ_STATE state;
 } mem_t;
 
+// one decoded line of the trace file
+typedef struct op
+{
+  enum OP_TYPE type;
+  int id;
+  int size;
+  int oldSize; // REALLOC only
+  int align; // ALIGNED only
+} op_t;
+
+// what a replay measured; the slice estimate sums weighted copies
+typedef struct score
+{
+  double ratioSum;
+  double ratioCount;
+  double bestTime;
+} score_t;
+
 /************Global Variables*********************************************/
 
 static int val = 0;
 
+static const double kTails[N_TAILS] = { 50.0, 99.0, 99.9, 100.0 };
+static const char* kTailNames[N_TAILS] = { "p50", "p99", "p99.9", "max" };
+
+#ifdef KMA_RM
+// the names of the resource map's free maps and policies, by number
+static const char* kRmMaps[] = { "list", "tree", "array", NULL };
+static const char* kRmFits[] = { "first", "best", "next", "worst", "good",
+				 "adaptive", NULL };
+#endif
+
 /************Function Prototypes******************************************/
-void allocate();
+op_t* load_trace(char*, int*, int*);
+void replay(op_t*, int, int, int, int, score_t*);
+#ifdef COMPETITION
+void time_trace(op_t*, int, int, int, int, int, score_t*);
+long long timed_replay(op_t*, int, int, int, void**);
+void estimate_from_slices(char*, int, int, score_t*);
+void report_estimate(char*, double, double);
+#endif
+void replay_unaligned(op_t*, int, int, score_t*);
+void tail_trace(op_t*, int, int);
+void report_tail(char*, long long*, int, long long);
+int compare_ns(const void*, const void*);
+int lookup_name(const char**, char*);
+void check_pages_freed();
+void sample_stats(int);
+void report_stats();
+void allocate(mem_t*, op_t*);
 void deallocate();
+void reallocate();
 void fill(char*, int);
 void check(char*, char*, int);
+void check_zero(char*, int);
 void usage();
 void error(char*, char*);
 void pass();
@@ -98,8 +170,34 @@ void fail();
 
 int anyMismatches = 0;
 
+// free and resize with KMA_UNSIZED, so the allocator looks the size up
+int unsizedFree = 0;
+
 int currentAllocBytes = 0;
 
+int peakPages = 0;
+
+// the replay with every ALIGNED made as a plain REQUEST
+int alignedCount = 0;
+int unalignedPeakPages = 0;
+
+// how many reallocs stayed in place, and the copy bytes that saved
+int reallocCount = 0;
+int reallocInPlace = 0;
+long long reallocBytes = 0;
+long long reallocBytesSaved = 0;
+
+// pages the main replay may hold, 0 for no limit, and the requests the
+// allocator turned down under it
+int pageLimit = 0;
+int refusedCount = 0;
+
+// ops between kma_get_stats samples of the main replay, 0 for none, and
+// the sample with the most pages for its size classes
+int statsInterval = 0;
+int statsPeakOp = 0;
+kma_stats_t statsPeak;
+
 char *name = NULL;
 
 int
@@ -116,124 +214,774 @@ main(int argc, char* argv[])
   printf("%s: Running in correctness mode\n", name);
 #endif
 
-  int n_req = 0, n_alloc=0, n_dealloc=0;
+  int n_req = 0, n_ops = 0;
+  int opt, runs = DEFAULT_RUNS, cpu = -1, tail = 0, stats = 0;
   kma_page_stat_t* stat;
+  op_t* ops;
+  score_t score, unaligned;
 
 #ifdef COMPETITION
-  double ratioSum = 0.0;
-  int ratioCount = 0;
+  char* manifest = NULL;
+  double avgRatio;
+  score_t estimate;
 #endif
   
-#ifndef COMPETITION
-  FILE* allocTrace = fopen("kma_output.dat", "w");
-  if (allocTrace == NULL)
+  while ((opt = getopt(argc, argv, "r:c:s:l:S:M:P:R:HC:tu")) != -1)
     {
-      error("unable to open allocation output file", "kma_output.dat");
-    }
-  fprintf(allocTrace, "0 0 0\n");
+      switch (opt)
+	{
+	case 'r':
+	  runs = atoi(optarg);
+	  break;
+	case 'c':
+	  cpu = atoi(optarg);
+	  break;
+	case 't':
+	  tail = 1;
+	  break;
+	case 'u':
+	  unsizedFree = 1;
+	  break;
+	case 'l':
+	  pageLimit = atoi(optarg);
+	  break;
+	case 'S':
+	  stats = atoi(optarg);
+	  break;
+#ifdef KMA_RM
+	case 'M':
+	  if (!kma_rm_set_map(lookup_name(kRmMaps, optarg)))
+	    {
+	      usage();
+	    }
+	  break;
+	case 'P':
+	  if (!kma_rm_set_fit(lookup_name(kRmFits, optarg)))
+	    {
+	      usage();
+	    }
+	  break;
+	case 'R':
+	  if (!kma_rm_set_region(atoi(optarg)))
+	    {
+	      usage();
+	    }
+	  break;
+#endif
+#ifdef KMA_P2FL
+	case 'H':
+	  kma_p2fl_set_headerless(TRUE);
+	  break;
 #endif
+#ifdef KMA_MCK2
+	case 'C':
+	  if (!kma_mck2_set_classes(atoi(optarg)))
+	    {
+	      usage();
+	    }
+	  break;
+#endif
+#ifdef COMPETITION
+	case 's':
+	  manifest = optarg;
+	  break;
+#endif
+	default:
+	  usage();
+	}
+    }
 
-  if (argc != 2)
+  if (argc - optind != 1 || runs < 1 || pageLimit < 0 || stats < 0)
     {
       usage();
     }
   
-  FILE* f_test = fopen(argv[1], "r");
+  // Decode the whole trace up front, so parsing never shows up in
+  // the measurements
+  ops = load_trace(argv[optind], &n_req, &n_ops);
+  
+  cpu = bench_pin_cpu(cpu);
+  if (cpu < 0)
+    {
+      fprintf(stderr, "%s: warning: unable to pin to a cpu\n", name);
+    }
+
+  // what the alignment costs: the same trace without it, replayed
+  // first so the output file is left to the real run
+  memset(&unaligned, 0, sizeof(score_t));
+  replay_unaligned(ops, n_ops, n_req, &unaligned);
+  
+  // only the checked replay runs under the limit, the timed ones
+  // would have nothing to compare against
+  memset(&score, 0, sizeof(score_t));
+  kma_set_limit(pageLimit);
+  statsInterval = stats;
+  replay(ops, n_ops, n_req, 0, n_ops, &score);
+  statsInterval = 0;
+  kma_set_limit(0);
+  
+  if(anyMismatches)
+    {
+      error("there were memory mismatches", "");
+    }
+
+#ifdef COMPETITION
+  time_trace(ops, n_ops, n_req, 0, n_ops, runs, &score);
+#endif
+  
+  if (tail)
+    {
+      tail_trace(ops, n_ops, n_req);
+    }
+  
+  if (stats > 0)
+    {
+      report_stats();
+    }
+  
+  stat = page_stats();
+  
+  printf("Page Requested/Freed/In Use: %5d/%5d/%5d\n",
+	 stat->num_requested, stat->num_freed, stat->num_in_use);	
+  printf("Peak pages in use: %d (%d bytes)\n", peakPages,
+	 peakPages * stat->page_size);
+  if (reallocCount > 0)
+    {
+      printf("Realloc in place: %d/%d, copy bytes saved: %lld/%lld\n",
+	     reallocInPlace, reallocCount, reallocBytesSaved, reallocBytes);
+    }
+  if (pageLimit > 0)
+    {
+      printf("Page limit %d: refused %d, reclaim passes %d, pages reclaimed %d, "
+	     "reclaim time %lld ns\n", pageLimit, refusedCount,
+	     stat->num_reclaims, stat->num_reclaimed, stat->reclaim_ns);
+    }
+  if (alignedCount > 0)
+    {
+      printf("Aligned requests: %d, peak pages %d (%d unaligned)\n",
+	     alignedCount, peakPages, unalignedPeakPages);
+#ifdef COMPETITION
+      printf("Aligned waste ratio: %f (%f unaligned)\n",
+	     score.ratioSum / score.ratioCount,
+	     unaligned.ratioSum / unaligned.ratioCount);
+#endif
+    }
+  
+#ifdef COMPETITION
+  avgRatio = score.ratioSum / score.ratioCount;
+  printf("Competition average ratio: %f\n", avgRatio);
+  printf("Competition time: %.9f (best of %d runs on cpu %d)\n",
+	 score.bestTime / 1e9, runs, cpu);
+  printf("Competition score: %.9f\n", score.bestTime / 1e9 * (1 + avgRatio));
+
+  if (manifest != NULL)
+    {
+      estimate_from_slices(manifest, runs, n_ops, &estimate);
+      
+      double estRatio = estimate.ratioSum / estimate.ratioCount;
+      report_estimate("average ratio", estRatio, avgRatio);
+      report_estimate("time", estimate.bestTime / 1e9, score.bestTime / 1e9);
+      report_estimate("score", estimate.bestTime / 1e9 * (1 + estRatio),
+		      score.bestTime / 1e9 * (1 + avgRatio));
+    }
+#endif
+  
+  free(ops);
+  
+  pass();
+  return 0;
+}
+
+op_t*
+load_trace(char* file, int* n_req, int* n_ops)
+{
+  FILE* f_test = fopen(file, "r");
   if (f_test == NULL)
     {
-      error("unable to open input test file", argv[1]);
+      error("unable to open input test file", file);
     }
   
   // Get the number of requests in the trace file
   // Allocate some memory...
-  int status = fscanf(f_test, "%d\n", &n_req);
+  int status = fscanf(f_test, "%d\n", n_req);
   if(status != 1)
     error("Couldn't read number of requests at head of file", "");
   
-  mem_t* requests = malloc((n_req + 1)*sizeof(mem_t));
-  memset(requests, 0, (n_req + 1)*sizeof(mem_t));
+  int capacity = *n_req > 0 ? *n_req : 1;
+  op_t* ops = malloc(capacity * sizeof(op_t));
   
   char command[16];
-  int req_id, req_size, index = 1;
+  int req_id, req_size;
 
-  // Parse the lines in the file, and call allocate or
-  // deallocate accordingly.
+  *n_ops = 0;
+  
+  // Parse the lines in the file into operations
   while (fscanf(f_test, "%10s", command) == 1)
     {
+      if (*n_ops == capacity)
+	{
+	  capacity *= 2;
+	  ops = realloc(ops, capacity * sizeof(op_t));
+	}
+      
+      op_t* op = &ops[*n_ops];
+      
       if (strcmp(command, "REQUEST") == 0)
 	{
 	  
 	  if (fscanf(f_test, "%d %d", &req_id, &req_size) != 2)
 	    error("Not enough arguments to REQUEST", "");
 
-	  assert(req_id >= 0 && req_id < n_req);
+	  assert(req_id >= 0 && req_id < *n_req);
 	  
-	  allocate(requests, req_id, req_size);
-	  n_alloc++;
+	  op->type = OP_REQUEST;
+	  op->size = req_size;
 	}
       else if (strcmp(command, "FREE") == 0)
 	{
 	  if (fscanf(f_test, "%d", &req_id) != 1)
 	    error("Not enough arguments to FREE", "");
 	  
-	  assert(req_id >= 0 && req_id < n_req);
+	  assert(req_id >= 0 && req_id < *n_req);
 	  
-	  deallocate(requests, req_id);
-	  n_dealloc++;
+	  op->type = OP_FREE;
+	  op->size = 0;
+	}
+      else if (strcmp(command, "REALLOC") == 0)
+	{
+	  if (fscanf(f_test, "%d %d", &req_id, &req_size) != 2)
+	    error("Not enough arguments to REALLOC", "");
+	  
+	  assert(req_id >= 0 && req_id < *n_req);
+	  
+	  op->type = OP_REALLOC;
+	  op->size = req_size;
+	}
+      else if (strcmp(command, "CALLOC") == 0)
+	{
+	  if (fscanf(f_test, "%d %d", &req_id, &req_size) != 2)
+	    error("Not enough arguments to CALLOC", "");
+	  
+	  assert(req_id >= 0 && req_id < *n_req);
+	  
+	  op->type = OP_CALLOC;
+	  op->size = req_size;
+	}
+      else if (strcmp(command, "ALIGNED") == 0)
+	{
+	  if (fscanf(f_test, "%d %d %d", &req_id, &req_size, &op->align) != 3)
+	    error("Not enough arguments to ALIGNED", "");
+	  
+	  assert(req_id >= 0 && req_id < *n_req);
+	  assert(op->align > 0 && (op->align & (op->align - 1)) == 0);
+	  
+	  op->type = OP_ALIGNED;
+	  op->size = req_size;
 	}
       else
 	{
 	  error("unknown command type:", command);
 	}
+      
+      op->id = req_id;
+      *n_ops += 1;
+    }
+  
+  fclose(f_test);
+  
+  // FREE does not carry the size, take it from the matching REQUEST,
+  // CALLOC or ALIGNED, or the last REALLOC
+  int i;
+  int* sizes = malloc((*n_req + 1) * sizeof(int));
+  for (i = 0; i < *n_ops; i++)
+    {
+      if (ops[i].type == OP_REQUEST || ops[i].type == OP_CALLOC
+	  || ops[i].type == OP_ALIGNED)
+	{
+	  sizes[ops[i].id] = ops[i].size;
+	}
+      else if (ops[i].type == OP_REALLOC)
+	{
+	  ops[i].oldSize = sizes[ops[i].id];
+	  sizes[ops[i].id] = ops[i].size;
+	}
+      else
+	{
+	  ops[i].size = sizes[ops[i].id];
+	}
+    }
+  free(sizes);
+  
+  // the timed replays take the sizes from the ops
+  for (i = 0; unsizedFree && i < *n_ops; i++)
+    {
+      if (ops[i].type == OP_FREE)
+	{
+	  ops[i].size = KMA_UNSIZED;
+	}
+      else if (ops[i].type == OP_REALLOC)
+	{
+	  ops[i].oldSize = KMA_UNSIZED;
+	}
+    }
+  
+  return ops;
+}
+
+void
+replay(op_t* ops, int n_ops, int n_req, int from, int to, score_t* score)
+{
+  int i, n_alloc = 0, n_dealloc = 0;
+  kma_page_stat_t* stat;
+  
+  mem_t* requests = malloc((n_req + 1)*sizeof(mem_t));
+  memset(requests, 0, (n_req + 1)*sizeof(mem_t));
+  
+#ifndef COMPETITION
+  FILE* allocTrace = fopen("kma_output.dat", "w");
+  if (allocTrace == NULL)
+    {
+      error("unable to open allocation output file", "kma_output.dat");
+    }
+  fprintf(allocTrace, "0 0 0\n");
+#endif
+
+  // Replay the trace with all the bookkeeping: memory checks in
+  // correctness mode, the waste ratio in competition mode
+  for (i = 0; i < n_ops; i++)
+    {
+      op_t* op = &ops[i];
+      
+      if (op->type == OP_REQUEST || op->type == OP_CALLOC
+	  || op->type == OP_ALIGNED)
+	{
+	  allocate(requests, op);
+	  n_alloc++;
+	}
+      else if (op->type == OP_REALLOC)
+	{
+	  reallocate(requests, op->id, op->size);
+	}
+      else
+	{
+	  deallocate(requests, op->id);
+	  n_dealloc++;
+	}
 
       stat = page_stats();
       int totalBytes = stat->num_in_use * stat->page_size;
+      if (stat->num_in_use > peakPages)
+	{
+	  peakPages = stat->num_in_use;
+	}
 
       
 #ifdef COMPETITION
-      if(req_id < n_req && n_alloc != n_dealloc)
+      if(i >= from && i < to && n_alloc != n_dealloc)
 	{
 	  // We can calculate the ratio of wasted to used memory here.
 
 	  int wastedBytes = totalBytes - currentAllocBytes;
-	  ratioSum += ((double) wastedBytes) / currentAllocBytes;
-	  ratioCount += 1;
+	  score->ratioSum += ((double) wastedBytes) / currentAllocBytes;
+	  score->ratioCount += 1;
 	}
 #endif
 
 #ifndef COMPETITION
-      fprintf(allocTrace, "%d %d %d\n", index, currentAllocBytes, totalBytes);
+      fprintf(allocTrace, "%d %d %d\n", i + 1, currentAllocBytes, totalBytes);
 #endif
-      
-      index += 1;
+
+      if (statsInterval > 0 && (i + 1) % statsInterval == 0)
+	{
+	  sample_stats(i + 1);
+	}
     }
 
 #ifndef COMPETITION
   fclose(allocTrace);
 #endif
   
+  free(requests);
   
-  stat = page_stats();
+  check_pages_freed();
+}
+
+#ifdef COMPETITION
+void
+time_trace(op_t* ops, int n_ops, int n_req, int from, int to, int runs,
+	   score_t* score)
+{
+  int i;
+  long long elapsed;
   
-  printf("Page Requested/Freed/In Use: %5d/%5d/%5d\n",
-	 stat->num_requested, stat->num_freed, stat->num_in_use);	
+  // Time the allocator alone: no parsing, no checks and no page
+  // statistics, only the kma_malloc/kma_free calls of the trace
+  void** ptrs = calloc(n_req + 1, sizeof(void*));
   
-  if (stat->num_requested != stat->num_freed || stat->num_in_use != 0)
+  // Hold one page across the runs, so the page pool is not torn down
+  // and faulted in again at the start of every run
+  kma_page_t* anchor = get_page();
+  
+  score->bestTime = -1;
+  for (i = 0; i < runs; i++)
     {
-      error("not all pages freed", "");
+      elapsed = timed_replay(ops, n_ops, from, to, ptrs);
+      if (page_stats()->num_in_use != 1)
+	{
+	  error("not all pages freed", "");
+	}
+      if (score->bestTime < 0 || elapsed < score->bestTime)
+	{
+	  score->bestTime = elapsed;
+	}
     }
   
-  if(anyMismatches)
+  free_page(anchor);
+  free(ptrs);
+}
+
+long long
+timed_replay(op_t* ops, int n_ops, int from, int to, void** ptrs)
+{
+  int i, end;
+  long long start = 0, elapsed = 0;
+  
+  // ops before from (a slice prefix) and from to on (its suffix) only
+  // set up and tear down the heap
+  for (i = 0; i < n_ops; i = end)
     {
-      error("there were memory mismatches", "");
+      end = i < from ? from : (i < to ? to : n_ops);
+      if (i == from)
+	{
+	  start = bench_now_ns();
+	}
+      
+      for (; i < end; i++)
+	{
+	  if (ops[i].type == OP_REQUEST)
+	    {
+	      ptrs[ops[i].id] = kma_malloc(ops[i].size);
+	    }
+	  else if (ops[i].type == OP_CALLOC)
+	    {
+	      ptrs[ops[i].id] = kma_calloc(1, ops[i].size);
+	    }
+	  else if (ops[i].type == OP_ALIGNED)
+	    {
+	      ptrs[ops[i].id] = kma_malloc_aligned(ops[i].size, ops[i].align);
+	    }
+	  else if (ops[i].type == OP_REALLOC)
+	    {
+	      ptrs[ops[i].id] = kma_realloc(ptrs[ops[i].id], ops[i].oldSize,
+					    ops[i].size);
+	    }
+	  else if (ptrs[ops[i].id] != NULL)
+	    {
+	      kma_free(ptrs[ops[i].id], ops[i].size);
+	    }
+	}
+      
+      if (end == to)
+	{
+	  elapsed = bench_now_ns() - start;
+	}
     }
+  
+  return elapsed;
+}
 
-#ifdef COMPETITION
-  printf("Competition average ratio: %f\n", ratioSum / ratioCount);
+void
+estimate_from_slices(char* manifest, int runs, int n_ops, score_t* estimate)
+{
+  char line[1024], file[512], path[1024];
+  double weight;
+  int prefix, window, n_slices = 0, n_slice_ops = 0;
+  
+  FILE* f = fopen(manifest, "r");
+  if (f == NULL)
+    {
+      error("unable to open slice manifest", manifest);
+    }
+  
+  // slice files are named relative to the manifest
+  char* slash = strrchr(manifest, '/');
+  int dirLen = slash == NULL ? 0 : slash - manifest + 1;
+  
+  memset(estimate, 0, sizeof(score_t));
+  while (fgets(line, sizeof(line), f) != NULL)
+    {
+      if (line[0] == '#' || line[0] == '\n')
+	{
+	  continue;
+	}
+      if (sscanf(line, "%511s %lf %d %d", file, &weight, &prefix, &window) != 4)
+	{
+	  error("malformed slice manifest line", line);
+	}
+      snprintf(path, sizeof(path), "%.*s%s", dirLen, manifest, file);
+      
+      int s_req, s_ops;
+      score_t slice;
+      op_t* ops = load_trace(path, &s_req, &s_ops);
+      
+      memset(&slice, 0, sizeof(score_t));
+      replay(ops, s_ops, s_req, prefix, prefix + window, &slice);
+      time_trace(ops, s_ops, s_req, prefix, prefix + window, runs, &slice);
+      free(ops);
+      
+      printf("Slice %s: weight %.2f, average ratio %f, time %.9f\n", file,
+	     weight, slice.ratioSum / slice.ratioCount, slice.bestTime / 1e9);
+      
+      estimate->ratioSum += weight * slice.ratioSum;
+      estimate->ratioCount += weight * slice.ratioCount;
+      estimate->bestTime += weight * slice.bestTime;
+      n_slices++;
+      n_slice_ops += window;
+    }
+  fclose(f);
+  
+  if (n_slices == 0)
+    {
+      error("no slices in manifest", manifest);
+    }
+  
+  printf("Slice estimate: %d slices timing %d of %d ops\n", n_slices,
+	 n_slice_ops, n_ops);
+}
+
+void
+report_estimate(char* what, double estimated, double measured)
+{
+  printf("Estimated %s: %.9f (full run %.9f, error %+.2f%%)\n", what,
+	 estimated, measured, 100.0 * (estimated - measured) / measured);
+}
 #endif
+
+void
+replay_unaligned(op_t* ops, int n_ops, int n_req, score_t* score)
+{
+  int i;
   
-  pass();
-  return 0;
+  for (i = 0; i < n_ops; i++)
+    {
+      if (ops[i].type == OP_ALIGNED)
+	{
+	  alignedCount++;
+	}
+    }
+  if (alignedCount == 0)
+    {
+      return;
+    }
+  
+  op_t* plain = malloc(n_ops * sizeof(op_t));
+  memcpy(plain, ops, n_ops * sizeof(op_t));
+  for (i = 0; i < n_ops; i++)
+    {
+      if (plain[i].type == OP_ALIGNED)
+	{
+	  plain[i].type = OP_REQUEST;
+	}
+    }
+  
+  replay(plain, n_ops, n_req, 0, n_ops, score);
+  free(plain);
+  
+  // the counters belong to the real run
+  unalignedPeakPages = peakPages;
+  peakPages = 0;
+  reallocCount = reallocInPlace = 0;
+  reallocBytes = reallocBytesSaved = 0;
+}
+
+void
+tail_trace(op_t* ops, int n_ops, int n_req)
+{
+  int i, n_malloc = 0, n_free = 0, n_realloc = 0, n_calloc = 0, n_aligned = 0;
+  long long start, end, overhead = -1;
+  
+  // Time every call on its own. The page pool is held open as in
+  // time_trace, so the worst case is the allocator's and not the
+  // pool setup of the harness.
+  void** ptrs = calloc(n_req + 1, sizeof(void*));
+  long long* mallocNs = malloc((n_ops + 1) * sizeof(long long));
+  long long* freeNs = malloc((n_ops + 1) * sizeof(long long));
+  long long* reallocNs = malloc((n_ops + 1) * sizeof(long long));
+  long long* callocNs = malloc((n_ops + 1) * sizeof(long long));
+  long long* alignedNs = malloc((n_ops + 1) * sizeof(long long));
+  kma_page_t* anchor = get_page();
+  
+  // the cheapest back-to-back clock read is taken off every sample
+  for (i = 0; i < 1000; i++)
+    {
+      start = bench_now_ns();
+      end = bench_now_ns();
+      if (overhead < 0 || end - start < overhead)
+	{
+	  overhead = end - start;
+	}
+    }
+  
+  for (i = 0; i < n_ops; i++)
+    {
+      if (ops[i].type == OP_REQUEST)
+	{
+	  start = bench_now_ns();
+	  ptrs[ops[i].id] = kma_malloc(ops[i].size);
+	  end = bench_now_ns();
+	  mallocNs[n_malloc++] = end - start;
+	}
+      else if (ops[i].type == OP_CALLOC)
+	{
+	  start = bench_now_ns();
+	  ptrs[ops[i].id] = kma_calloc(1, ops[i].size);
+	  end = bench_now_ns();
+	  callocNs[n_calloc++] = end - start;
+	}
+      else if (ops[i].type == OP_ALIGNED)
+	{
+	  start = bench_now_ns();
+	  ptrs[ops[i].id] = kma_malloc_aligned(ops[i].size, ops[i].align);
+	  end = bench_now_ns();
+	  alignedNs[n_aligned++] = end - start;
+	}
+      else if (ops[i].type == OP_REALLOC)
+	{
+	  start = bench_now_ns();
+	  ptrs[ops[i].id] = kma_realloc(ptrs[ops[i].id], ops[i].oldSize,
+					ops[i].size);
+	  end = bench_now_ns();
+	  reallocNs[n_realloc++] = end - start;
+	}
+      else if (ptrs[ops[i].id] != NULL)
+	{
+	  start = bench_now_ns();
+	  kma_free(ptrs[ops[i].id], ops[i].size);
+	  end = bench_now_ns();
+	  freeNs[n_free++] = end - start;
+	}
+    }
+  
+  if (page_stats()->num_in_use != 1)
+    {
+      error("not all pages freed", "");
+    }
+  free_page(anchor);
+  
+  report_tail("kma_malloc", mallocNs, n_malloc, overhead);
+  report_tail("kma_free", freeNs, n_free, overhead);
+  report_tail("kma_realloc", reallocNs, n_realloc, overhead);
+  report_tail("kma_calloc", callocNs, n_calloc, overhead);
+  report_tail("kma_malloc_aligned", alignedNs, n_aligned, overhead);
+  
+  free(mallocNs);
+  free(freeNs);
+  free(reallocNs);
+  free(callocNs);
+  free(alignedNs);
+  free(ptrs);
+}
+
+void
+report_tail(char* what, long long* ns, int n, long long overhead)
+{
+  int i;
+  
+  if (n == 0)
+    {
+      return;
+    }
+  qsort(ns, n, sizeof(long long), compare_ns);
+  
+  printf("Tail %s ns:", what);
+  for (i = 0; i < N_TAILS; i++)
+    {
+      int at = (int) (kTails[i] / 100.0 * (n - 1) + 0.5);
+      long long v = ns[at] - overhead;
+      printf(" %s %lld", kTailNames[i], v < 0 ? 0 : v);
+    }
+  printf("\n");
+}
+
+int
+lookup_name(const char** names, char* name)
+{
+  int i;
+  
+  for (i = 0; names[i] != NULL; i++)
+    {
+      if (strcmp(names[i], name) == 0)
+	{
+	  return i;
+	}
+    }
+  return -1;
+}
+
+int
+compare_ns(const void* lhs, const void* rhs)
+{
+  long long a = *(const long long*) lhs, b = *(const long long*) rhs;
+  
+  return a < b ? -1 : (a > b);
+}
+
+void
+sample_stats(int op)
+{
+  kma_stats_t stats;
+  long long pageBytes;
+  
+  // what the pages hold beyond the live bytes: rounding and headers of
+  // the blocks handed out, free blocks not given back, and control data
+  kma_get_stats(&stats);
+  pageBytes = (long long) (stats.data_pages + stats.meta_pages) * PAGESIZE;
+  printf("Stats op %d: pages %d (%d control), live %d, internal %lld, "
+	 "external %lld, metadata %lld\n", op,
+	 stats.data_pages + stats.meta_pages, stats.meta_pages,
+	 currentAllocBytes, stats.used_bytes - currentAllocBytes,
+	 stats.free_bytes, pageBytes - stats.used_bytes - stats.free_bytes);
+  
+  if (stats.data_pages + stats.meta_pages
+      > statsPeak.data_pages + statsPeak.meta_pages)
+    {
+      statsPeak = stats;
+      statsPeakOp = op;
+    }
+}
+
+void
+report_stats()
+{
+  int i;
+  
+  if (statsPeakOp == 0)
+    {
+      return;
+    }
+  printf("Stats classes at op %d:", statsPeakOp);
+  for (i = 0; i < statsPeak.num_classes; i++)
+    {
+      if (statsPeak.classes[i].used > 0 || statsPeak.classes[i].free > 0)
+	{
+	  printf(" %d:%d/%d", statsPeak.classes[i].size,
+		 statsPeak.classes[i].used, statsPeak.classes[i].free);
+	}
+    }
+  printf(" (size:used/free)\n");
+}
+
+void
+check_pages_freed()
+{
+  kma_page_stat_t* stat = page_stats();
+  
+  if (stat->num_requested != stat->num_freed || stat->num_in_use != 0)
+    {
+      printf("Page Requested/Freed/In Use: %5d/%5d/%5d\n",
+	     stat->num_requested, stat->num_freed, stat->num_in_use);	
+      error("not all pages freed", "");
+    }
 }
 
 void
@@ -252,7 +1000,18 @@ pass()
 
 void
 usage() {
-  printf("Usage: %s traceFile\n", name);
+  printf("Usage: %s [-r runs] [-c cpu] [-s sliceManifest] [-l pageLimit] [-S statsInterval] [-t] [-u] traceFile\n",
+	 name);
+#ifdef KMA_RM
+  printf("       -M list|tree|array picks the free map, -R pages the pages per region,\n");
+  printf("       -P first|best|next|worst|good|adaptive the placement policy\n");
+#endif
+#ifdef KMA_P2FL
+  printf("       -H drops the block headers\n");
+#endif
+#ifdef KMA_MCK2
+  printf("       -C 1|2|4 the size classes per power of two\n");
+#endif
   exit(0);
 }
 
@@ -263,28 +1022,55 @@ error(char* message, char* arg ) {
 }
 
 void
-allocate(mem_t* requests, int req_id, int req_size)
+allocate(mem_t* requests, op_t* op)
 {
-  mem_t* new = &requests[req_id];
+  mem_t* new = &requests[op->id];
+  int limit = PAGESIZE - sizeof(void*);
   
   assert(new->state == FREE);
   
-  new->size = req_size;
-  new->ptr = kma_malloc(new->size);
+  new->size = op->size;
+  if (op->type == OP_CALLOC)
+    {
+      new->ptr = kma_calloc(1, new->size);
+    }
+  else if (op->type == OP_ALIGNED)
+    {
+      new->ptr = kma_malloc_aligned(new->size, op->align);
+      // size + align has to fit, an allocator may serve more than that
+      if (new->ptr == NULL)
+	limit -= op->align;
+    }
+  else
+    {
+      new->ptr = kma_malloc(new->size);
+    }
   
   // Accept a NULL response in some cases... 
-  if(!(((new->ptr != NULL) && (new->size <= (PAGESIZE - sizeof(void*))))
-       || ((new->ptr == NULL) && (new->size > (PAGESIZE - sizeof(void*))))))
+  if(!(((new->ptr != NULL) && (new->size <= limit))
+       || ((new->ptr == NULL) && (new->size > limit))))
     {
-      error("got NULL from kma_malloc for alloc'able request", "");
+      // under the page limit the allocator may turn it down
+      if (pageLimit == 0)
+	{
+	  error("got NULL from kma_malloc for alloc'able request", "");
+	}
+      refusedCount++;
+      new->state = REFUSED;
+      return;
     }
   
   if (new->ptr == NULL)
     {
       return;
     }
+  
+  if (op->type == OP_ALIGNED && ((unsigned long) new->ptr & (op->align - 1)))
+    {
+      error("kma_malloc_aligned returned a misaligned block", "");
+    }
 
-  currentAllocBytes += req_size;
+  currentAllocBytes += op->size;
   
 #ifndef COMPETITION
   // Only run the actual memory accesses/copies/checks if we're
@@ -293,6 +1079,15 @@ allocate(mem_t* requests, int req_id, int req_size)
   new->value = malloc(new->size);
   assert(new->value != NULL);
   
+  if (op->type == OP_CALLOC)
+    {
+      check_zero((char*)new->ptr, new->size);
+    }
+  if (kma_usable_size(new->ptr) < new->size)
+    {
+      error("kma_usable_size is smaller than the request", "");
+    }
+  
   // initialize memory
   fill((char*)new->ptr, new->size);
   
@@ -311,6 +1106,12 @@ deallocate(mem_t* requests, int req_id)
 {
   mem_t* cur = &requests[req_id];
   
+  if (cur->state == REFUSED)
+    {
+      cur->state = FREE;
+      return;
+    }
+  
   assert(cur->state == USED);
   assert(cur->size > 0);
   
@@ -324,13 +1125,67 @@ deallocate(mem_t* requests, int req_id)
   free(cur->value);
 #endif
 
-  kma_free(cur->ptr, cur->size);
+  kma_free(cur->ptr, unsizedFree ? KMA_UNSIZED : cur->size);
 
   currentAllocBytes -= cur->size;
   
   cur->state = FREE;
 }
 
+void
+reallocate(mem_t* requests, int req_id, int req_size)
+{
+  mem_t* cur = &requests[req_id];
+  void* ptr;
+  int kept = cur->size < req_size ? cur->size : req_size;
+  
+  if (cur->state == REFUSED)
+    {
+      return;
+    }
+  assert(cur->state == USED);
+  
+#ifndef COMPETITION
+  check((char*)cur->ptr, (char*)cur->value, cur->size);
+#endif
+  
+  ptr = kma_realloc(cur->ptr, unsizedFree ? KMA_UNSIZED : cur->size, req_size);
+  if (ptr == NULL)
+    {
+      if (pageLimit == 0)
+	{
+	  error("got NULL from kma_realloc for alloc'able request", "");
+	}
+      // a failed realloc leaves the old block as it was
+      refusedCount++;
+      return;
+    }
+  
+  // a moved block had to copy what it kept
+  reallocCount++;
+  reallocBytes += kept;
+  if (ptr == cur->ptr)
+    {
+      reallocInPlace++;
+      reallocBytesSaved += kept;
+    }
+  
+#ifndef COMPETITION
+  // the kept part must survive, the rest is new memory
+  check((char*)ptr, (char*)cur->value, kept);
+  
+  cur->value = realloc(cur->value, req_size);
+  assert(cur->value != NULL);
+  
+  fill((char*)ptr + kept, req_size - kept);
+  bcopy((char*)ptr + kept, (char*)cur->value + kept, req_size - kept);
+#endif
+  
+  currentAllocBytes += req_size - cur->size;
+  cur->ptr = ptr;
+  cur->size = req_size;
+}
+
 void
 fill(char* ptr, int size)
 {
@@ -357,3 +1212,18 @@ check(char* lhs, char* rhs, int size)
 	}
     }
 }
+
+void
+check_zero(char* ptr, int size)
+{
+  int i;
+  
+  for (i = 0; i < size; i++)
+    {
+      if (ptr[i] != 0)
+	{
+	  fprintf(stderr, "kma_calloc left position %d set (%3d)\n", i, ptr[i]);
+	  anyMismatches = 1;
+	}
+    }
+}
@@ -65,6 +65,37 @@
 
 typedef int kma_size_t;
 
+// pass as the size to kma_free or kma_realloc when it is not known
+#define KMA_UNSIZED 0
+
+// flags for kma_malloc_flags, or-ed together
+#define KMA_ZERO	0x1	// the memory is cleared
+#define KMA_TEMP	0x2	// short-lived, kept off the pages of long-lived memory
+#define KMA_NOWAIT	0x4	// fail rather than take a new page
+
+// a heap of its own, see kma_heap_create
+typedef struct kma_heap kma_heap_t;
+
+// the most size classes kma_get_stats reports
+#define KMA_STAT_CLASSES 32
+
+typedef struct
+{
+  int size; // block size of the class or order
+  int used; // blocks handed out
+  int free; // blocks on its free list
+} kma_class_stat_t;
+
+typedef struct
+{
+  int data_pages; // pages blocks are handed out from
+  int meta_pages; // pages holding control data, page maps and bitmaps
+  long long used_bytes; // handed out, with rounding and block headers
+  long long free_bytes; // free in the data pages, but not given back
+  int num_classes;
+  kma_class_stat_t classes[KMA_STAT_CLASSES];
+} kma_stats_t;
+
 /************Global Variables*********************************************/
 
 /************Function Prototypes******************************************/
@@ -86,11 +117,175 @@ EXTERN void* kma_malloc(kma_size_t size);
  *    Purpose: Frees the memory space pointed to by ptr, which must
  *             have been returned by a previous call to kma_malloc()
  *    Input: the pointer to the memory space, the size of the memory
- *           space
+ *           space or KMA_UNSIZED to have the allocator look it up,
+ *           which is slower
  *    Output: none
  ***********************************************************************/
 EXTERN void kma_free(void*, kma_size_t size);
 
+/***********************************************************************
+ *  Title: Resizes kernel memory
+ * ---------------------------------------------------------------------
+ *    Purpose: Resizes the memory space pointed to by ptr, which must
+ *             have been returned by a previous call to kma_malloc()
+ *             or kma_realloc(), to new_size bytes. The space grows or
+ *             shrinks in place when the allocator can manage it,
+ *             otherwise the contents are copied to a new space. A
+ *             NULL ptr behaves like kma_malloc()
+ *    Input: the pointer to the memory space, the size of the memory
+ *           space or KMA_UNSIZED, the new size
+ *    Output: the resized memory space or NULL on failure, in which
+ *            case the old space is left untouched
+ ***********************************************************************/
+EXTERN void* kma_realloc(void*, kma_size_t size, kma_size_t new_size);
+
+/***********************************************************************
+ *  Title: Allocates zeroed kernel memory
+ * ---------------------------------------------------------------------
+ *    Purpose: Allocates nmemb elements of size bytes each and sets
+ *             them to zero. Memory the allocator knows to be zero
+ *             already, such as a page fresh from the page pool, is
+ *             not cleared again
+ *    Input: the number of elements, the size of each element
+ *    Output: the zeroed memory or NULL on failure
+ ***********************************************************************/
+EXTERN void* kma_calloc(kma_size_t nmemb, kma_size_t size);
+
+/***********************************************************************
+ *  Title: Allocates aligned kernel memory
+ * ---------------------------------------------------------------------
+ *    Purpose: Allocates size bytes at an address that is a multiple
+ *             of align. The memory is freed with kma_free and the same
+ *             size; kma_realloc does not keep the alignment
+ *    Input: the size of the memory, the alignment (a power of two)
+ *    Output: the aligned memory, or NULL if align is not a power of
+ *            two or the request does not fit a page. Allocators that
+ *            move the block up to the alignment need size + align +
+ *            sizeof(void*) to fit, the buddies, whose blocks are
+ *            aligned to their size, only size + sizeof(void*) and
+ *            align
+ ***********************************************************************/
+EXTERN void* kma_malloc_aligned(kma_size_t size, kma_size_t align);
+
+/***********************************************************************
+ *  Title: Usable size of an allocation
+ * ---------------------------------------------------------------------
+ *    Purpose: Finds how many bytes of an allocated block the caller
+ *             may use, which is at least the size it asked for
+ *    Input: the memory returned by one of the allocation functions
+ *    Output: the usable size in bytes
+ ***********************************************************************/
+EXTERN kma_size_t kma_usable_size(void*);
+
+/***********************************************************************
+ *  Title: Allocates a batch of kernel memory
+ * ---------------------------------------------------------------------
+ *    Purpose: Allocates n blocks of size bytes each, like n calls to
+ *             kma_malloc() with the size lookup and the list handling
+ *             done once for the whole batch
+ *    Input: the size of each block, the number of blocks, the array
+ *           to store the blocks to
+ *    Output: the number of blocks allocated, less than n on failure
+ ***********************************************************************/
+EXTERN int kma_malloc_batch(kma_size_t size, int n, void* ptrs[]);
+
+/***********************************************************************
+ *  Title: Frees a batch of kernel memory
+ * ---------------------------------------------------------------------
+ *    Purpose: Frees n blocks, like n calls to kma_free(). The array is
+ *             sorted by address on the way, so that neighbours are
+ *             coalesced together and blocks on one page share the
+ *             page lookup. The sizes are looked up as for a free with
+ *             KMA_UNSIZED, so the blocks need not all have one size
+ *    Input: the array of blocks, the number of blocks
+ *    Output: none
+ ***********************************************************************/
+EXTERN void kma_free_batch(void* ptrs[], int n);
+
+/***********************************************************************
+ *  Title: Creates a heap
+ * ---------------------------------------------------------------------
+ *    Purpose: Creates a heap with pages and free lists of its own, so
+ *             that a subsystem does not share pages with the rest of
+ *             the kernel. Unlike the default heap it is not released
+ *             when its last block is freed. Its control page counts
+ *             against the page limit like any other
+ *    Input: none
+ *    Output: the new heap, NULL if the page limit leaves no room
+ ***********************************************************************/
+EXTERN kma_heap_t* kma_heap_create();
+
+/***********************************************************************
+ *  Title: Destroys a heap
+ * ---------------------------------------------------------------------
+ *    Purpose: Releases all the pages of a heap in one step, whether
+ *             or not its blocks were freed
+ *    Input: the heap
+ *    Output: none
+ ***********************************************************************/
+EXTERN void kma_heap_destroy(kma_heap_t* heap);
+
+/***********************************************************************
+ *  Title: Allocates kernel memory from a heap
+ * ---------------------------------------------------------------------
+ *    Purpose: Like kma_malloc(), from the pages of the given heap
+ *    Input: the heap, the size
+ *    Output: the allocated memory or NULL on failure
+ ***********************************************************************/
+EXTERN void* kma_heap_malloc(kma_heap_t* heap, kma_size_t size);
+
+/***********************************************************************
+ *  Title: Frees kernel memory to a heap
+ * ---------------------------------------------------------------------
+ *    Purpose: Like kma_free(), for memory from kma_heap_malloc() on the
+ *             same heap
+ *    Input: the heap, the pointer to the memory space, its size or
+ *           KMA_UNSIZED
+ *    Output: none
+ ***********************************************************************/
+EXTERN void kma_heap_free(kma_heap_t* heap, void*, kma_size_t size);
+
+/***********************************************************************
+ *  Title: Allocates kernel memory with flags
+ * ---------------------------------------------------------------------
+ *    Purpose: Like kma_malloc(), for callers that say what kind of
+ *             memory they want. KMA_ZERO clears it, KMA_TEMP takes it
+ *             from pages kept apart for short-lived memory, KMA_NOWAIT
+ *             only uses pages the allocator already has. The memory is
+ *             freed with kma_free() as usual
+ *    Input: the size, the flags
+ *    Output: the allocated memory or NULL on failure
+ ***********************************************************************/
+EXTERN void* kma_malloc_flags(kma_size_t size, int flags);
+
+/***********************************************************************
+ *  Title: Reclaims cached memory
+ * ---------------------------------------------------------------------
+ *    Purpose: Gives back the pages the allocator holds without a live
+ *             block on them, such as pages whose blocks all sit on
+ *             free lists. page_reserve() runs it when the page budget
+ *             would be exceeded, so it should tell at once when it
+ *             holds nothing it could give back
+ *    Input: none
+ *    Output: the number of pages given back, -1 if there was nothing
+ *            to give back
+ ***********************************************************************/
+EXTERN int kma_reclaim();
+
+/***********************************************************************
+ *  Title: Reports what the allocator holds
+ * ---------------------------------------------------------------------
+ *    Purpose: Fills in the pages of the current heap split into data
+ *             and control pages, the bytes of the data pages that are
+ *             handed out and that are free, and the handed out and
+ *             free blocks of every size class or buddy order. Walks
+ *             the allocator's lists, so it is meant for sampling and
+ *             not for every call
+ *    Input: the statistics to fill in
+ *    Output: none
+ ***********************************************************************/
+EXTERN void kma_get_stats(kma_stats_t* stats);
+
 /************External Declaration*****************************************/
 
 /**************Definition***************************************************/
@@ -0,0 +1,263 @@
+/***************************************************************************
+ *  Title: Heap Aging Benchmark
+ * -------------------------------------------------------------------------
+ *    Purpose: Drive a steady-state live set through a long run of
+ *             alloc/free pairs whose size distribution drifts slowly,
+ *             and sample footprint, waste and latency along the way
+ *    Author: Yang Yang
+ *    Copyright: 2014 Northwestern University
+ ***************************************************************************/
+#define __KMA_AGING_IMPL__
+
+/************System include***********************************************/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/************Private include**********************************************/
+#include "kma_page.h"
+#include "kma.h"
+#include "kma_bench.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#define DEFAULT_OPS		20000000LL
+#define DEFAULT_LIVE	4096
+#define DEFAULT_SAMPLES	100
+#define DEFAULT_CYCLES	2
+#define DEFAULT_SEED	343
+#define DEFAULT_OUTPUT	"kma_aging.dat"
+
+// log2 range the centre of the size distribution drifts through
+#define CENTER_LO	5.0
+#define CENTER_HI	10.0
+// log2 width of the size distribution around its centre
+#define SPREAD		2.0
+
+// alloc/free pairs generated and timed together
+#define BATCH		1024
+// one batch in TAIL_EVERY times every op on its own to catch the worst case
+#define TAIL_EVERY	16
+
+// one live object
+typedef struct slot {
+	void *ptr;
+	int size;
+} slot_t;
+
+// one alloc/free pair: replace the object in slot with a new one of size
+typedef struct step {
+	int slot;
+	int size;
+} step_t;
+
+// what one sampling interval measured
+typedef struct sample {
+	long long ops;
+	int pages;
+	long long live;
+	long long time;
+	long long timed_ops;
+	long long max_op;
+} sample_t;
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+static double drift_center(long long done, long long total, int cycles);
+static int draw_size(unsigned long long *rng, double center);
+static void run_batch(slot_t *slots, step_t *steps, int n, long long *live, sample_t *s, int per_op);
+static void report_cycles(sample_t *samples, int n, int cycles);
+void usage(char *prog);
+void error(char *message, char *arg);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+int main(int argc, char *argv[]) {
+	long long total = DEFAULT_OPS;
+	int nlive = DEFAULT_LIVE;
+	int nsamples = DEFAULT_SAMPLES;
+	int cycles = DEFAULT_CYCLES;
+	unsigned long long rng = DEFAULT_SEED;
+	char *output = DEFAULT_OUTPUT;
+	int cpu = -1;
+	slot_t *slots;
+	step_t *steps;
+	sample_t *samples;
+	FILE *out;
+	long long live = 0, done = 0, interval, batches = 0;
+	int i, k, c;
+
+	while((c = getopt(argc, argv, "n:l:i:d:s:c:o:")) != -1) {
+		switch(c) {
+			case 'n': total = atoll(optarg); break;
+			case 'l': nlive = atoi(optarg); break;
+			case 'i': nsamples = atoi(optarg); break;
+			case 'd': cycles = atoi(optarg); break;
+			case 's': rng = strtoull(optarg, NULL, 10); break;
+			case 'c': cpu = atoi(optarg); break;
+			case 'o': output = optarg; break;
+			default: usage(argv[0]);
+		}
+	}
+	if(optind != argc || total <= 0 || nlive <= 0 || nsamples <= 0 || cycles < 0)
+		usage(argv[0]);
+	// xorshift sticks at zero
+	if(rng == 0)
+		rng = DEFAULT_SEED;
+
+	slots = calloc(nlive, sizeof(slot_t));
+	steps = malloc(BATCH * sizeof(step_t));
+	samples = calloc(nsamples, sizeof(sample_t));
+	if(!slots || !steps || !samples)
+		error("out of memory", "benchmark state");
+	if(!(out = fopen(output, "w")))
+		error("cannot open output file", output);
+	cpu = bench_pin_cpu(cpu);
+
+	// fill the live set with the distribution the run starts from
+	for(i = 0; i < nlive; i++) {
+		slots[i].size = draw_size(&rng, drift_center(0, total, cycles));
+		if(!(slots[i].ptr = kma_malloc(slots[i].size)))
+			error("kma_malloc failed while filling the live set", "");
+		live += slots[i].size;
+	}
+
+	printf("Aging %d live objects for %lld ops, %d drift cycles, cpu %d\n", nlive, total, cycles, cpu);
+	fprintf(out, "# ops pages live_bytes waste_ratio mean_ns max_ns\n");
+	// every step is a free and a malloc
+	interval = (total + nsamples - 1) / nsamples;
+	for(k = 0; k < nsamples && done < total; k++) {
+		sample_t *s = &samples[k];
+		long long end = done + interval < total ? done + interval : total;
+		while(done < end) {
+			double center = drift_center(done, total, cycles);
+			int n = (end - done + 1) / 2;
+			if(n > BATCH)
+				n = BATCH;
+			for(i = 0; i < n; i++) {
+				steps[i].slot = bench_rand(&rng) % nlive;
+				steps[i].size = draw_size(&rng, center);
+			}
+			run_batch(slots, steps, n, &live, s, (batches++ % TAIL_EVERY) == TAIL_EVERY - 1);
+			done += 2 * n;
+		}
+		s->ops = done;
+		s->pages = page_stats()->num_in_use;
+		s->live = live;
+		fprintf(out, "%lld %d %lld %f %.1f %lld\n", s->ops, s->pages, s->live,
+				(double)((long long)s->pages * PAGESIZE - live) / live,
+				s->timed_ops ? (double)s->time / s->timed_ops : 0.0, s->max_op);
+	}
+	fclose(out);
+	nsamples = k;
+
+	report_cycles(samples, nsamples, cycles);
+
+	for(i = 0; i < nlive; i++)
+		kma_free(slots[i].ptr, slots[i].size);
+	if(page_stats()->num_in_use != 0)
+		printf("Pages still in use after freeing everything: %d\n", page_stats()->num_in_use);
+
+	free(slots);
+	free(steps);
+	free(samples);
+	return 0;
+}
+
+// the centre sweeps CENTER_LO..CENTER_HI and back once per cycle, so
+// the end of every cycle sees the same distribution as its start
+static double drift_center(long long done, long long total, int cycles) {
+	double phase = 2 * M_PI * cycles * ((double)done / total);
+	return CENTER_LO + (CENTER_HI - CENTER_LO) * (0.5 - 0.5 * cos(phase));
+}
+
+// log-uniform around the centre, like the "log" traces
+static int draw_size(unsigned long long *rng, double center) {
+	double r = (bench_rand(rng) >> 11) * (1.0 / 9007199254740992.0);
+	int size = (int)pow(2.0, center + (r - 0.5) * SPREAD);
+	return size < 1 ? 1 : size;
+}
+
+static void run_batch(slot_t *slots, step_t *steps, int n, long long *live, sample_t *s, int per_op) {
+	long long start, t;
+	int i;
+
+	if(!per_op) {
+		start = bench_now_ns();
+		for(i = 0; i < n; i++) {
+			slot_t *o = &slots[steps[i].slot];
+			kma_free(o->ptr, o->size);
+			// a slot can come up again in the batch, so stop before
+			// its NULL is freed or counted
+			if(!(o->ptr = kma_malloc(steps[i].size)))
+				error("kma_malloc failed during the run", "");
+			*live += steps[i].size - o->size;
+			o->size = steps[i].size;
+		}
+		s->time += bench_now_ns() - start;
+		s->timed_ops += 2 * n;
+	} else {
+		// the clock reads would inflate the mean, so these only feed the max
+		for(i = 0; i < n; i++) {
+			slot_t *o = &slots[steps[i].slot];
+			start = bench_now_ns();
+			kma_free(o->ptr, o->size);
+			t = bench_now_ns();
+			if(t - start > s->max_op)
+				s->max_op = t - start;
+			o->ptr = kma_malloc(steps[i].size);
+			start = bench_now_ns();
+			if(!o->ptr)
+				error("kma_malloc failed during the run", "");
+			if(start - t > s->max_op)
+				s->max_op = start - t;
+			*live += steps[i].size - o->size;
+			o->size = steps[i].size;
+		}
+	}
+}
+
+// compare the first and the last drift cycle: both see the same sizes,
+// so any difference is the heap aging
+static void report_cycles(sample_t *samples, int n, int cycles) {
+	int per = cycles > 0 ? n / cycles : n;
+	int i, j;
+
+	if(per == 0)
+		per = n;
+	for(j = 0; j < 2; j++) {
+		int from = j == 0 ? 0 : n - per;
+		double pages = 0, waste = 0, time = 0, ops = 0;
+		long long max_op = 0;
+		for(i = from; i < from + per; i++) {
+			pages += samples[i].pages;
+			waste += (double)((long long)samples[i].pages * PAGESIZE - samples[i].live) / samples[i].live;
+			time += samples[i].time;
+			ops += samples[i].timed_ops;
+			if(samples[i].max_op > max_op)
+				max_op = samples[i].max_op;
+		}
+		printf("%s cycle: pages %.1f, waste ratio %f, mean %.1f ns/op, max %lld ns\n",
+				j == 0 ? "First" : "Last ", pages / per, waste / per, ops ? time / ops : 0.0, max_op);
+	}
+}
+
+void usage(char *prog) {
+	fprintf(stderr, "Usage: %s [-n ops] [-l liveObjects] [-i samples] [-d driftCycles] "
+			"[-s seed] [-c cpu] [-o output]\n", prog);
+	exit(1);
+}
+
+void error(char *message, char *arg) {
+	fprintf(stderr, "ERROR: %s: %s.\n", message, arg);
+	exit(1);
+}
@@ -0,0 +1,10 @@
+set term png
+set output "kma_aging.png"
+set xlabel "ops"
+set y2tics
+plot "kma_aging.dat" using 1:2 with lines title "Pages", \
+     "kma_aging.dat" using 1:4 axes x1y2 with lines title "Waste ratio"
+
+set output "kma_aging_latency.png"
+plot "kma_aging.dat" using 1:5 with lines title "Mean ns/op", \
+     "kma_aging.dat" using 1:6 axes x1y2 with lines title "Max ns/op"
@@ -0,0 +1,712 @@
+/***************************************************************************
+ *  Title: Application Benchmarks
+ * -------------------------------------------------------------------------
+ *    Purpose: Data structure workloads that live on kma_malloc/kma_free
+ *             and actually touch their memory, so allocator placement
+ *             shows up as cache behaviour
+ *    Author: Yang Yang
+ *    Copyright: 2014 Northwestern University
+ ***************************************************************************/
+#define __KMA_APPS_IMPL__
+
+/************System include***********************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/************Private include**********************************************/
+#include "kma_page.h"
+#include "kma.h"
+#include "kma_bench.h"
+#ifdef KMA_ARENA
+#include "kma_arena.h"
+#endif
+#ifdef KMA_P2FL
+#include "kma_p2fl.h"
+#endif
+#ifdef KMA_MCK2
+#include "kma_mck2.h"
+#endif
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#define DEFAULT_ITEMS	50000
+#define DEFAULT_RUNS	3
+#define DEFAULT_SEED	343
+
+// lookups per inserted key in the hash table and the tree
+#define LOOKUPS		4
+// full traversals of the linked list
+#define TRAVERSALS	20
+// longest string the string workload builds
+#define MAX_STRING	2000
+// packets of one size that come and go together, and how many of these
+// bursts the packet pipeline keeps in flight
+#define BURST		32
+#define IN_FLIGHT	64
+// objects one session of the session workloads builds and drops
+#define SESSION_ITEMS	1000
+// short-lived objects per long-lived one in the mixed workloads, and how
+// many of the short-lived ones are live at a time
+#define TEMP_PER_KEPT	16
+#define TEMP_LIVE		512
+// how a session drops its objects
+#define DROP_FREE		0
+#define DROP_HEAP		1
+#define DROP_REWIND		2
+
+#define RED		1
+#define BLACK	0
+
+// chained hash table node
+struct hash_node {
+	unsigned long long key;
+	long value;
+	struct hash_node *next;
+};
+
+// left-leaning red-black tree node
+struct rb_node {
+	unsigned long long key;
+	long value;
+	struct rb_node *left;
+	struct rb_node *right;
+	int color;
+};
+
+// list node, the payload follows the header
+struct list_node {
+	struct list_node *next;
+	int len;
+	unsigned char data[0];
+};
+
+// one workload: how much work it did and the most pages it held
+struct app_result {
+	long long ops;
+	int peak_pages;
+	long checksum;
+};
+
+typedef void (*app_fn)(int n, unsigned long long seed, struct app_result *res);
+
+/************Global Variables*********************************************/
+
+// keeps the compiler from dropping the lookups and traversals
+static volatile long gSink;
+
+/************Function Prototypes******************************************/
+static void app_hash(int n, unsigned long long seed, struct app_result *res);
+static void app_rbtree(int n, unsigned long long seed, struct app_result *res);
+static void app_list(int n, unsigned long long seed, struct app_result *res);
+static void app_strings(int n, unsigned long long seed, struct app_result *res);
+static void app_packets(int n, unsigned long long seed, struct app_result *res);
+static void app_batch(int n, unsigned long long seed, struct app_result *res);
+static void app_sessions(int n, unsigned long long seed, struct app_result *res);
+static void app_heaps(int n, unsigned long long seed, struct app_result *res);
+static void app_mixed(int n, unsigned long long seed, struct app_result *res);
+static void app_temp(int n, unsigned long long seed, struct app_result *res);
+#ifdef KMA_ARENA
+static void app_rewind(int n, unsigned long long seed, struct app_result *res);
+#endif
+static void note_peak(struct app_result *res);
+static void *xmalloc(int size);
+void usage(char *prog);
+void error(char *message, char *arg);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+static struct {
+	char *name;
+	app_fn run;
+} apps[] = {
+	{ "hash",		app_hash },
+	{ "rbtree",		app_rbtree },
+	{ "list",		app_list },
+	{ "strings",	app_strings },
+	{ "packets",	app_packets },
+	{ "batch",		app_batch },
+	{ "sessions",	app_sessions },
+	{ "heaps",		app_heaps },
+	{ "mixed",		app_mixed },
+	{ "temp",		app_temp },
+#ifdef KMA_ARENA
+	{ "rewind",		app_rewind },
+#endif
+};
+
+int main(int argc, char *argv[]) {
+	int n = DEFAULT_ITEMS, runs = DEFAULT_RUNS, cpu = -1;
+	unsigned long long seed = DEFAULT_SEED;
+	char *only = NULL;
+	int a, r, c;
+
+	while((c = getopt(argc, argv, "n:r:s:c:w:HC:")) != -1) {
+		switch(c) {
+			case 'n': n = atoi(optarg); break;
+			case 'r': runs = atoi(optarg); break;
+			case 's': seed = strtoull(optarg, NULL, 10); break;
+			case 'c': cpu = atoi(optarg); break;
+			case 'w': only = optarg; break;
+#ifdef KMA_P2FL
+			case 'H': kma_p2fl_set_headerless(TRUE); break;
+#endif
+#ifdef KMA_MCK2
+			case 'C':
+				if(!kma_mck2_set_classes(atoi(optarg)))
+					usage(argv[0]);
+				break;
+#endif
+			default: usage(argv[0]);
+		}
+	}
+	if(optind != argc || n < 2 || runs < 1)
+		usage(argv[0]);
+	if(seed == 0)
+		seed = DEFAULT_SEED;
+	cpu = bench_pin_cpu(cpu);
+
+	printf("%-8s %10s %12s %10s %6s\n", "workload", "ms", "ops", "Mops/s", "pages");
+	for(a = 0; a < sizeof(apps) / sizeof(apps[0]); a++) {
+		struct app_result res;
+		long long best = -1, t;
+		if(only && strcmp(only, apps[a].name))
+			continue;
+		for(r = 0; r < runs; r++) {
+			memset(&res, 0, sizeof(res));
+			t = bench_now_ns();
+			apps[a].run(n, seed, &res);
+			t = bench_now_ns() - t;
+			if(page_stats()->num_in_use != 0)
+				error("not all pages freed after", apps[a].name);
+			if(best < 0 || t < best)
+				best = t;
+			gSink += res.checksum;
+		}
+		printf("%-8s %10.3f %12lld %10.2f %6d\n", apps[a].name, best / 1e6, res.ops,
+				res.ops * 1e3 / best, res.peak_pages);
+	}
+	return 0;
+}
+
+static void note_peak(struct app_result *res) {
+	if(page_stats()->num_in_use > res->peak_pages)
+		res->peak_pages = page_stats()->num_in_use;
+}
+
+static void *xmalloc(int size) {
+	void *ptr = kma_malloc(size);
+	if(!ptr)
+		error("kma_malloc failed", "");
+	return ptr;
+}
+
+/************Hash table*****************************************************/
+
+static void app_hash(int n, unsigned long long seed, struct app_result *res) {
+	struct hash_node **buckets, *node, **link;
+	unsigned long long *keys, rng = seed;
+	int nb = 1, i;
+	long found = 0;
+
+	while(nb < n / 2)
+		nb <<= 1;
+	buckets = calloc(nb, sizeof(struct hash_node*));
+	keys = malloc(n * sizeof(unsigned long long));
+
+	for(i = 0; i < n; i++) {
+		keys[i] = bench_rand(&rng);
+		node = xmalloc(sizeof(struct hash_node));
+		node->key = keys[i];
+		node->value = i;
+		node->next = buckets[keys[i] & (nb - 1)];
+		buckets[keys[i] & (nb - 1)] = node;
+	}
+	note_peak(res);
+
+	// half hits, half misses
+	for(i = 0; i < LOOKUPS * n; i++) {
+		unsigned long long key = (i & 1) ? keys[bench_rand(&rng) % n] : bench_rand(&rng);
+		for(node = buckets[key & (nb - 1)]; node; node = node->next)
+			if(node->key == key) {
+				found += node->value;
+				break;
+			}
+	}
+
+	// delete in insertion order, so the chains are unlinked from the middle
+	for(i = 0; i < n; i++) {
+		for(link = &buckets[keys[i] & (nb - 1)]; (*link)->key != keys[i]; link = &(*link)->next)
+			;
+		node = *link;
+		*link = node->next;
+		kma_free(node, sizeof(struct hash_node));
+	}
+
+	free(keys);
+	free(buckets);
+	res->ops = (long long)n * (2 + LOOKUPS);
+	res->checksum = found;
+}
+
+/************Red-black tree*************************************************/
+
+static int is_red(struct rb_node *h) {
+	return h && h->color == RED;
+}
+
+static struct rb_node *rotate_left(struct rb_node *h) {
+	struct rb_node *x = h->right;
+	h->right = x->left;
+	x->left = h;
+	x->color = h->color;
+	h->color = RED;
+	return x;
+}
+
+static struct rb_node *rotate_right(struct rb_node *h) {
+	struct rb_node *x = h->left;
+	h->left = x->right;
+	x->right = h;
+	x->color = h->color;
+	h->color = RED;
+	return x;
+}
+
+static void flip_colors(struct rb_node *h) {
+	h->color = !h->color;
+	h->left->color = !h->left->color;
+	h->right->color = !h->right->color;
+}
+
+static struct rb_node *fix_up(struct rb_node *h) {
+	if(is_red(h->right) && !is_red(h->left))
+		h = rotate_left(h);
+	if(is_red(h->left) && is_red(h->left->left))
+		h = rotate_right(h);
+	if(is_red(h->left) && is_red(h->right))
+		flip_colors(h);
+	return h;
+}
+
+static struct rb_node *rb_insert(struct rb_node *h, unsigned long long key, long value) {
+	if(!h) {
+		h = xmalloc(sizeof(struct rb_node));
+		h->key = key;
+		h->value = value;
+		h->left = h->right = NULL;
+		h->color = RED;
+		return h;
+	}
+	if(key < h->key)
+		h->left = rb_insert(h->left, key, value);
+	else if(key > h->key)
+		h->right = rb_insert(h->right, key, value);
+	else
+		h->value = value;
+	return fix_up(h);
+}
+
+static struct rb_node *move_red_left(struct rb_node *h) {
+	flip_colors(h);
+	if(is_red(h->right->left)) {
+		h->right = rotate_right(h->right);
+		h = rotate_left(h);
+		flip_colors(h);
+	}
+	return h;
+}
+
+static struct rb_node *move_red_right(struct rb_node *h) {
+	flip_colors(h);
+	if(is_red(h->left->left)) {
+		h = rotate_right(h);
+		flip_colors(h);
+	}
+	return h;
+}
+
+static struct rb_node *rb_delete_min(struct rb_node *h) {
+	if(!h->left) {
+		kma_free(h, sizeof(struct rb_node));
+		return NULL;
+	}
+	if(!is_red(h->left) && !is_red(h->left->left))
+		h = move_red_left(h);
+	h->left = rb_delete_min(h->left);
+	return fix_up(h);
+}
+
+// the key must be in the tree
+static struct rb_node *rb_delete(struct rb_node *h, unsigned long long key) {
+	struct rb_node *m;
+	if(key < h->key) {
+		if(!is_red(h->left) && !is_red(h->left->left))
+			h = move_red_left(h);
+		h->left = rb_delete(h->left, key);
+	} else {
+		if(is_red(h->left))
+			h = rotate_right(h);
+		if(key == h->key && !h->right) {
+			kma_free(h, sizeof(struct rb_node));
+			return NULL;
+		}
+		if(!is_red(h->right) && !is_red(h->right->left))
+			h = move_red_right(h);
+		if(key == h->key) {
+			for(m = h->right; m->left; m = m->left)
+				;
+			h->key = m->key;
+			h->value = m->value;
+			h->right = rb_delete_min(h->right);
+		} else
+			h->right = rb_delete(h->right, key);
+	}
+	return fix_up(h);
+}
+
+static void app_rbtree(int n, unsigned long long seed, struct app_result *res) {
+	struct rb_node *root = NULL, *node;
+	unsigned long long *keys, rng = seed, tmp;
+	int i, j;
+	long found = 0;
+
+	keys = malloc(n * sizeof(unsigned long long));
+	for(i = 0; i < n; i++) {
+		keys[i] = bench_rand(&rng);
+		root = rb_insert(root, keys[i], i);
+		root->color = BLACK;
+	}
+	note_peak(res);
+
+	for(i = 0; i < LOOKUPS * n; i++) {
+		unsigned long long key = keys[bench_rand(&rng) % n];
+		for(node = root; node && node->key != key; node = key < node->key ? node->left : node->right)
+			;
+		found += node->value;
+	}
+
+	// delete in a shuffled order
+	for(i = n - 1; i > 0; i--) {
+		j = bench_rand(&rng) % (i + 1);
+		tmp = keys[i];
+		keys[i] = keys[j];
+		keys[j] = tmp;
+	}
+	for(i = 0; i < n; i++) {
+		if(!is_red(root->left) && !is_red(root->right))
+			root->color = RED;
+		root = rb_delete(root, keys[i]);
+		if(root)
+			root->color = BLACK;
+	}
+
+	free(keys);
+	res->ops = (long long)n * (2 + LOOKUPS);
+	res->checksum = found;
+}
+
+/************Linked list****************************************************/
+
+static void app_list(int n, unsigned long long seed, struct app_result *res) {
+	struct list_node *head = NULL, **tail = &head, *node;
+	void **garbage;
+	int *garbage_len;
+	unsigned long long rng = seed;
+	int i, k, len;
+	long sum = 0;
+
+	// short-lived allocations between the nodes scatter the list
+	garbage = malloc(n * sizeof(void*));
+	garbage_len = malloc(n * sizeof(int));
+	for(i = 0; i < n; i++) {
+		len = 16 + bench_rand(&rng) % 97;
+		node = xmalloc(sizeof(struct list_node) + len);
+		node->next = NULL;
+		node->len = len;
+		memset(node->data, i, len);
+		*tail = node;
+		tail = &node->next;
+		garbage_len[i] = 8 + bench_rand(&rng) % 249;
+		garbage[i] = xmalloc(garbage_len[i]);
+	}
+	note_peak(res);
+	for(i = 0; i < n; i++)
+		kma_free(garbage[i], garbage_len[i]);
+
+	for(k = 0; k < TRAVERSALS; k++)
+		for(node = head; node; node = node->next)
+			for(i = 0; i < node->len; i += 16)
+				sum += node->data[i];
+
+	while(head) {
+		node = head;
+		head = head->next;
+		kma_free(node, sizeof(struct list_node) + node->len);
+	}
+
+	free(garbage);
+	free(garbage_len);
+	res->ops = (long long)n * (4 + TRAVERSALS);
+	res->checksum = sum;
+}
+
+/************Strings********************************************************/
+
+static int compare_strings(const void *lhs, const void *rhs) {
+	return strcmp(*(char * const*)lhs, *(char * const*)rhs);
+}
+
+static void app_strings(int n, unsigned long long seed, struct app_result *res) {
+	char **strs, *s;
+	int *lens;
+	unsigned long long rng = seed;
+	int i, j, a, b, len;
+
+	strs = malloc(n * sizeof(char*));
+	lens = malloc(n * sizeof(int));
+	for(i = 0; i < n; i++) {
+		lens[i] = 8 + bench_rand(&rng) % 113;
+		strs[i] = xmalloc(lens[i] + 1);
+		for(j = 0; j < lens[i]; j++)
+			strs[i][j] = 'a' + bench_rand(&rng) % 26;
+		strs[i][lens[i]] = '\0';
+	}
+
+	// concatenate pairs into fresh buffers, dropping the old string
+	for(i = 0; i < n; i++) {
+		a = bench_rand(&rng) % n;
+		b = bench_rand(&rng) % n;
+		len = lens[a] + lens[b];
+		if(a == b || len > MAX_STRING)
+			continue;
+		s = xmalloc(len + 1);
+		memcpy(s, strs[a], lens[a]);
+		memcpy(s + lens[a], strs[b], lens[b] + 1);
+		kma_free(strs[a], lens[a] + 1);
+		strs[a] = s;
+		lens[a] = len;
+	}
+	note_peak(res);
+
+	qsort(strs, n, sizeof(char*), compare_strings);
+	for(i = 0; i < n; i++)
+		kma_free(strs[i], strlen(strs[i]) + 1);
+
+	free(strs);
+	free(lens);
+	res->ops = (long long)n * 4;
+}
+
+/************Packet pipeline************************************************/
+
+// bursts of same-size packets are received, held while IN_FLIGHT newer
+// bursts arrive, and dropped in the order the consumer finished them.
+// batched goes through kma_malloc_batch/kma_free_batch, otherwise every
+// packet is a kma_malloc/kma_free of its own
+static void run_packets(int n, unsigned long long seed, struct app_result *res, int batched) {
+	void **ring, **burst, *recv[BURST];
+	int *sizes;
+	unsigned long long rng = seed;
+	int bursts = (n + BURST - 1) / BURST;
+	int b, i, slot;
+	long sum = 0;
+
+	ring = malloc(IN_FLIGHT * BURST * sizeof(void*));
+	sizes = malloc(IN_FLIGHT * sizeof(int));
+	for(b = 0; b < bursts + IN_FLIGHT; b++) {
+		slot = b % IN_FLIGHT;
+		burst = ring + slot * BURST;
+		if(b >= IN_FLIGHT) {
+			for(i = 0; i < BURST; i++)
+				sum += ((unsigned char*)burst[i])[0] + ((unsigned char*)burst[i])[sizes[slot] - 1];
+			if(batched)
+				kma_free_batch(burst, BURST);
+			else
+				for(i = 0; i < BURST; i++)
+					kma_free(burst[i], sizes[slot]);
+		}
+		if(b >= bursts)
+			continue;
+		sizes[slot] = 64 + bench_rand(&rng) % 1437;
+		if(batched) {
+			if(kma_malloc_batch(sizes[slot], BURST, recv) != BURST)
+				error("kma_malloc_batch failed", "");
+		} else {
+			for(i = 0; i < BURST; i++)
+				recv[i] = xmalloc(sizes[slot]);
+		}
+		// the consumer finishes the packets out of order
+		for(i = 0; i < BURST; i++) {
+			memset(recv[i], b, 64);
+			((unsigned char*)recv[i])[sizes[slot] - 1] = i;
+			burst[(i * 7) % BURST] = recv[i];
+		}
+		note_peak(res);
+	}
+
+	free(ring);
+	free(sizes);
+	res->ops = (long long)bursts * BURST * 2;
+	res->checksum = sum;
+}
+
+static void app_packets(int n, unsigned long long seed, struct app_result *res) {
+	run_packets(n, seed, res, 0);
+}
+
+static void app_batch(int n, unsigned long long seed, struct app_result *res) {
+	run_packets(n, seed, res, 1);
+}
+
+/************Sessions*******************************************************/
+
+// every session builds a list of small objects, walks it and drops it,
+// while one long-lived object stays allocated for the whole run. the
+// objects are freed one by one, or go with a heap of their own that is
+// destroyed, or with a rewind of the arena to where the session started
+static void run_sessions(int n, unsigned long long seed, struct app_result *res, int drop) {
+	struct list_node *head, *node;
+	kma_heap_t *heap = NULL;
+#ifdef KMA_ARENA
+	kma_mark_t mark = 0;
+#endif
+	void *pinned;
+	unsigned long long rng = seed;
+	int sessions = (n + SESSION_ITEMS - 1) / SESSION_ITEMS;
+	int s, i, len;
+	long sum = 0;
+
+	pinned = xmalloc(64);
+	for(s = 0; s < sessions; s++) {
+		if(drop == DROP_HEAP && !(heap = kma_heap_create()))
+			error("kma_heap_create failed", "");
+#ifdef KMA_ARENA
+		if(drop == DROP_REWIND)
+			mark = kma_arena_mark();
+#endif
+		head = NULL;
+		for(i = 0; i < SESSION_ITEMS; i++) {
+			len = 16 + bench_rand(&rng) % 97;
+			node = drop == DROP_HEAP ? kma_heap_malloc(heap, sizeof(struct list_node) + len) :
+					xmalloc(sizeof(struct list_node) + len);
+			if(!node)
+				error("kma_heap_malloc failed", "");
+			node->next = head;
+			node->len = len;
+			memset(node->data, i, len);
+			head = node;
+		}
+		note_peak(res);
+		for(node = head; node; node = node->next)
+			sum += node->data[node->len - 1];
+		if(drop == DROP_HEAP)
+			kma_heap_destroy(heap);
+#ifdef KMA_ARENA
+		else if(drop == DROP_REWIND)
+			kma_arena_rewind(mark);
+#endif
+		else
+			while(head) {
+				node = head;
+				head = head->next;
+				kma_free(node, sizeof(struct list_node) + node->len);
+			}
+	}
+	kma_free(pinned, 64);
+
+	res->ops = (long long)sessions * SESSION_ITEMS * 2;
+	res->checksum = sum;
+}
+
+static void app_sessions(int n, unsigned long long seed, struct app_result *res) {
+	run_sessions(n, seed, res, DROP_FREE);
+}
+
+static void app_heaps(int n, unsigned long long seed, struct app_result *res) {
+	run_sessions(n, seed, res, DROP_HEAP);
+}
+
+#ifdef KMA_ARENA
+static void app_rewind(int n, unsigned long long seed, struct app_result *res) {
+	run_sessions(n, seed, res, DROP_REWIND);
+}
+#endif
+
+/************Mixed lifetimes************************************************/
+
+// a list of long-lived objects grows while many more short-lived ones
+// come and go around it, like request buffers next to the cache they
+// fill. temp_flags is passed for the short-lived ones, so with KMA_TEMP
+// they stay off the pages of the list
+static void run_mixed(int n, unsigned long long seed, struct app_result *res, int temp_flags) {
+	struct list_node *head = NULL, *node;
+	void **ring;
+	int *sizes;
+	unsigned long long rng = seed;
+	int i, slot, len;
+	long sum = 0;
+
+	ring = calloc(TEMP_LIVE, sizeof(void*));
+	sizes = malloc(TEMP_LIVE * sizeof(int));
+	for(i = 0; i < n; i++) {
+		slot = i % TEMP_LIVE;
+		if(ring[slot]) {
+			sum += ((unsigned char*)ring[slot])[sizes[slot] - 1];
+			kma_free(ring[slot], sizes[slot]);
+		}
+		sizes[slot] = 16 + bench_rand(&rng) % 241;
+		if(!(ring[slot] = kma_malloc_flags(sizes[slot], temp_flags)))
+			error("kma_malloc_flags failed", "");
+		memset(ring[slot], i, sizes[slot]);
+		if(i % TEMP_PER_KEPT == 0) {
+			len = 16 + bench_rand(&rng) % 97;
+			node = xmalloc(sizeof(struct list_node) + len);
+			node->next = head;
+			node->len = len;
+			memset(node->data, i, len);
+			head = node;
+			note_peak(res);
+		}
+	}
+	for(slot = 0; slot < TEMP_LIVE; slot++)
+		if(ring[slot])
+			kma_free(ring[slot], sizes[slot]);
+	while(head) {
+		node = head;
+		head = head->next;
+		sum += node->data[0];
+		kma_free(node, sizeof(struct list_node) + node->len);
+	}
+
+	free(ring);
+	free(sizes);
+	res->ops = (long long)(n + (n + TEMP_PER_KEPT - 1) / TEMP_PER_KEPT) * 2;
+	res->checksum = sum;
+}
+
+static void app_mixed(int n, unsigned long long seed, struct app_result *res) {
+	run_mixed(n, seed, res, 0);
+}
+
+static void app_temp(int n, unsigned long long seed, struct app_result *res) {
+	run_mixed(n, seed, res, KMA_TEMP);
+}
+
+void usage(char *prog) {
+	fprintf(stderr, "Usage: %s [-n items] [-r runs] [-s seed] [-c cpu] [-w workload] [-H] [-C classes]\n", prog);
+	exit(1);
+}
+
+void error(char *message, char *arg) {
+	fprintf(stderr, "ERROR: %s: %s.\n", message, arg);
+	exit(1);
+}
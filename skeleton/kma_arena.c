@@ -0,0 +1,644 @@
+/***************************************************************************
+ *  Title: Kernel Memory Allocator
+ * -------------------------------------------------------------------------
+ *    Purpose: Kernel memory allocator based on arenas: blocks are bumped
+ *             off the current page and pages go back whole
+ *    Author: Yang Yang
+ *    Copyright: 2014 Northwestern University
+ ***************************************************************************/
+#ifdef KMA_ARENA
+#define __KMA_IMPL__
+#define __KMA_ARENA_IMPL__
+
+/************System include***********************************************/
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+/************Private include**********************************************/
+#include "kma_page.h"
+#include "kma.h"
+#include "kma_arena.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+inline void *get_page_start(void *addr) {
+	return (void*)((unsigned long)addr & ~((unsigned long)(PAGESIZE-1)));
+};
+
+inline void *get_page_end(void *addr) {
+	return (void*)((char*)get_page_start(addr) + PAGESIZE);
+}
+
+// the entry point of the first page, the control page of the default
+// heap
+static kma_page_t *first_page = NULL;
+// pages are numbered in the order the arenas take them, a mark is the
+// number of a page and an offset on it
+static long next_seq = 0;
+
+// blocks are handed out in whole units, so the size in front of a
+// block leads to the next one
+#define UNIT		(8)
+
+// round a request up to whole units, a zero request still takes one
+inline int round_unit(int size) {
+	return size ? (size + UNIT - 1) & ~(UNIT - 1) : UNIT;
+}
+
+// round an address up to a multiple of align
+inline char *align_up(char *ptr, kma_size_t align) {
+	return (char*)(((unsigned long)ptr + align - 1) & ~((unsigned long)align - 1));
+}
+
+// the record of a page, kept off the page as the resource map does, so
+// that a request of a whole page still fits behind the back pointer
+// every page starts with
+struct page_rec {
+	kma_page_t *page;
+	struct page_rec *prev;
+	struct page_rec *next;
+	char *top;		// the first byte not handed out yet
+	long seq;
+	int live;		// blocks on the page not freed yet
+	int big;		// the page holds one block too large to share a page
+	int temp;		// the page only holds KMA_TEMP blocks
+};
+
+// in front of every block on a shared page
+struct block_hdr {
+	int size;		// the rounded size, the next block follows it
+	int freed;
+};
+
+// the control unit of this allocator, one for the default heap and one
+// for every kma_heap_create
+struct arena_ctl {
+	kma_page_t *page;				// the page the unit is on
+	int total_alloc;
+	int total_free;
+	struct page_rec page_list;		// pages we allocate from, oldest first
+	struct page_rec ctl_page_list;	// pages holding records
+	struct page_rec unused_list;
+	struct page_rec *cur;			// the page blocks are bumped off
+	int zero;						// nothing above cur->top was ever written
+	struct page_rec *temp_cur;		// the same for KMA_TEMP blocks
+	int temp_zero;
+	int heap;						// only kma_heap_destroy releases the pages
+};
+
+static inline struct arena_ctl *get_arena_ctl() {
+	assert(first_page);
+	return (struct arena_ctl*)(first_page->ptr);
+}
+
+/*
+ * a lot of list operation functions
+ */
+void list_append(struct page_rec *item, struct page_rec *header) {
+	item->prev = header->prev;
+	item->next = header;
+	header->prev = item;
+	item->prev->next = item;
+}
+
+void list_insert_head(struct page_rec *item, struct page_rec *header) {
+	item->prev = header;
+	item->next = header->next;
+	header->next = item;
+	item->next->prev = item;
+}
+
+void list_remove(struct page_rec *item) {
+	item->prev->next = item->next;
+	item->next->prev = item->prev;
+}
+
+extern struct page_rec *get_unused_page_rec(struct arena_ctl *ctl);
+extern void release_pages(struct arena_ctl *ctl);
+
+// add and initialize all the records in a new allocated page
+void add_page_for_page_rec(struct arena_ctl *ctl) {
+	struct page_rec *cur, *end;
+	kma_page_t *page;
+	assert(ctl);
+	page = get_page();
+	cur = (struct page_rec*)(page->ptr);
+	end = (struct page_rec*)get_page_end(cur);
+	for(; cur + 1 < end; cur++) {
+		list_append(cur, &(ctl->unused_list));
+	}
+	cur = get_unused_page_rec(ctl);
+	cur->page = page;
+	list_append(cur, &(ctl->ctl_page_list));
+}
+
+// set up a control unit on a new page
+struct arena_ctl *init_ctl() {
+	struct arena_ctl *ctl;
+	struct page_rec *cur, *end;
+	kma_page_t *page = get_page();
+	memset(page->ptr, 0, page->size);
+	ctl = (struct arena_ctl*)(page->ptr);
+	ctl->page = page;
+	ctl->total_alloc = 0;
+	ctl->total_free = 0;
+	ctl->page_list.prev = ctl->page_list.next = &(ctl->page_list);
+	ctl->ctl_page_list.prev = ctl->ctl_page_list.next = &(ctl->ctl_page_list);
+	ctl->unused_list.prev = ctl->unused_list.next = &(ctl->unused_list);
+	ctl->cur = ctl->temp_cur = NULL;
+	cur = (struct page_rec*)((char*)ctl + sizeof(struct arena_ctl));
+	end = (struct page_rec*)get_page_end((void*)cur);
+
+	// use the rest room of the first page
+	for(; cur + 1 < end; cur++) {
+		list_append(cur, &(ctl->unused_list));
+	}
+	return ctl;
+}
+
+// the default heap, which the first request sets up. NULL if the page
+// for it cannot be had
+static struct arena_ctl *get_default_ctl(int flags) {
+	if(!first_page) {
+		if((flags & KMA_NOWAIT) || !page_reserve(1))
+			return NULL;
+		first_page = init_ctl()->page;
+	}
+	return get_arena_ctl();
+}
+
+// get unused record
+struct page_rec *get_unused_page_rec(struct arena_ctl *ctl) {
+	struct page_rec *rec;
+	assert(ctl);
+	if(ctl->unused_list.prev == &(ctl->unused_list))
+		add_page_for_page_rec(ctl);
+	rec = ctl->unused_list.next;
+	list_remove(rec);
+	return rec;
+}
+
+// return the record to unused list
+void put_unused_page_rec(struct arena_ctl *ctl, struct page_rec *rec) {
+	assert(rec);
+	list_insert_head(rec, &(ctl->unused_list));
+}
+
+// the record of the page a block is on
+inline struct page_rec *get_page_rec(void *ptr) {
+	return *(struct page_rec**)get_page_start(ptr);
+}
+
+// take a new page for the arena, it goes to the end of the page list
+struct page_rec *add_data_page(struct arena_ctl *ctl, int big, int temp) {
+	struct page_rec *rec;
+	rec = get_unused_page_rec(ctl);
+	rec->page = get_page();
+	*(struct page_rec**)(rec->page->ptr) = rec;
+	rec->top = (char*)(rec->page->ptr) + sizeof(struct page_rec*);
+	rec->seq = next_seq++;
+	rec->live = 0;
+	rec->big = big;
+	rec->temp = temp;
+	list_append(rec, &(ctl->page_list));
+	return rec;
+}
+
+// give a page back to the page pool
+void free_data_page(struct arena_ctl *ctl, struct page_rec *rec) {
+	list_remove(rec);
+	free_page(rec->page);
+	put_unused_page_rec(ctl, rec);
+}
+
+// the first request of the default heap set it up, so when the page
+// limit turns that request down the heap goes again, as it would with
+// its last block
+static void release_idle(struct arena_ctl *ctl) {
+	if(ctl->total_alloc == ctl->total_free && !ctl->heap)
+		release_pages(ctl);
+}
+
+// bump a block off the current page, at a multiple of align. zero is set
+// if the block was never written. KMA_TEMP blocks are bumped off pages
+// of their own, KMA_NOWAIT gets NULL rather than a new page
+void *get_block(struct arena_ctl *ctl, kma_size_t size, kma_size_t align, int flags, int *zero) {
+	struct page_rec *rec, **cur;
+	struct block_hdr *hdr;
+	char *ptr = NULL;
+	int first, *cur_zero;
+	if(align < UNIT)
+		align = UNIT;
+	size = round_unit(size);
+
+	// a block that would not fit next to the headers of a fresh page
+	// gets a page of its own with just the back pointer in front
+	first = sizeof(struct page_rec*) + sizeof(struct block_hdr);
+	if(align > first)
+		first = align;
+	if(first + size > PAGESIZE) {
+		if((flags & KMA_NOWAIT) || !page_reserve(2)) {
+			release_idle(ctl);
+			return NULL;
+		}
+		rec = add_data_page(ctl, 1, flags & KMA_TEMP);
+		rec->live = 1;
+		ctl->total_alloc++;
+		*zero = rec->page->zero;
+		return align_up((char*)(rec->page->ptr) + sizeof(struct page_rec*), align);
+	}
+
+	cur = flags & KMA_TEMP ? &(ctl->temp_cur) : &(ctl->cur);
+	cur_zero = flags & KMA_TEMP ? &(ctl->temp_zero) : &(ctl->zero);
+	rec = *cur;
+	if(rec)
+		ptr = align_up(rec->top + sizeof(struct block_hdr), align);
+	// the full page stays until its last block is freed
+	if(!rec || ptr + size > (char*)(rec->page->ptr) + rec->page->size) {
+		if((flags & KMA_NOWAIT) || !page_reserve(2)) {
+			release_idle(ctl);
+			return NULL;
+		}
+		rec = *cur = add_data_page(ctl, 0, flags & KMA_TEMP);
+		*cur_zero = rec->page->zero;
+		ptr = align_up(rec->top + sizeof(struct block_hdr), align);
+	}
+	// the gap an alignment leaves is a freed block of its own
+	if(ptr - sizeof(struct block_hdr) > rec->top) {
+		hdr = (struct block_hdr*)rec->top;
+		hdr->size = ptr - rec->top - 2 * sizeof(struct block_hdr);
+		hdr->freed = 1;
+	}
+	hdr = (struct block_hdr*)ptr - 1;
+	hdr->size = size;
+	hdr->freed = 0;
+	rec->top = ptr + size;
+	rec->live++;
+	ctl->total_alloc++;
+	*zero = *cur_zero;
+	return (void*)ptr;
+}
+
+// free all the pages of a control unit, its own page last
+void release_pages(struct arena_ctl *ctl) {
+	struct page_rec *cur;
+	int count = 0;
+	kma_page_t *page_array[MAXPAGES];
+
+	cur = ctl->page_list.next;
+	while(cur != &(ctl->page_list)) {
+		assert(cur->page->ptr);
+		free_page(cur->page);
+		cur = cur->next;
+	}
+	// the records of these pages are on them
+	cur = ctl->ctl_page_list.next;
+	while(cur != &(ctl->ctl_page_list)) {
+		assert(cur->page->ptr);
+		page_array[count++] = cur->page;
+		cur = cur->next;
+	}
+	for(count = count - 1; count >= 0; count--)
+		free_page(page_array[count]);
+	if(ctl->page == first_page)
+		first_page = NULL;
+	free_page(ctl->page);
+}
+
+void*
+kma_malloc(kma_size_t size)
+{
+	struct arena_ctl *ctl;
+	int zero;
+	if(size + sizeof(void*) > PAGESIZE || !(ctl = get_default_ctl(0)))
+		return NULL;
+	return get_block(ctl, size, UNIT, 0, &zero);
+}
+
+void*
+kma_malloc_flags(kma_size_t size, int flags)
+{
+	struct arena_ctl *ctl;
+	void *ptr;
+	int zero;
+	if(size + sizeof(void*) > PAGESIZE || !(ctl = get_default_ctl(flags)))
+		return NULL;
+	ptr = get_block(ctl, size, UNIT, flags, &zero);
+	if(ptr && (flags & KMA_ZERO) && !zero)
+		zero_block(ptr, size);
+	return ptr;
+}
+
+// the freed blocks on a page stay until the whole page goes, and the
+// room above top is free too. there are no size classes
+void
+kma_get_stats(kma_stats_t* stats)
+{
+	struct arena_ctl *ctl;
+	struct page_rec *rec;
+	struct block_hdr *hdr;
+	char *ptr;
+	memset(stats, 0, sizeof(kma_stats_t));
+	if(!first_page)
+		return;
+	ctl = get_arena_ctl();
+
+	stats->meta_pages = 1;
+	for(rec = ctl->ctl_page_list.next; rec != &(ctl->ctl_page_list); rec = rec->next)
+		stats->meta_pages++;
+	for(rec = ctl->page_list.next; rec != &(ctl->page_list); rec = rec->next) {
+		stats->data_pages++;
+		if(rec->big) {
+			stats->used_bytes += rec->page->size - sizeof(struct page_rec*);
+			continue;
+		}
+		ptr = (char*)(rec->page->ptr) + sizeof(struct page_rec*);
+		for(; ptr < rec->top; ptr += sizeof(struct block_hdr) + hdr->size) {
+			hdr = (struct block_hdr*)ptr;
+			if(hdr->freed)
+				stats->free_bytes += sizeof(struct block_hdr) + hdr->size;
+			else
+				stats->used_bytes += sizeof(struct block_hdr) + hdr->size;
+		}
+		stats->free_bytes += (char*)(rec->page->ptr) + rec->page->size - rec->top;
+	}
+}
+
+// pages are given back as soon as their last block goes, only the
+// current pages are kept when empty. they are all there is to reclaim
+int
+kma_reclaim()
+{
+	struct arena_ctl *ctl;
+	int count = 0;
+	if(!first_page)
+		return -1;
+	ctl = get_arena_ctl();
+	if((!ctl->cur || ctl->cur->live) && (!ctl->temp_cur || ctl->temp_cur->live))
+		return -1;
+	if(ctl->cur && ctl->cur->live == 0) {
+		free_data_page(ctl, ctl->cur);
+		ctl->cur = NULL;
+		count++;
+	}
+	if(ctl->temp_cur && ctl->temp_cur->live == 0) {
+		free_data_page(ctl, ctl->temp_cur);
+		ctl->temp_cur = NULL;
+		count++;
+	}
+	return count;
+}
+
+// free a block of a control unit, which goes with its last block unless
+// it is a heap
+void put_block(struct arena_ctl *ctl, void *ptr) {
+	struct page_rec *rec;
+	assert(ctl);
+
+	rec = get_page_rec(ptr);
+	if(!rec->big)
+		((struct block_hdr*)ptr - 1)->freed = 1;
+	ctl->total_free++;
+	if(--rec->live == 0) {
+		if(rec == ctl->cur || rec == ctl->temp_cur) {
+			// nothing is left on the current page, bump from its start
+			// again. it counts as a new page, so older marks drop it
+			rec->top = (char*)(rec->page->ptr) + sizeof(struct page_rec*);
+			rec->seq = next_seq++;
+			list_remove(rec);
+			list_append(rec, &(ctl->page_list));
+			if(rec == ctl->cur)
+				ctl->zero = 0;
+			else
+				ctl->temp_zero = 0;
+		} else
+			free_data_page(ctl, rec);
+	}
+
+	if(ctl->total_alloc == ctl->total_free && !ctl->heap)
+		release_pages(ctl);
+}
+
+void
+kma_free(void* ptr, kma_size_t size)
+{
+	put_block(get_arena_ctl(), ptr);
+}
+
+void*
+kma_realloc(void* ptr, kma_size_t size, kma_size_t new_size)
+{
+	struct arena_ctl *ctl;
+	struct page_rec *rec;
+	struct block_hdr *hdr;
+	kma_size_t usable;
+	void *new_ptr;
+	if(!ptr)
+		return kma_malloc(new_size);
+	if(new_size + sizeof(void*) > PAGESIZE)
+		return NULL;
+	ctl = get_arena_ctl();
+	rec = get_page_rec(ptr);
+	usable = kma_usable_size(ptr);
+	if(size == KMA_UNSIZED)
+		size = usable;
+	if(new_size <= usable)
+		return ptr;
+	// the last block on the current page grows into the room behind it
+	hdr = (struct block_hdr*)ptr - 1;
+	if(rec == ctl->cur && (char*)ptr + hdr->size == rec->top &&
+			(char*)ptr + round_unit(new_size) <= (char*)(rec->page->ptr) + rec->page->size) {
+		hdr->size = round_unit(new_size);
+		rec->top = (char*)ptr + hdr->size;
+		return ptr;
+	}
+	new_ptr = kma_malloc(new_size);
+	if(new_ptr) {
+		memcpy(new_ptr, ptr, size);
+		kma_free(ptr, size);
+	}
+	return new_ptr;
+}
+
+void*
+kma_calloc(kma_size_t nmemb, kma_size_t size)
+{
+	struct arena_ctl *ctl;
+	long long total = (long long)nmemb * size;
+	void *ptr;
+	int zero;
+	if(total + sizeof(void*) > PAGESIZE || !(ctl = get_default_ctl(0)))
+		return NULL;
+	ptr = get_block(ctl, total, UNIT, 0, &zero);
+	if(ptr && !zero)
+		zero_block(ptr, total);
+	return ptr;
+}
+
+void*
+kma_malloc_aligned(kma_size_t size, kma_size_t align)
+{
+	struct arena_ctl *ctl;
+	int zero;
+	if(align == 0 || (align & (align - 1)) != 0 || size + align + sizeof(void*) > PAGESIZE)
+		return NULL;
+	if(!(ctl = get_default_ctl(0)))
+		return NULL;
+	return get_block(ctl, size, align, 0, &zero);
+}
+
+kma_size_t
+kma_usable_size(void* ptr)
+{
+	struct page_rec *rec = get_page_rec(ptr);
+	// a block of its own runs to the end of its page
+	if(rec->big)
+		return (char*)(rec->page->ptr) + rec->page->size - (char*)ptr;
+	return ((struct block_hdr*)ptr - 1)->size;
+}
+
+int
+kma_malloc_batch(kma_size_t size, int n, void* ptrs[])
+{
+	int i;
+	// bumping is as cheap as it gets, there is nothing to share
+	for(i = 0; i < n; i++)
+		if(!(ptrs[i] = kma_malloc(size)))
+			break;
+	return i;
+}
+
+void
+kma_free_batch(void* ptrs[], int n)
+{
+	struct arena_ctl *ctl = get_arena_ctl();
+	int i;
+	// a block is only counted off its page, its size is not needed
+	for(i = 0; i < n; i++)
+		put_block(ctl, ptrs[i]);
+}
+
+kma_mark_t
+kma_arena_mark()
+{
+	struct arena_ctl *ctl;
+	// before any page, the mark covers every page still to come
+	if(!first_page || !(ctl = get_arena_ctl())->cur)
+		return next_seq * PAGESIZE;
+	return ctl->cur->seq * PAGESIZE + (ctl->cur->top - (char*)(ctl->cur->page->ptr));
+}
+
+void
+kma_arena_rewind(kma_mark_t mark)
+{
+	struct arena_ctl *ctl;
+	struct page_rec *rec, *prev;
+	struct block_hdr *hdr;
+	long seq = mark / PAGESIZE;
+	int off = mark % PAGESIZE;
+	char *ptr;
+	if(!first_page)
+		return;
+	ctl = get_arena_ctl();
+
+	// the pages taken after the mark go back whole, an offset of zero
+	// means the mark was taken before its page. marks are taken on the
+	// main pages, so KMA_TEMP pages are left to kma_free
+	rec = ctl->page_list.prev;
+	while(rec != &(ctl->page_list) && (rec->seq > seq || (rec->seq == seq && off == 0))) {
+		prev = rec->prev;
+		if(!rec->temp) {
+			ctl->total_free += rec->live;
+			if(rec == ctl->cur)
+				ctl->cur = NULL;
+			free_data_page(ctl, rec);
+		}
+		rec = prev;
+	}
+	// on the page of the mark, the blocks behind it are freed and the
+	// page is bumped off again from there
+	if(rec != &(ctl->page_list) && rec->seq == seq) {
+		for(ptr = (char*)(rec->page->ptr) + off; ptr < rec->top; ptr += sizeof(struct block_hdr) + hdr->size) {
+			hdr = (struct block_hdr*)ptr;
+			if(!hdr->freed) {
+				rec->live--;
+				ctl->total_free++;
+			}
+		}
+		rec->top = (char*)(rec->page->ptr) + off;
+		ctl->cur = rec;
+		ctl->zero = 0;
+	}
+
+	if(ctl->total_alloc == ctl->total_free && !ctl->heap)
+		release_pages(ctl);
+}
+
+void
+kma_arena_reset()
+{
+	struct arena_ctl *ctl;
+	if(!first_page)
+		return;
+	ctl = get_arena_ctl();
+	// one pass over the pages, the blocks on them are not looked at
+	if(!ctl->heap) {
+		release_pages(ctl);
+		return;
+	}
+	while(ctl->page_list.next != &(ctl->page_list))
+		free_data_page(ctl, ctl->page_list.next);
+	ctl->cur = ctl->temp_cur = NULL;
+	ctl->total_free = ctl->total_alloc;
+}
+
+// the handle of a heap is its control unit, the default heap is left
+// alone
+kma_heap_t*
+kma_heap_create()
+{
+	struct arena_ctl *ctl;
+	if(!page_reserve(1))
+		return NULL;
+	ctl = init_ctl();
+	ctl->heap = 1;
+	return (kma_heap_t*)ctl;
+}
+
+void
+kma_heap_destroy(kma_heap_t *heap)
+{
+	release_pages((struct arena_ctl*)heap);
+}
+
+void*
+kma_heap_malloc(kma_heap_t *heap, kma_size_t size)
+{
+	int zero;
+	if(size + sizeof(void*) > PAGESIZE)
+		return NULL;
+	return get_block((struct arena_ctl*)heap, size, UNIT, 0, &zero);
+}
+
+void
+kma_heap_free(kma_heap_t *heap, void* ptr, kma_size_t size)
+{
+	put_block((struct arena_ctl*)heap, ptr);
+}
+
+#endif // KMA_ARENA
@@ -65,7 +65,9 @@
 
 #define SIZE_OFFSET	(5)
 #define MAX_SIZE	PAGESIZE
-#define BITMAP_LEN	(PAGESIZE/(8*(1<<SIZE_OFFSET)))
+#define BITS_LEN	(PAGESIZE/(8*(1<<SIZE_OFFSET)))
+// a bitmap holds the used bits of a page, then its end bits
+#define BITMAP_LEN	(2*BITS_LEN)
 #define PAGE_INDEX_MASK	(~(PAGESIZE-1))
 #define PAGE_BIT_LEN	((PAGESIZE==8192)?(13):((PAGESIZE==4096)?12:11))
 #define SIZE_NUM	(PAGE_BIT_LEN+1-SIZE_OFFSET)
@@ -92,6 +94,7 @@ struct page_item {
 	unsigned char *bitmap;
 	struct page_item *prev;
 	struct page_item *next;
+	struct block_list *lists;	// the free lists of a work page's pool
 };
 // construct the page map page
 struct page_map {
@@ -102,6 +105,7 @@ struct page_map {
 struct free_block {
 	struct free_block *prev;
 	struct free_block *next;
+	int zero;		// nothing but the links was ever written
 };
 struct block_list {
 	struct free_block block;
@@ -109,9 +113,11 @@ struct block_list {
 
 // the control unit of buddy system
 struct bud_ctl {
+	kma_page_t *page;	// the page the unit is on
 	int total_alloc;
 	int total_free;
 	struct block_list free_list[SIZE_NUM];		// free lists with different size
+	struct block_list temp_list[SIZE_NUM];		// the same for KMA_TEMP work pages
 	int MultiplyDeBruijnBitPosition[32];
 	kma_page_t *cur_page;
 	int max_order;
@@ -120,9 +126,10 @@ struct bud_ctl {
 	struct page_item work_page_list;
 	struct page_item ctl_page_list;
 	struct page_item page_map_list;
+	int heap;		// only kma_heap_destroy releases the pages
 };
 
-static void insert_page_map(struct page_item *item);
+static void insert_page_map(struct bud_ctl*, struct page_item *item);
 
 // get the buddy index of the specified block
 inline int get_buddy_index(int idx, int order) {
@@ -216,11 +223,11 @@ inline void block_list_remove(struct free_block *item) {
 }
 
 
-extern struct page_item *get_unused_page_item(int need_bitmap);
+extern struct page_item *get_unused_page_item(struct bud_ctl*, int need_bitmap);
+extern void release_pages(struct bud_ctl *ctl);
 
 // allocate more pages for list items
-void add_page_for_page_item() {
-	struct bud_ctl *ctl = get_bud_ctl();
+void add_page_for_page_item(struct bud_ctl *ctl) {
 	struct page_item *cur, *end;
 	kma_page_t *page;
 	//assert(ctl);
@@ -241,8 +248,7 @@ void add_page_for_page_item() {
 }
 
 // allocate more pages for bitmaps
-void add_page_for_bitmap() {
-	struct bud_ctl *ctl = get_bud_ctl();
+void add_page_for_bitmap(struct bud_ctl *ctl) {
 	struct page_item *node;
 	unsigned char *cur, *end;
 	kma_page_t *page;
@@ -254,10 +260,10 @@ void add_page_for_bitmap() {
 		node = (struct page_item*)cur;
 		list_insert_head(node, &(ctl->bitmap_list));
 	}
-	node = get_unused_page_item(0);
+	node = get_unused_page_item(ctl, 0);
 	node->page = page;
 	node->bitmap = NULL;
-	insert_page_map(node);
+	insert_page_map(ctl, node);
 	list_append(node, &(ctl->ctl_page_list));
 }
 
@@ -299,8 +305,8 @@ inline int get_list_index_by_size(int *table, int sz) {
 		return 8;
 }
 
-// initialize the control unit on the first page
-void init_first_page() {
+// set up a control unit on a new page, and its first page map page
+struct bud_ctl *init_ctl() {
 	struct bud_ctl *ctl;
 	struct page_item *fp, *rsv, *cur, *end;
 	char *st, *ed;
@@ -309,14 +315,15 @@ void init_first_page() {
 		0, 1, 28, 2, 29, 14, 24, 3, 30, 22, 20, 15, 25, 17, 4, 8, 
 		31, 27, 13, 23, 21, 19, 16, 7, 26, 12, 18, 6, 11, 5, 10, 9
 	};
-	first_page = get_page();
-	memset(first_page->ptr, 0, first_page->size);
-	cur = (struct page_item*)first_page->ptr;
+	kma_page_t *page = get_page();
+	memset(page->ptr, 0, page->size);
+	cur = (struct page_item*)page->ptr;
 	cur->bitmap = (unsigned char*)0x1;
-	cur->page = first_page;
+	cur->page = page;
 	fp = cur;
 	cur++;
 	ctl = (struct bud_ctl*)cur;
+	ctl->page = page;
 	ctl->total_alloc = 0;
 	ctl->total_free = 0;
 
@@ -360,28 +367,41 @@ void init_first_page() {
 	// initialize the free lists
 	for(i = 0; i < SIZE_NUM; i++) {
 		ctl->free_list[i].block.next = ctl->free_list[i].block.prev = &(ctl->free_list[i].block);
+		ctl->temp_list[i].block.next = ctl->temp_list[i].block.prev = &(ctl->temp_list[i].block);
 	}
 	rsv->page = get_page();
 	memset(rsv->page->ptr, 0, PAGESIZE);
 	list_append(rsv, &(ctl->page_map_list));
-	insert_page_map(fp);
+	insert_page_map(ctl, fp);
+	return ctl;
+}
+
+// the default heap, which the first request sets up. NULL if the pages
+// for it cannot be had
+static struct bud_ctl *get_default_ctl(int flags) {
+	if(unlikely(!first_page)) {
+		// the first page and the first page map page
+		if((flags & KMA_NOWAIT) || !page_reserve(2))
+			return NULL;
+		first_page = init_ctl()->page;
+	}
+	return get_bud_ctl();
 }
 
-unsigned char *get_bitmap();
-void put_bitmap(unsigned char*);
-static struct page_item *find_page_item_by_addr(void*);
-static void remove_page_map_by_addr(void*);
+unsigned char *get_bitmap(struct bud_ctl*);
+void put_bitmap(struct bud_ctl*, unsigned char*);
+static struct page_item *find_page_item_by_addr(struct bud_ctl*, void*);
+static void remove_page_map_by_addr(struct bud_ctl*, void*);
 
 // get a list item from unused list item list
-struct page_item *get_unused_page_item(int need_bitmap) {
-	struct bud_ctl *ctl = get_bud_ctl();
+struct page_item *get_unused_page_item(struct bud_ctl *ctl, int need_bitmap) {
 	struct page_item *node, *tp;
 	unsigned char *bmp;
 	//assert(ctl);
 	if(unlikely(ctl->unused_list.prev == &(ctl->unused_list)))
-		add_page_for_page_item();
+		add_page_for_page_item(ctl);
 	if(need_bitmap) {
-		bmp = get_bitmap();
+		bmp = get_bitmap(ctl);
 		node = ctl->unused_list.prev;
 		node->bitmap = bmp;
 	} else
@@ -394,14 +414,13 @@ struct page_item *get_unused_page_item(int need_bitmap) {
 };
 
 // return a list item to the unused list item list
-void put_unused_page_item(struct page_item *node, int have_bitmap) {
-	struct bud_ctl *ctl = get_bud_ctl();
+void put_unused_page_item(struct bud_ctl *ctl, struct page_item *node, int have_bitmap) {
 	struct page_item *tp, *cur, *end;
 	//assert(node);
 	if(have_bitmap) {
-		put_bitmap((unsigned char*)node->bitmap);
+		put_bitmap(ctl, (unsigned char*)node->bitmap);
 	}
-	if(first_page->ptr == get_page_start((void*)node))
+	if(ctl->page->ptr == get_page_start((void*)node))
 		list_insert_head(node, &(ctl->unused_list));
 	else
 		list_append(node, &(ctl->unused_list));
@@ -422,31 +441,29 @@ void put_unused_page_item(struct page_item *node, int have_bitmap) {
 }
 
 // get a unused bitmap
-unsigned char *get_bitmap() {
-	struct bud_ctl *ctl = get_bud_ctl();
+unsigned char *get_bitmap(struct bud_ctl *ctl) {
 	struct page_item *node, *tp;
 	//assert(ctl);
 	if(unlikely(ctl->bitmap_list.prev == &(ctl->bitmap_list)))
-		add_page_for_bitmap();
+		add_page_for_bitmap(ctl);
 	node = ctl->bitmap_list.next;
 	list_remove(node);
-	tp = find_page_item_by_addr((void*)node);
+	tp = find_page_item_by_addr(ctl, (void*)node);
 	tp->bitmap++;
 	memset((unsigned char*)node, 0, BITMAP_LEN);
 	return (unsigned char*)node;
 }
 
 // return a bitmap when a work page is freed
-void put_bitmap(unsigned char *bmp) {
-	struct bud_ctl *ctl = get_bud_ctl();
+void put_bitmap(struct bud_ctl *ctl, unsigned char *bmp) {
 	struct page_item *tp;
 	unsigned char *cur, *end;
 	//assert(ctl);
-	if(first_page->ptr == get_page_start((void*)bmp))
+	if(ctl->page->ptr == get_page_start((void*)bmp))
 		list_insert_head((struct page_item*)bmp, &(ctl->bitmap_list));
 	else
 		list_append((struct page_item*)bmp, &(ctl->bitmap_list));
-	tp = find_page_item_by_addr((void*)bmp);
+	tp = find_page_item_by_addr(ctl, (void*)bmp);
 	tp->bitmap--;
 	if(unlikely(!(tp->bitmap))) {
 		cur = tp->page->ptr;
@@ -454,10 +471,10 @@ void put_bitmap(unsigned char *bmp) {
 		for(; cur + BITMAP_LEN <= end; cur += BITMAP_LEN) {
 			list_remove((struct page_item*)cur);
 		}
-		remove_page_map_by_addr(tp->page->ptr);
+		remove_page_map_by_addr(ctl, tp->page->ptr);
 		list_remove(tp);
 		free_page(tp->page);
-		put_unused_page_item(tp, 0);
+		put_unused_page_item(ctl, tp, 0);
 	}
 }
 
@@ -477,10 +494,9 @@ static inline int get_page_map_index(void *ptr) {
 }
 
 // insert a new page item into the page map
-static void insert_page_map(struct page_item *item) {
+static void insert_page_map(struct bud_ctl *ctl, struct page_item *item) {
 	int idx;
 	struct page_item *cur;
-	struct bud_ctl *ctl = get_bud_ctl();
 	struct page_map *map_arr;
 	int found = 0;
 	//assert(item);
@@ -497,7 +513,7 @@ static void insert_page_map(struct page_item *item) {
 	}
 	// if not found, allocate a new page
 	if(unlikely(!found)) {
-		cur = get_unused_page_item(0);
+		cur = get_unused_page_item(ctl, 0);
 		cur->page = get_page();
 		memset(cur->page->ptr, 0, cur->page->size);
 		list_append(cur, &(ctl->page_map_list));
@@ -507,29 +523,27 @@ static void insert_page_map(struct page_item *item) {
 }
 
 // find a page item using an address
-static struct page_item *find_page_item_by_addr(void *ptr) {
+static struct page_item *find_page_item_by_addr(struct bud_ctl *ctl, void *ptr) {
 	struct page_item *cur;
-	struct bud_ctl *ctl = get_bud_ctl();
 	struct page_map *map_arr;
 	int idx;
 	//assert(ptr);
 	cur = ctl->page_map_list.next;
 	idx = get_page_map_index(ptr);
-//	ptr = get_page_start(ptr);
-	// traverse the page map to get a page item
-//	while(likely(cur != &(ctl->page_map_list))) {
+	ptr = get_page_start(ptr);
+	// traverse the page map to get a page item, pages 1024 apart share an index
+	while(likely(cur != &(ctl->page_map_list))) {
 		map_arr = (struct page_map*)cur->page->ptr;
-//		if(likely(map_arr[idx].page && map_arr[idx].page->page->ptr == ptr))
+		if(likely(map_arr[idx].page && map_arr[idx].page->page->ptr == ptr))
 			return map_arr[idx].page;
-//		cur = cur->next;
-//	}
-//	return NULL;
+		cur = cur->next;
+	}
+	return NULL;
 }
 
 // remove the page item map in page map when a work page is freed
-static void remove_page_map_by_addr(void *ptr) {
+static void remove_page_map_by_addr(struct bud_ctl *ctl, void *ptr) {
 	struct page_item *cur;
-	struct bud_ctl *ctl = get_bud_ctl();
 	struct page_map *map_arr;
 	int idx;
 	//assert(ptr);
@@ -547,18 +561,19 @@ static void remove_page_map_by_addr(void *ptr) {
 	}
 }
 
-// allocate a new working page for allocating
-inline void alloc_work_page() {
-	struct bud_ctl *ctl = get_bud_ctl();
+// allocate a new working page for allocating, its blocks go to lists
+inline void alloc_work_page(struct bud_ctl *ctl, struct block_list *lists) {
 	struct page_item *item;
 	struct free_block *block;
 	//assert(ctl);	
-	item = get_unused_page_item(1);
+	item = get_unused_page_item(ctl, 1);
 	item->page = get_page();
+	item->lists = lists;
 	//init_bitmap(item);
-	insert_page_map(item);
+	insert_page_map(ctl, item);
 	block = (struct free_block*)item->page->ptr;
-	block_list_append(block, &(ctl->free_list[ctl->max_order].block));
+	block->zero = item->page->zero;
+	block_list_append(block, &(lists[ctl->max_order].block));
 	list_append(item, &(ctl->work_page_list));
 }
 
@@ -609,9 +624,26 @@ inline void set_block_unused(unsigned char *bitmap, int begin_idx) {
 	clear_bit(bitmap, begin_idx);
 }
 
+// the end bits follow the used bits and mark the last unit of every
+// block that is handed out, so a block can be freed without its size
+inline void set_block_end(unsigned char *bitmap, int begin_idx, int order) {
+	set_bit(bitmap + BITS_LEN, begin_idx + (1 << order) - 1);
+}
+
+inline void clear_block_end(unsigned char *bitmap, int begin_idx, int order) {
+	clear_bit(bitmap + BITS_LEN, begin_idx + (1 << order) - 1);
+}
+
+// a handed out block has the smallest order whose last unit has an end bit
+inline int get_block_order(unsigned char *bitmap, int begin_idx) {
+	int order = 0;
+	while(!get_bit(bitmap + BITS_LEN, begin_idx + (1 << order) - 1))
+		order++;
+	return order;
+}
+
 // free a work page when all the blocks on this page are freed
-inline void free_work_page(struct page_item *item) {
-	struct bud_ctl *ctl = get_bud_ctl();
+inline void free_work_page(struct bud_ctl *ctl, struct page_item *item) {
 	struct page_item *cur;
 	struct page_map *map_arr;
 	int idx;
@@ -629,33 +661,38 @@ inline void free_work_page(struct page_item *item) {
 	}
 	list_remove(item);
 	free_page(item->page);
-	put_unused_page_item(item, 1);
+	put_unused_page_item(ctl, item, 1);
 }
 
-// used by kma_malloc to allocate a new block
-inline struct free_block *get_free_block(int order, int sz) {
-	struct bud_ctl *ctl = get_bud_ctl();
+// used by kma_malloc to allocate a new block. KMA_TEMP blocks come from
+// work pages of their own, KMA_NOWAIT gets NULL rather than a new page
+static inline struct free_block *get_free_block(struct bud_ctl *ctl, int order, int sz, int flags) {
 	int i, end_order = order;
 	struct free_block *block = NULL, *buddy_block;
 	struct page_item *item;
+	struct block_list *lists;
 	//assert(ctl);
 
 #ifdef REUSE_PAGE_ITEM
 	if(sz <= sizeof(struct page_item))
-		return (struct free_block*)get_unused_page_item(0);
+		return (struct free_block*)get_unused_page_item(ctl, 0);
 #endif
 
 	// find a available block
+	lists = flags & KMA_TEMP ? ctl->temp_list : ctl->free_list;
 	for(i = order; i <= ctl->max_order; i++) {
-		block = ctl->free_list[i].block.next;
-		if(block != &(ctl->free_list[i].block)) {
+		block = lists[i].block.next;
+		if(block != &(lists[i].block)) {
 			end_order = i;
 			block_list_remove(block);
 			break;
 		}
 		if(i == ctl->max_order) {
-			alloc_work_page();
-			block = ctl->free_list[i].block.next;
+			// a work page can take a page item, bitmap and page map page along
+			if((flags & KMA_NOWAIT) || !page_reserve(4))
+				return NULL;
+			alloc_work_page(ctl, lists);
+			block = lists[i].block.next;
 			block_list_remove(block);
 			end_order = i;
 		}
@@ -664,31 +701,23 @@ inline struct free_block *get_free_block(int order, int sz) {
 	// split the block if needed
 	for(i = end_order - 1; i >= order; i--) {
 		buddy_block = (struct free_block*)((char*)block + (1<<(i+SIZE_OFFSET)));
-		block_list_append(buddy_block, &(ctl->free_list[i].block));
+		buddy_block->zero = block->zero;
+		block_list_append(buddy_block, &(lists[i].block));
 	}
-	item = find_page_item_by_addr((void*)block);
+	item = find_page_item_by_addr(ctl, (void*)block);
 	//assert(item);
 	set_block_used(item->bitmap, get_block_index(block));
+	set_block_end(item->bitmap, get_block_index(block), order);
 	return block;
 }
 
-// used by kma_free to free a allocated block
-inline void put_free_block(struct free_block *block, int order, int sz) {
-	struct bud_ctl *ctl = get_bud_ctl();
-	struct page_item *item;
+// free a block whose page item the caller has already looked up
+static inline void free_block_in_page(struct bud_ctl *ctl, struct page_item *item, struct free_block *block, int order) {
 	int idx;
-	//assert(ctl);
 
-#ifdef REUSE_PAGE_ITEM
-	if(sz <= sizeof(struct page_item)) {
-		put_unused_page_item((struct page_item*)block, 0);
-		return;
-	}
-#endif
-
-	item = find_page_item_by_addr((void*)block);
 	idx = get_block_index((void*)block);
 	set_block_unused(item->bitmap, idx);
+	clear_block_end(item->bitmap, idx, order);
 	// coalesce the blocks if possible
 	while(order < ctl->max_order) {
 		if(check_buddy_free(item->bitmap, idx, order)) {
@@ -702,9 +731,68 @@ inline void put_free_block(struct free_block *block, int order, int sz) {
 	}
 	//assert(block);
 	if(order == ctl->max_order)
-		free_work_page(item);
-	else
-		block_list_append(block, &(ctl->free_list[order].block));
+		free_work_page(ctl, item);
+	else {
+		block->zero = 0;
+		block_list_append(block, &(item->lists[order].block));
+	}
+}
+
+// used by kma_free to free a allocated block
+static inline void put_free_block(struct bud_ctl *ctl, struct free_block *block, int order, int sz) {
+	struct page_item *item;
+
+#ifdef REUSE_PAGE_ITEM
+	if(sz <= sizeof(struct page_item)) {
+		put_unused_page_item(ctl, (struct page_item*)block, 0);
+		return;
+	}
+#endif
+
+	item = find_page_item_by_addr(ctl, (void*)block);
+	free_block_in_page(ctl, item, block, order);
+}
+
+
+// shrink a block in place, its tail halves go back to the free lists
+static void shrink_block(struct bud_ctl *ctl, struct free_block *block, int order, int new_order) {
+	struct page_item *item;
+	struct free_block *buddy_block;
+	int i;
+	item = find_page_item_by_addr(ctl, (void*)block);
+	clear_block_end(item->bitmap, get_block_index((void*)block), order);
+	set_block_end(item->bitmap, get_block_index((void*)block), new_order);
+	for(i = order - 1; i >= new_order; i--) {
+		buddy_block = (struct free_block*)((char*)block + (1<<(i+SIZE_OFFSET)));
+		buddy_block->zero = 0;
+		block_list_append(buddy_block, &(item->lists[i].block));
+	}
+}
+
+// grow a block in place by absorbing its buddies, only if all of them are free
+static int grow_block(struct bud_ctl *ctl, struct free_block *block, int order, int new_order) {
+	struct page_item *item;
+	int i, idx;
+	item = find_page_item_by_addr(ctl, (void*)block);
+	idx = get_block_index((void*)block);
+	for(i = order; i < new_order; i++) {
+		// the block has to be the lower half at every level
+		if(idx & (1 << i))
+			return 0;
+		if(!check_buddy_free(item->bitmap, idx, i))
+			return 0;
+	}
+	for(i = order; i < new_order; i++)
+		block_list_remove((struct free_block*)get_block_addr(item->page->ptr, get_buddy_index(idx, i)));
+	clear_block_end(item->bitmap, idx, order);
+	set_block_end(item->bitmap, idx, new_order);
+	return 1;
+}
+
+// the order of a handed out block, for callers that do not pass its size
+static int get_order_by_addr(struct bud_ctl *ctl, void *ptr) {
+	struct page_item *item = find_page_item_by_addr(ctl, ptr);
+	return get_block_order(item->bitmap, get_block_index(ptr));
 }
 
 // round up a integer to a nearest power of 2
@@ -719,65 +807,373 @@ inline int __roundup_pow2(int v) {
 	return v;
 }
 
+// the control unit of the default heap comes with its first request, and
+// goes again if the page limit refuses it while nothing is handed out.
+// the batch counts its blocks only at the end, so this is left to callers
+static void release_idle(struct bud_ctl *ctl) {
+	if(ctl->total_alloc == ctl->total_free && !ctl->heap)
+		release_pages(ctl);
+}
+
 void*
 kma_malloc(kma_size_t size)
 {
 	struct bud_ctl *ctl;
+	struct free_block *block;
 	int idx;
-	if(unlikely(size + sizeof(void*) > PAGESIZE))
+	if(unlikely(size + sizeof(void*) > PAGESIZE) || !(ctl = get_default_ctl(0)))
 		return NULL;
-	if(unlikely(!first_page)) {
-		init_first_page();
-	}
-	ctl = get_bud_ctl();
-
-	ctl->total_alloc++;
 
 	//idx = get_list_index_by_size(ctl->MultiplyDeBruijnBitPosition, __roundup_pow2(size));
 	idx = get_list_index_by_size(NULL, size);
-	return (void*)get_free_block(idx, size);
+	block = get_free_block(ctl, idx, size, 0);
+	if(likely(block != NULL))
+		ctl->total_alloc++;
+	else
+		release_idle(ctl);
+	return (void*)block;
 }
 
+void*
+kma_malloc_flags(kma_size_t size, int flags)
+{
+	struct bud_ctl *ctl;
+	struct free_block *block;
+	int idx;
+	if(unlikely(size + sizeof(void*) > PAGESIZE) || !(ctl = get_default_ctl(flags)))
+		return NULL;
+
+	idx = get_list_index_by_size(NULL, size);
+	block = get_free_block(ctl, idx, size, flags);
+	if(!block) {
+		release_idle(ctl);
+		return NULL;
+	}
+	ctl->total_alloc++;
+	if(flags & KMA_ZERO) {
+		// a block split from a fresh page only holds its list links
+		if(block->zero)
+			memset(block, 0, sizeof(struct free_block));
+		else
+			zero_block(block, size);
+	}
+	return (void*)block;
+}
+
+// a work page goes back as soon as its blocks coalesce, and so do the
+// pages of page items and bitmaps, so there is nothing cached to give back
+int
+kma_reclaim()
+{
+	return -1;
+}
+
+// the used bits give the blocks handed out, the lists the free ones
 void
-kma_free(void* ptr, kma_size_t size)
+kma_get_stats(kma_stats_t* stats)
 {
-	struct bud_ctl *ctl = get_bud_ctl();
+	struct bud_ctl *ctl;
+	struct page_item *cur;
+	struct block_list *lists;
+	struct free_block *block;
+	int pool, order, idx;
+	memset(stats, 0, sizeof(kma_stats_t));
+	if(!first_page)
+		return;
+	ctl = get_bud_ctl();
+
+	stats->meta_pages = 1;
+	for(cur = ctl->ctl_page_list.next; cur != &(ctl->ctl_page_list); cur = cur->next)
+		stats->meta_pages++;
+	for(cur = ctl->page_map_list.next; cur != &(ctl->page_map_list); cur = cur->next)
+		stats->meta_pages++;
+	stats->num_classes = ctl->max_order + 1;
+	for(order = 0; order <= ctl->max_order; order++)
+		stats->classes[order].size = 1 << (order + SIZE_OFFSET);
+	for(cur = ctl->work_page_list.next; cur != &(ctl->work_page_list); cur = cur->next) {
+		stats->data_pages++;
+		for(idx = 0; idx < (PAGESIZE >> SIZE_OFFSET); idx++) {
+			if(!get_bit(cur->bitmap, idx))
+				continue;
+			order = get_block_order(cur->bitmap, idx);
+			stats->classes[order].used++;
+			idx += (1 << order) - 1;
+		}
+	}
+	for(pool = 0; pool < 2; pool++) {
+		lists = pool ? ctl->temp_list : ctl->free_list;
+		for(order = 0; order <= ctl->max_order; order++) {
+			for(block = lists[order].block.next; block != &(lists[order].block); block = block->next) {
+				stats->classes[order].free++;
+			}
+		}
+	}
+	for(order = 0; order <= ctl->max_order; order++) {
+		stats->used_bytes += (long long)stats->classes[order].used * stats->classes[order].size;
+		stats->free_bytes += (long long)stats->classes[order].free * stats->classes[order].size;
+	}
+}
+
+// return all the pages of a control unit, the unit too
+void release_pages(struct bud_ctl *ctl) {
 	struct page_item *cur;
 	int count = 0;
 	kma_page_t *page_array[MAXPAGES];
-	//assert(ctl);
 
+	cur = ctl->work_page_list.next;
+	while(cur != &(ctl->work_page_list)) {
+		//assert(cur->page->ptr);
+		page_array[count++] = cur->page;
+		cur = cur->next;
+	}
+	cur = ctl->ctl_page_list.next;
+	while(cur != &(ctl->ctl_page_list)) {
+		//assert(cur->page->ptr);
+		page_array[count++] = cur->page;
+		cur = cur->next;
+	}
+	cur = ctl->page_map_list.next;
+	while(cur != &(ctl->page_map_list)) {
+		//assert(cur->page->ptr);
+		page_array[count++] = cur->page;
+		cur = cur->next;
+	}
+	for(count = count - 1; count >= 0; count--)
+		free_page(page_array[count]);
+	if(ctl->page == first_page)
+		first_page = NULL;
+	free_page(ctl->page);
+}
+
+// free a block of a control unit, which goes with its last block unless
+// it is a heap
+static void put_block(struct bud_ctl *ctl, void *ptr, kma_size_t size) {
 	//put_free_block((struct free_block*)ptr, get_list_index_by_size(ctl->MultiplyDeBruijnBitPosition,
 //				__roundup_pow2(size)), size);
-	put_free_block((struct free_block*)ptr, get_list_index_by_size(NULL, size), size);
+	// without the size, the end bits know the order
+	put_free_block(ctl, (struct free_block*)ptr, size == KMA_UNSIZED ? get_order_by_addr(ctl, ptr) :
+			get_list_index_by_size(NULL, size), size);
 	ctl->total_free++;
 
-	// return all the pages if all the requests are done
-	if(unlikely(ctl->total_alloc == ctl->total_free)) {
-		cur = ctl->work_page_list.next;
-		while(cur != &(ctl->work_page_list)) {
-			//assert(cur->page->ptr);
-			page_array[count++] = cur->page;
-			cur = cur->next;
-		}
-		cur = ctl->ctl_page_list.next;
-		while(cur != &(ctl->ctl_page_list)) {
-			//assert(cur->page->ptr);
-			page_array[count++] = cur->page;
-			cur = cur->next;
-		}
-		cur = ctl->page_map_list.next;
-		while(cur != &(ctl->page_map_list)) {
-			//assert(cur->page->ptr);
-			page_array[count++] = cur->page;
-			cur = cur->next;
+	if(unlikely(ctl->total_alloc == ctl->total_free && !ctl->heap))
+		release_pages(ctl);
+}
+
+void
+kma_free(void* ptr, kma_size_t size)
+{
+	put_block(get_bud_ctl(), ptr, size);
+}
+
+void*
+kma_realloc(void* ptr, kma_size_t size, kma_size_t new_size)
+{
+	struct bud_ctl *ctl;
+	int order, new_order;
+	void *new_ptr;
+	if(unlikely(!ptr))
+		return kma_malloc(new_size);
+	if(unlikely(new_size + sizeof(void*) > PAGESIZE))
+		return NULL;
+
+	if(size == KMA_UNSIZED)
+		size = kma_usable_size(ptr);
+
+	ctl = get_bud_ctl();
+	order = get_list_index_by_size(NULL, size);
+	new_order = get_list_index_by_size(NULL, new_size);
+	if(new_order == order)
+		return ptr;
+	if(new_order < order) {
+		shrink_block(ctl, (struct free_block*)ptr, order, new_order);
+		return ptr;
+	}
+	if(grow_block(ctl, (struct free_block*)ptr, order, new_order))
+		return ptr;
+
+	new_ptr = kma_malloc(new_size);
+	if(likely(new_ptr != NULL)) {
+		memcpy(new_ptr, ptr, size);
+		kma_free(ptr, size);
+	}
+	return new_ptr;
+}
+
+void*
+kma_calloc(kma_size_t nmemb, kma_size_t size)
+{
+	long long total = (long long)nmemb * size;
+	struct free_block *block;
+	if(unlikely(total + sizeof(void*) > PAGESIZE))
+		return NULL;
+	block = (struct free_block*)kma_malloc(total);
+	if(unlikely(block == NULL))
+		return NULL;
+	// a block split from a fresh page only holds its list links
+	if(block->zero)
+		memset(block, 0, sizeof(struct free_block));
+	else
+		zero_block(block, total);
+	return block;
+}
+
+void*
+kma_malloc_aligned(kma_size_t size, kma_size_t align)
+{
+	struct bud_ctl *ctl;
+	struct free_block *block;
+	int order, align_order;
+	// a block is aligned to its own size, so the request only has to fit
+	// the block of the larger of the two, up to a whole page
+	if(unlikely(align == 0 || (align & (align - 1)) || align > PAGESIZE || size + sizeof(void*) > PAGESIZE))
+		return NULL;
+	// only an alignment beyond the size needs the larger block, whose
+	// tail halves go right back
+	order = get_list_index_by_size(NULL, size);
+	align_order = get_list_index_by_size(NULL, align);
+	if(align_order <= order)
+		return kma_malloc(size);
+	if(!(ctl = get_default_ctl(0)))
+		return NULL;
+	block = get_free_block(ctl, align_order, align, 0);
+	if(unlikely(block == NULL)) {
+		release_idle(ctl);
+		return NULL;
+	}
+	ctl->total_alloc++;
+	shrink_block(ctl, block, align_order, order);
+	return (void*)block;
+}
+
+kma_size_t
+kma_usable_size(void* ptr)
+{
+	return 1 << (get_order_by_addr(get_bud_ctl(), ptr) + SIZE_OFFSET);
+}
+
+// order the batch by address, batches are short enough for an insertion sort
+static void sort_addr(void **ptrs, int n) {
+	void *p;
+	int i, j;
+	for(i = 1; i < n; i++) {
+		p = ptrs[i];
+		for(j = i; j > 0 && (char*)ptrs[j - 1] > (char*)p; j--)
+			ptrs[j] = ptrs[j - 1];
+		ptrs[j] = p;
+	}
+}
+
+// hand out a used block of order k as 2^(k-order) used blocks of order
+static void split_used_block(struct bud_ctl *ctl, struct free_block *block, int k, int order, void **ptrs) {
+	struct page_item *item;
+	int i, idx;
+	item = find_page_item_by_addr(ctl, (void*)block);
+	idx = get_block_index((void*)block);
+	clear_block_end(item->bitmap, idx, k);
+	for(i = 0; i < (1 << (k - order)); i++) {
+		set_block_used(item->bitmap, idx + (i << order));
+		set_block_end(item->bitmap, idx + (i << order), order);
+		ptrs[i] = (char*)block + (i << (order + SIZE_OFFSET));
+	}
+}
+
+int
+kma_malloc_batch(kma_size_t size, int n, void* ptrs[])
+{
+	struct bud_ctl *ctl;
+	struct free_block *block;
+	int order, k, i = 0;
+	if(unlikely(size + sizeof(void*) > PAGESIZE) || !(ctl = get_default_ctl(0)))
+		return 0;
+
+	order = get_list_index_by_size(NULL, size);
+	while(i < n) {
+		// free blocks of the order go first, after that one larger
+		// block is split into as many as the batch still needs
+		k = order;
+		if(ctl->free_list[order].block.next == &(ctl->free_list[order].block))
+			while(k < ctl->max_order && (2 << (k - order)) <= n - i)
+				k++;
+		block = get_free_block(ctl, k, size, 0);
+		if(unlikely(block == NULL))
+			break;
+		if(k > order) {
+			split_used_block(ctl, block, k, order, ptrs + i);
+			i += 1 << (k - order);
+		} else
+			ptrs[i++] = (void*)block;
+	}
+	ctl->total_alloc += i;
+	if(i == 0)
+		release_idle(ctl);
+	return i;
+}
+
+void
+kma_free_batch(void* ptrs[], int n)
+{
+	struct bud_ctl *ctl = get_bud_ctl();
+	struct page_item *item = NULL;
+	void *start = NULL;
+	int i, order;
+	//assert(ctl);
+
+	// in address order a block and its buddy are freed one after the
+	// other, and the blocks of one page share one page map lookup, which
+	// also gives the bitmap their orders are read from
+	sort_addr(ptrs, n);
+	for(i = 0; i < n; i++) {
+		// the item is gone once its page coalesces back, so compare
+		// against the page start rather than the item
+		if(get_page_start(ptrs[i]) != start) {
+			start = get_page_start(ptrs[i]);
+			item = find_page_item_by_addr(ctl, ptrs[i]);
 		}
-		for(count = count - 1; count >= 0; count--)
-			free_page(page_array[count]);
-		free_page(first_page);
-		first_page = NULL;
+		order = get_block_order(item->bitmap, get_block_index(ptrs[i]));
+		free_block_in_page(ctl, item, (struct free_block*)ptrs[i], order);
 	}
+	ctl->total_free += n;
+
+	if(unlikely(ctl->total_alloc == ctl->total_free && !ctl->heap))
+		release_pages(ctl);
 }
 
+// a heap has its own free lists, work pages and page map, so it takes
+// a page map page along with its control page. the handle is the unit
+kma_heap_t*
+kma_heap_create()
+{
+	struct bud_ctl *ctl;
+	if(!page_reserve(2))
+		return NULL;
+	ctl = init_ctl();
+	ctl->heap = 1;
+	return (kma_heap_t*)ctl;
+}
+
+void
+kma_heap_destroy(kma_heap_t *heap)
+{
+	release_pages((struct bud_ctl*)heap);
+}
+
+void*
+kma_heap_malloc(kma_heap_t *heap, kma_size_t size)
+{
+	struct bud_ctl *ctl = (struct bud_ctl*)heap;
+	struct free_block *block;
+	if(unlikely(size + sizeof(void*) > PAGESIZE))
+		return NULL;
+	block = get_free_block(ctl, get_list_index_by_size(NULL, size), size, 0);
+	if(likely(block != NULL))
+		ctl->total_alloc++;
+	return (void*)block;
+}
+
+void
+kma_heap_free(kma_heap_t *heap, void* ptr, kma_size_t size)
+{
+	put_block((struct bud_ctl*)heap, ptr, size);
+}
 
 #endif // KMA_BUD
@@ -63,7 +63,9 @@
 #define SIZE_NUM	(16)
 #define SIZE_OFFSET	(5)
 #define MAX_SIZE	PAGESIZE
-#define BITMAP_LEN	(PAGESIZE/(8*(1<<SIZE_OFFSET)))
+#define BITS_LEN	(PAGESIZE/(8*(1<<SIZE_OFFSET)))
+// a bitmap holds the used bits of a page, then its end bits
+#define BITMAP_LEN	(2*BITS_LEN)
 #define PAGE_INDEX_MASK	(~(PAGESIZE-1))
 #define PAGE_BIT_LEN	((PAGESIZE==8192)?(13):((PAGESIZE==4096)?12:11))
 
@@ -88,6 +90,7 @@ struct page_item {
 	unsigned char *bitmap;	// to identify the free block
 	struct page_item *prev;
 	struct page_item *next;
+	struct block_list *lists;	// the free lists of a work page's pool
 };
 // the page map unit, indexed by the page start address
 struct page_map {
@@ -98,6 +101,7 @@ struct page_map {
 struct free_block {
 	struct free_block *prev;
 	struct free_block *next;
+	int zero;		// nothing but the links was ever written
 };
 
 // all the free block will be stored here
@@ -108,9 +112,11 @@ struct block_list {
 
 // our control unit for Lazy Buddy allocator
 struct bud_ctl {
+	kma_page_t *page;	// the page the unit is on
 	int total_alloc;
 	int total_free;
 	struct block_list free_list[SIZE_NUM];
+	struct block_list temp_list[SIZE_NUM];		// the same for KMA_TEMP work pages
 	int MultiplyDeBruijnBitPosition[32];
 	kma_page_t *cur_page;
 	int cur_used;
@@ -119,6 +125,8 @@ struct bud_ctl {
 	struct page_item work_page_list;
 	struct page_item ctl_page_list;
 	struct page_item page_map_list;		// to store pages used to lookup for page_item
+	int local;		// a block went locally free since the last kma_reclaim
+	int heap;		// only kma_heap_destroy releases the pages
 };
 
 inline int get_buddy_index(int idx, int order) {
@@ -207,11 +215,11 @@ inline void block_list_remove(struct free_block *item) {
 }
 
 
-extern struct page_item *get_unused_page_item(int need_bitmap);
+extern struct page_item *get_unused_page_item(struct bud_ctl*, int need_bitmap);
+extern void release_pages(struct bud_ctl *ctl);
 
 // add all the list items in a page to the unused list item list
-void add_page_for_page_item() {
-	struct bud_ctl *ctl = get_bud_ctl();
+void add_page_for_page_item(struct bud_ctl *ctl) {
 	struct page_item *cur, *end;
 	kma_page_t *page;
 	assert(ctl);
@@ -222,7 +230,7 @@ void add_page_for_page_item() {
 		cur->bitmap = NULL;
 		list_insert_head(cur, &(ctl->unused_list));
 	}
-	cur = get_unused_page_item(0);
+	cur = get_unused_page_item(ctl, 0);
 	cur->page = page;
 	list_append(cur, &(ctl->ctl_page_list));
 }
@@ -234,18 +242,19 @@ inline int get_list_index_by_size(int *table, int sz) {
 	return ret <= 0 ? 0 : ret;
 }
 
-// initialize the first page
-void init_first_page() {
+// set up a control unit on a new page
+struct bud_ctl *init_ctl() {
 	struct bud_ctl *ctl;
 	struct page_item *cur, *end;
+	kma_page_t *page = get_page();
 	int i;
 	int _MultiplyDeBruijnBitPosition[32] = {
 		0, 1, 28, 2, 29, 14, 24, 3, 30, 22, 20, 15, 25, 17, 4, 8, 
 		31, 27, 13, 23, 21, 19, 16, 7, 26, 12, 18, 6, 11, 5, 10, 9
 	};
-	first_page = get_page();
-	memset(first_page->ptr, 0, first_page->size);
-	ctl = (struct bud_ctl*)(first_page->ptr);
+	memset(page->ptr, 0, page->size);
+	ctl = (struct bud_ctl*)(page->ptr);
+	ctl->page = page;
 	ctl->total_alloc = 0;
 	ctl->total_free = 0;
 
@@ -270,16 +279,29 @@ void init_first_page() {
 	for(i = 0; i < SIZE_NUM; i++) {
 		ctl->free_list[i].slack = 0;
 		ctl->free_list[i].block.next = ctl->free_list[i].block.prev = &(ctl->free_list[i].block);
+		ctl->temp_list[i].slack = 0;
+		ctl->temp_list[i].block.next = ctl->temp_list[i].block.prev = &(ctl->temp_list[i].block);
 	}
+	return ctl;
+}
+
+// the default heap, which the first request sets up. NULL if the page
+// for it cannot be had
+static struct bud_ctl *get_default_ctl(int flags) {
+	if(!first_page) {
+		if((flags & KMA_NOWAIT) || !page_reserve(1))
+			return NULL;
+		first_page = init_ctl()->page;
+	}
+	return get_bud_ctl();
 }
 
 // get a page item from the unused page item list
-struct page_item *get_unused_page_item(int need_bitmap) {
-	struct bud_ctl *ctl = get_bud_ctl();
+struct page_item *get_unused_page_item(struct bud_ctl *ctl, int need_bitmap) {
 	struct page_item *node;
 	assert(ctl);
 	if(ctl->unused_list.prev == &(ctl->unused_list))
-		add_page_for_page_item();
+		add_page_for_page_item(ctl);
 	if(need_bitmap)
 		node = ctl->unused_list.prev;
 	else
@@ -289,8 +311,7 @@ struct page_item *get_unused_page_item(int need_bitmap) {
 };
 
 // return a page item after using it
-void put_unused_page_item(struct page_item *node, int have_bitmap) {
-	struct bud_ctl *ctl = get_bud_ctl();
+void put_unused_page_item(struct bud_ctl *ctl, struct page_item *node, int have_bitmap) {
 	assert(node);
 	if(have_bitmap)
 		list_append(node, &(ctl->unused_list));
@@ -299,15 +320,14 @@ void put_unused_page_item(struct page_item *node, int have_bitmap) {
 }
 
 // initialize the bitmap, allocate new page if needed
-void init_bitmap(struct page_item *item) {
-	struct bud_ctl *ctl = get_bud_ctl();
+void init_bitmap(struct bud_ctl *ctl, struct page_item *item) {
 	struct page_item *ii;
 	assert(item);
 	assert(ctl);
 	if(item->bitmap)
 		goto clear_bit;
 	if(!(ctl->cur_page && (ctl->cur_used + BITMAP_LEN <= PAGESIZE))) {
-		ii = get_unused_page_item(0);
+		ii = get_unused_page_item(ctl, 0);
 		ii->page = get_page();
 		list_append(ii, &(ctl->ctl_page_list));
 		ctl->cur_used = 0;
@@ -338,10 +358,9 @@ static inline int get_page_map_index(void *ptr) {
 }
 
 // insert the working page into the page map which could accelerate the page finding
-static void insert_page_map(struct page_item *item) {
+static void insert_page_map(struct bud_ctl *ctl, struct page_item *item) {
 	int idx;
 	struct page_item *cur;
-	struct bud_ctl *ctl = get_bud_ctl();
 	struct page_map *map_arr;
 	int found = 0;
 	assert(item);
@@ -357,7 +376,7 @@ static void insert_page_map(struct page_item *item) {
 	}
 	// if we couldn't find a place to insert the page map
 	if(!found) {
-		cur = get_unused_page_item(0);
+		cur = get_unused_page_item(ctl, 0);
 		cur->page = get_page();
 		memset(cur->page->ptr, 0, cur->page->size);
 		list_append(cur, &(ctl->page_map_list));
@@ -367,9 +386,8 @@ static void insert_page_map(struct page_item *item) {
 }
 
 // given an address, to find the corresponding page item
-static struct page_item *find_page_item_by_addr(void *ptr) {
+static struct page_item *find_page_item_by_addr(struct bud_ctl *ctl, void *ptr) {
 	struct page_item *cur;
-	struct bud_ctl *ctl = get_bud_ctl();
 	struct page_map *map_arr;
 	int idx;
 	assert(ptr);
@@ -386,18 +404,19 @@ static struct page_item *find_page_item_by_addr(void *ptr) {
 	return NULL;
 }
 
-// allocate the work page for kma_malloc
-void alloc_work_page() {
-	struct bud_ctl *ctl = get_bud_ctl();
+// allocate the work page for kma_malloc, its blocks go to lists
+void alloc_work_page(struct bud_ctl *ctl, struct block_list *lists) {
 	struct page_item *item;
 	struct free_block *block;
 	assert(ctl);	
-	item = get_unused_page_item(1);
+	item = get_unused_page_item(ctl, 1);
 	item->page = get_page();
-	init_bitmap(item);
-	insert_page_map(item);
+	item->lists = lists;
+	init_bitmap(ctl, item);
+	insert_page_map(ctl, item);
 	block = (struct free_block*)item->page->ptr;
-	block_list_append(block, &(ctl->free_list[ctl->max_order].block));
+	block->zero = item->page->zero;
+	block_list_append(block, &(lists[ctl->max_order].block));
 	list_append(item, &(ctl->work_page_list));
 }
 
@@ -453,9 +472,26 @@ inline int test_block_unused(unsigned char *bitmap, int begin_idx) {
 	return get_bit(bitmap, begin_idx) == 0;
 }
 
+// the end bits follow the used bits and mark the last unit of every
+// block that is handed out, so a block can be freed without its size
+inline void set_block_end(unsigned char *bitmap, int begin_idx, int order) {
+	set_bit(bitmap + BITS_LEN, begin_idx + (1 << order) - 1);
+}
+
+inline void clear_block_end(unsigned char *bitmap, int begin_idx, int order) {
+	clear_bit(bitmap + BITS_LEN, begin_idx + (1 << order) - 1);
+}
+
+// a handed out block has the smallest order whose last unit has an end bit
+inline int get_block_order(unsigned char *bitmap, int begin_idx) {
+	int order = 0;
+	while(!get_bit(bitmap + BITS_LEN, begin_idx + (1 << order) - 1))
+		order++;
+	return order;
+}
+
 // free a working page
-void free_work_page(struct page_item *item) {
-	struct bud_ctl *ctl = get_bud_ctl();
+void free_work_page(struct bud_ctl *ctl, struct page_item *item) {
 	struct page_item *cur;
 	struct page_map *map_arr;
 	int idx;
@@ -473,63 +509,79 @@ void free_work_page(struct page_item *item) {
 	}
 	list_remove(item);
 	free_page(item->page);
-	put_unused_page_item(item, 1);
+	put_unused_page_item(ctl, item, 1);
 }
 
-// used by kma_malloc to get a free block
-struct free_block *get_free_block(int order) {
-	struct bud_ctl *ctl = get_bud_ctl();
+// used by kma_malloc to get a free block. KMA_TEMP blocks come from
+// work pages of their own, KMA_NOWAIT gets NULL rather than a new page
+struct free_block *get_free_block(struct bud_ctl *ctl, int order, int flags) {
 	int i, end_order = order;
 	struct free_block *block = NULL, *buddy_block;
 	struct page_item *item;
+	struct block_list *lists;
 	assert(ctl);
+	lists = flags & KMA_TEMP ? ctl->temp_list : ctl->free_list;
 	// loop to find the avaailable block in increased order 
 	for(i = order; i <= ctl->max_order; i++) {
-		block = ctl->free_list[i].block.next;
-		if(block != &(ctl->free_list[i].block)) {
+		block = lists[i].block.next;
+		if(block != &(lists[i].block)) {
 			end_order = i;
 			block_list_remove(block);
-			item = find_page_item_by_addr((void*)block);
+			item = find_page_item_by_addr(ctl, (void*)block);
 			if(!test_block_unused(item->bitmap, get_block_index(block))) {
 				// local free
-				ctl->free_list[i].slack += 2;
+				lists[i].slack += 2;
 			} else {
 				// global free
-				ctl->free_list[i].slack += 1;
+				lists[i].slack += 1;
 			}
 			break;
 		}
 		if(i == ctl->max_order) {
-			alloc_work_page();
-			block = ctl->free_list[i].block.next;
+			if(flags & KMA_NOWAIT)
+				return NULL;
+			// when the page limit is near, reclaim coalesces the locally
+			// free blocks, which may have made a block of the order
+			if(!page_reserve(4))
+				return get_free_block(ctl, order, flags | KMA_NOWAIT);
+			alloc_work_page(ctl, lists);
+			block = lists[i].block.next;
 			block_list_remove(block);
 			end_order = i;
 		}
 	}
 	assert(block);
 	// split the avaailable block if needed
+	if(end_order > order)
+		ctl->local = 1;
 	for(i = end_order - 1; i >= order; i--) {
 		buddy_block = (struct free_block*)((char*)block + (1<<(i+SIZE_OFFSET)));
-		item = find_page_item_by_addr((void*)buddy_block);
+		item = find_page_item_by_addr(ctl, (void*)buddy_block);
 		set_block_used(item->bitmap, get_block_index(buddy_block));
-		block_list_append(buddy_block, &(ctl->free_list[i].block));
+		buddy_block->zero = block->zero;
+		block_list_append(buddy_block, &(lists[i].block));
 	}
-	item = find_page_item_by_addr((void*)block);
+	item = find_page_item_by_addr(ctl, (void*)block);
 	assert(item);
 	set_block_used(item->bitmap, get_block_index(block));
+	set_block_end(item->bitmap, get_block_index(block), order);
 	return block;
 }
 
 // return the free block to the right list and do coalesc if possible
-void put_free_block(struct free_block *block, int order) {
-	struct bud_ctl *ctl = get_bud_ctl();
+void put_free_block(struct bud_ctl *ctl, struct free_block *block, int order) {
 	struct page_item *item;
+	struct block_list *lists;
 	int idx;
 	assert(ctl);
-	item = find_page_item_by_addr((void*)block);
+	item = find_page_item_by_addr(ctl, (void*)block);
+	lists = item->lists;
 	idx = get_block_index((void*)block);
+	clear_block_end(item->bitmap, idx, order);
+	// the block was handed out, or merged from a block that was
+	block->zero = 0;
 
-	switch(ctl->free_list[order].slack) {
+	switch(lists[order].slack) {
 		// slack == 0
 		case 0:
 			set_block_unused(item->bitmap, idx);
@@ -540,12 +592,12 @@ void put_free_block(struct free_block *block, int order) {
 					idx = get_parent_index(idx, order);
 					block = (struct free_block*)get_block_addr(item->page->ptr, idx);
 					set_block_used(item->bitmap, idx);
-					put_free_block(block, order+1);
+					put_free_block(ctl, block, order+1);
 				}else {
-					block_list_insert_head(block, &(ctl->free_list[order].block));
+					block_list_insert_head(block, &(lists[order].block));
 				}
 			} else if(order == ctl->max_order) {
-				free_work_page(item);
+				free_work_page(ctl, item);
 				break;
 			} else {
 				assert("impossible branch here" == NULL);
@@ -553,9 +605,9 @@ void put_free_block(struct free_block *block, int order) {
 
 			order++;
 			// select on locally free block of order + 1, mark it globally and coalesce if possible
-			block = ctl->free_list[order].block.prev;
-			while(block != &(ctl->free_list[order].block)) {
-				item = find_page_item_by_addr((void*)block);
+			block = lists[order].block.prev;
+			while(block != &(lists[order].block)) {
+				item = find_page_item_by_addr(ctl, (void*)block);
 				idx = get_block_index((void*)block);
 				if(test_block_unused(item->bitmap, idx)) {
 					block = block->prev;
@@ -569,12 +621,12 @@ void put_free_block(struct free_block *block, int order) {
 							idx = get_parent_index(idx, order);
 							block = (struct free_block*)get_block_addr(item->page->ptr, idx);
 							set_block_used(item->bitmap, idx);
-							put_free_block(block, order+1);
+							put_free_block(ctl, block, order+1);
 						}else {
-							block_list_insert_head(block, &(ctl->free_list[order].block));
+							block_list_insert_head(block, &(lists[order].block));
 						}
 					} else if(order == ctl->max_order)
-						free_work_page(item);
+						free_work_page(ctl, item);
 					else {
 						assert("impossible branch here" == NULL);
 					}
@@ -594,29 +646,77 @@ void put_free_block(struct free_block *block, int order) {
 					idx = get_parent_index(idx, order);
 					block = (struct free_block*)get_block_addr(item->page->ptr, idx);
 					set_block_used(item->bitmap, idx);
-					put_free_block(block, order+1);
+					put_free_block(ctl, block, order+1);
 				}else {
-					block_list_append(block, &(ctl->free_list[order].block));
+					block_list_append(block, &(lists[order].block));
 				}
 			} else if(order == ctl->max_order)
-				free_work_page(item);
+				free_work_page(ctl, item);
 			else {
 				assert("impossible branch here" == NULL);
 			}
 
-			ctl->free_list[order].slack = 0;
+			lists[order].slack = 0;
 			break;
 		// otherwise slack >= 2
 		default:
 			// set the freed block as local free
-			assert(ctl->free_list[order].slack >= 0);
-			block_list_append(block, &(ctl->free_list[order].block));
-			ctl->free_list[order].slack -= 2;
+			assert(lists[order].slack >= 0);
+			block_list_append(block, &(lists[order].block));
+			lists[order].slack -= 2;
+			ctl->local = 1;
 			break;
 	}
 
 }
 
+// shrink a block in place, its tail halves become locally free like split halves
+static void shrink_block(struct bud_ctl *ctl, struct free_block *block, int order, int new_order) {
+	struct page_item *item;
+	struct free_block *buddy_block;
+	int i;
+	item = find_page_item_by_addr(ctl, (void*)block);
+	clear_block_end(item->bitmap, get_block_index((void*)block), order);
+	set_block_end(item->bitmap, get_block_index((void*)block), new_order);
+	if(order > new_order)
+		ctl->local = 1;
+	for(i = order - 1; i >= new_order; i--) {
+		buddy_block = (struct free_block*)((char*)block + (1<<(i+SIZE_OFFSET)));
+		set_block_used(item->bitmap, get_block_index(buddy_block));
+		buddy_block->zero = 0;
+		block_list_append(buddy_block, &(item->lists[i].block));
+	}
+}
+
+// grow a block in place by absorbing its buddies, only if all of them are globally free
+static int grow_block(struct bud_ctl *ctl, struct free_block *block, int order, int new_order) {
+	struct page_item *item;
+	int i, idx;
+	item = find_page_item_by_addr(ctl, (void*)block);
+	idx = get_block_index((void*)block);
+	for(i = order; i < new_order; i++) {
+		// the block has to be the lower half at every level
+		if(idx & (1 << i))
+			return 0;
+		if(!check_buddy_free(item->bitmap, idx, i))
+			return 0;
+	}
+	for(i = order; i < new_order; i++) {
+		block_list_remove((struct free_block*)get_block_addr(item->page->ptr, get_buddy_index(idx, i)));
+		// taking a globally free block, as get_free_block does
+		item->lists[i].slack += 1;
+	}
+	clear_block_end(item->bitmap, idx, order);
+	set_block_end(item->bitmap, idx, new_order);
+	return 1;
+}
+
+// the order of a handed out block, for callers that do not pass its size
+static int get_order_by_addr(struct bud_ctl *ctl, void *ptr) {
+	struct page_item *item = find_page_item_by_addr(ctl, ptr);
+	return get_block_order(item->bitmap, get_block_index(ptr));
+}
+
 // a quick function to round a integer up to its nearest power of 2
 inline int __roundup_pow2(int v) {
 	v--;
@@ -629,6 +729,13 @@ inline int __roundup_pow2(int v) {
 	return v;
 }
 
+// when the page limit turns down the first request of the default heap,
+// even after kma_reclaim has coalesced what it could, nothing is handed
+// out and its control unit goes again
+static void release_idle(struct bud_ctl *ctl) {
+	if(ctl->total_alloc == ctl->total_free && !ctl->heap)
+		release_pages(ctl);
+}
 
 void*
 kma_malloc(kma_size_t size)
@@ -636,59 +743,418 @@ kma_malloc(kma_size_t size)
 	struct bud_ctl *ctl;
 	int idx;
 	void *blk;
-	if(size + sizeof(void*) > PAGESIZE)
+	if(size + sizeof(void*) > PAGESIZE || !(ctl = get_default_ctl(0)))
 		return NULL;
-	if(!first_page) {
-		init_first_page();
-	}
-	ctl = get_bud_ctl();
-
-	ctl->total_alloc++;
 
 	idx = get_list_index_by_size(ctl->MultiplyDeBruijnBitPosition, __roundup_pow2(size));
-	blk = (void*)get_free_block(idx);
+	blk = (void*)get_free_block(ctl, idx, 0);
+	if(blk)
+		ctl->total_alloc++;
+	else
+		release_idle(ctl);
 	return blk;
 }
 
+void*
+kma_malloc_flags(kma_size_t size, int flags)
+{
+	struct bud_ctl *ctl;
+	struct free_block *block;
+	int idx;
+	if(size + sizeof(void*) > PAGESIZE || !(ctl = get_default_ctl(flags)))
+		return NULL;
+
+	idx = get_list_index_by_size(ctl->MultiplyDeBruijnBitPosition, __roundup_pow2(size));
+	block = get_free_block(ctl, idx, flags);
+	if(!block) {
+		release_idle(ctl);
+		return NULL;
+	}
+	ctl->total_alloc++;
+	if(flags & KMA_ZERO) {
+		// a block split from a fresh page only holds its list links
+		if(block->zero)
+			memset(block, 0, sizeof(struct free_block));
+		else
+			zero_block(block, size);
+	}
+	return (void*)block;
+}
+
+
+// make a locally free block globally free and coalesce it with its
+// buddies. returns 1 if that gave its work page back
+static int coalesce_block(struct bud_ctl *ctl, struct free_block *block, int order) {
+	struct page_item *item;
+	int idx;
+	item = find_page_item_by_addr(ctl, (void*)block);
+	idx = get_block_index((void*)block);
+	set_block_unused(item->bitmap, idx);
+	while(order < ctl->max_order && check_buddy_free(item->bitmap, idx, order)) {
+		block_list_remove((struct free_block*)get_block_addr(item->page->ptr, get_buddy_index(idx, order)));
+		idx = get_parent_index(idx, order);
+		order++;
+	}
+	if(order == ctl->max_order) {
+		free_work_page(ctl, item);
+		return 1;
+	}
+	block = (struct free_block*)get_block_addr(item->page->ptr, idx);
+	block->zero = 0;
+	block_list_append(block, &(item->lists[order].block));
+	return 0;
+}
+
+// coalesce every locally free block, as an accelerated free would. the
+// slack is reset, since no order has locally free blocks left, and the
+// lists are not walked again until a block goes locally free
+int
+kma_reclaim()
+{
+	struct bud_ctl *ctl;
+	struct block_list *lists;
+	struct free_block local, *block, *next;
+	struct page_item *item;
+	int pool, order, count = 0;
+	if(!first_page || !get_bud_ctl()->local)
+		return -1;
+	ctl = get_bud_ctl();
+	ctl->local = 0;
+
+	for(pool = 0; pool < 2; pool++) {
+		lists = pool ? ctl->temp_list : ctl->free_list;
+		for(order = 0; order <= ctl->max_order; order++) {
+			// move the locally free blocks aside first, coalescing takes
+			// their buddies off the list as it goes
+			local.prev = local.next = &local;
+			block = lists[order].block.next;
+			while(block != &(lists[order].block)) {
+				next = block->next;
+				item = find_page_item_by_addr(ctl, (void*)block);
+				if(!test_block_unused(item->bitmap, get_block_index(block))) {
+					block_list_remove(block);
+					block_list_append(block, &local);
+				}
+				block = next;
+			}
+			while(local.next != &local) {
+				block = local.next;
+				block_list_remove(block);
+				count += coalesce_block(ctl, block, order);
+			}
+			lists[order].slack = 0;
+		}
+	}
+	return count;
+}
+
+// put back or clear the end bits of the locally free blocks
+static void set_local_ends(struct bud_ctl *ctl, int set) {
+	struct page_item *item;
+	struct block_list *lists;
+	struct free_block *block;
+	int pool, order, idx;
+	for(pool = 0; pool < 2; pool++) {
+		lists = pool ? ctl->temp_list : ctl->free_list;
+		for(order = 0; order <= ctl->max_order; order++) {
+			for(block = lists[order].block.next; block != &(lists[order].block); block = block->next) {
+				item = find_page_item_by_addr(ctl, (void*)block);
+				idx = get_block_index(block);
+				if(test_block_unused(item->bitmap, idx))
+					continue;
+				if(set)
+					set_block_end(item->bitmap, idx, order);
+				else
+					clear_block_end(item->bitmap, idx, order);
+			}
+		}
+	}
+}
 
+// the used bits give the blocks handed out. a locally free block keeps
+// its used bit but not its end bit, so its end bit is put back while
+// the pages are walked, and the block is counted as free instead
 void
-kma_free(void* ptr, kma_size_t size)
+kma_get_stats(kma_stats_t* stats)
 {
-	struct bud_ctl *ctl = get_bud_ctl();
+	struct bud_ctl *ctl;
+	struct page_item *cur;
+	struct block_list *lists;
+	struct free_block *block;
+	int pool, order, idx;
+	memset(stats, 0, sizeof(kma_stats_t));
+	if(!first_page)
+		return;
+	ctl = get_bud_ctl();
+
+	stats->meta_pages = 1;
+	for(cur = ctl->ctl_page_list.next; cur != &(ctl->ctl_page_list); cur = cur->next)
+		stats->meta_pages++;
+	for(cur = ctl->page_map_list.next; cur != &(ctl->page_map_list); cur = cur->next)
+		stats->meta_pages++;
+	stats->num_classes = ctl->max_order + 1;
+	for(order = 0; order <= ctl->max_order; order++)
+		stats->classes[order].size = 1 << (order + SIZE_OFFSET);
+	set_local_ends(ctl, 1);
+	for(cur = ctl->work_page_list.next; cur != &(ctl->work_page_list); cur = cur->next) {
+		stats->data_pages++;
+		for(idx = 0; idx < (PAGESIZE >> SIZE_OFFSET); idx++) {
+			if(!get_bit(cur->bitmap, idx))
+				continue;
+			order = get_block_order(cur->bitmap, idx);
+			stats->classes[order].used++;
+			idx += (1 << order) - 1;
+		}
+	}
+	set_local_ends(ctl, 0);
+	for(pool = 0; pool < 2; pool++) {
+		lists = pool ? ctl->temp_list : ctl->free_list;
+		for(order = 0; order <= ctl->max_order; order++) {
+			for(block = lists[order].block.next; block != &(lists[order].block); block = block->next) {
+				stats->classes[order].free++;
+				if(!test_block_unused(find_page_item_by_addr(ctl, (void*)block)->bitmap, get_block_index(block)))
+					stats->classes[order].used--;
+			}
+		}
+	}
+	for(order = 0; order <= ctl->max_order; order++) {
+		stats->used_bytes += (long long)stats->classes[order].used * stats->classes[order].size;
+		stats->free_bytes += (long long)stats->classes[order].free * stats->classes[order].size;
+	}
+}
+
+// return all the pages of a control unit, the unit too
+void release_pages(struct bud_ctl *ctl) {
 	struct page_item *cur;
 	int count = 0;
 	kma_page_t *page_array[MAXPAGES];
+
+	cur = ctl->work_page_list.next;
+	while(cur != &(ctl->work_page_list)) {
+		assert(cur->page->ptr);
+		page_array[count++] = cur->page;
+		cur = cur->next;
+	}
+	cur = ctl->ctl_page_list.next;
+	while(cur != &(ctl->ctl_page_list)) {
+		assert(cur->page->ptr);
+		page_array[count++] = cur->page;
+		cur = cur->next;
+	}
+	cur = ctl->page_map_list.next;
+	while(cur != &(ctl->page_map_list)) {
+		assert(cur->page->ptr);
+		page_array[count++] = cur->page;
+		cur = cur->next;
+	}
+	for(count = count - 1; count >= 0; count--)
+		free_page(page_array[count]);
+	if(ctl->page == first_page)
+		first_page = NULL;
+	free_page(ctl->page);
+}
+
+// free a block of a control unit, which goes with its last block unless
+// it is a heap
+static void put_block(struct bud_ctl *ctl, void *ptr, kma_size_t size) {
 	assert(ctl);
 
-	put_free_block((struct free_block*)ptr, get_list_index_by_size(ctl->MultiplyDeBruijnBitPosition,
-				__roundup_pow2(size)));
+	// without the size, the end bits know the order
+	put_free_block(ctl, (struct free_block*)ptr, size == KMA_UNSIZED ? get_order_by_addr(ctl, ptr) :
+			get_list_index_by_size(ctl->MultiplyDeBruijnBitPosition, __roundup_pow2(size)));
 	ctl->total_free++;
 
-	if(ctl->total_alloc == ctl->total_free) {
-		cur = ctl->work_page_list.next;
-		while(cur != &(ctl->work_page_list)) {
-			assert(cur->page->ptr);
-			page_array[count++] = cur->page;
-			cur = cur->next;
-		}
-		cur = ctl->ctl_page_list.next;
-		while(cur != &(ctl->ctl_page_list)) {
-			assert(cur->page->ptr);
-			page_array[count++] = cur->page;
-			cur = cur->next;
-		}
-		cur = ctl->page_map_list.next;
-		while(cur != &(ctl->page_map_list)) {
-			assert(cur->page->ptr);
-			page_array[count++] = cur->page;
-			cur = cur->next;
+	if(ctl->total_alloc == ctl->total_free && !ctl->heap)
+		release_pages(ctl);
+}
+
+void
+kma_free(void* ptr, kma_size_t size)
+{
+	put_block(get_bud_ctl(), ptr, size);
+}
+
+void*
+kma_realloc(void* ptr, kma_size_t size, kma_size_t new_size)
+{
+	struct bud_ctl *ctl;
+	int order, new_order;
+	void *new_ptr;
+	if(!ptr)
+		return kma_malloc(new_size);
+	if(new_size + sizeof(void*) > PAGESIZE)
+		return NULL;
+	ctl = get_bud_ctl();
+	assert(ctl);
+
+	if(size == KMA_UNSIZED)
+		size = kma_usable_size(ptr);
+
+	order = get_list_index_by_size(ctl->MultiplyDeBruijnBitPosition, __roundup_pow2(size));
+	new_order = get_list_index_by_size(ctl->MultiplyDeBruijnBitPosition, __roundup_pow2(new_size));
+	if(new_order == order)
+		return ptr;
+	if(new_order < order) {
+		shrink_block(ctl, (struct free_block*)ptr, order, new_order);
+		return ptr;
+	}
+	if(grow_block(ctl, (struct free_block*)ptr, order, new_order))
+		return ptr;
+
+	new_ptr = kma_malloc(new_size);
+	if(new_ptr) {
+		memcpy(new_ptr, ptr, size);
+		kma_free(ptr, size);
+	}
+	return new_ptr;
+}
+
+void*
+kma_calloc(kma_size_t nmemb, kma_size_t size)
+{
+	long long total = (long long)nmemb * size;
+	struct free_block *block;
+	if(total + sizeof(void*) > PAGESIZE)
+		return NULL;
+	block = (struct free_block*)kma_malloc(total);
+	if(!block)
+		return NULL;
+	// a block split from a fresh page only holds its list links
+	if(block->zero)
+		memset(block, 0, sizeof(struct free_block));
+	else
+		zero_block(block, total);
+	return block;
+}
+
+void*
+kma_malloc_aligned(kma_size_t size, kma_size_t align)
+{
+	struct bud_ctl *ctl;
+	struct free_block *block;
+	int order, align_order;
+	// a block is aligned to its own size, so the request only has to fit
+	// the block of the larger of the two, up to a whole page
+	if(align == 0 || (align & (align - 1)) || align > PAGESIZE || size + sizeof(void*) > PAGESIZE)
+		return NULL;
+	if(!(ctl = get_default_ctl(0)))
+		return NULL;
+	// only an alignment beyond the size needs the larger block, whose
+	// tail halves go right back
+	order = get_list_index_by_size(ctl->MultiplyDeBruijnBitPosition, __roundup_pow2(size));
+	align_order = get_list_index_by_size(ctl->MultiplyDeBruijnBitPosition, align);
+	if(align_order <= order)
+		return kma_malloc(size);
+	if(!(block = get_free_block(ctl, align_order, 0))) {
+		release_idle(ctl);
+		return NULL;
+	}
+	ctl->total_alloc++;
+	shrink_block(ctl, block, align_order, order);
+	return (void*)block;
+}
+
+kma_size_t
+kma_usable_size(void* ptr)
+{
+	return 1 << (get_order_by_addr(get_bud_ctl(), ptr) + SIZE_OFFSET);
+}
+
+// order the batch by address, batches are short enough for an insertion sort
+static void sort_addr(void **ptrs, int n) {
+	void *p;
+	int i, j;
+	for(i = 1; i < n; i++) {
+		p = ptrs[i];
+		for(j = i; j > 0 && (char*)ptrs[j - 1] > (char*)p; j--)
+			ptrs[j] = ptrs[j - 1];
+		ptrs[j] = p;
+	}
+}
+
+int
+kma_malloc_batch(kma_size_t size, int n, void* ptrs[])
+{
+	struct bud_ctl *ctl;
+	int idx, i;
+	if(size + sizeof(void*) > PAGESIZE || !(ctl = get_default_ctl(0)))
+		return 0;
+
+	// the slack counts every block on its own, so the blocks still come
+	// one at a time, only the order is worked out once
+	idx = get_list_index_by_size(ctl->MultiplyDeBruijnBitPosition, __roundup_pow2(size));
+	for(i = 0; i < n; i++)
+		if(!(ptrs[i] = (void*)get_free_block(ctl, idx, 0)))
+			break;
+	ctl->total_alloc += i;
+	if(i == 0)
+		release_idle(ctl);
+	return i;
+}
+
+void
+kma_free_batch(void* ptrs[], int n)
+{
+	struct bud_ctl *ctl = get_bud_ctl();
+	struct page_item *item = NULL;
+	void *start = NULL;
+	int i;
+	assert(ctl);
+
+	// in address order a block and its buddy are freed one after the
+	// other, so a coalescing free finds its buddy right away. the orders
+	// are read from the bitmap of a page looked up once for its blocks,
+	// by its start since the item goes if the page coalesces back
+	sort_addr(ptrs, n);
+	for(i = 0; i < n; i++) {
+		if(get_page_start(ptrs[i]) != start) {
+			start = get_page_start(ptrs[i]);
+			item = find_page_item_by_addr(ctl, ptrs[i]);
 		}
-		for(count = count - 1; count >= 0; count--)
-			free_page(page_array[count]);
-		free_page(first_page);
-		first_page = NULL;
+		put_free_block(ctl, (struct free_block*)ptrs[i], get_block_order(item->bitmap, get_block_index(ptrs[i])));
 	}
+	ctl->total_free += n;
+
+	if(ctl->total_alloc == ctl->total_free && !ctl->heap)
+		release_pages(ctl);
+}
+
+// a heap keeps its own lists and slack, so its frees are not put off
+// by the other heaps. the handle is the control unit
+kma_heap_t*
+kma_heap_create()
+{
+	struct bud_ctl *ctl;
+	if(!page_reserve(1))
+		return NULL;
+	ctl = init_ctl();
+	ctl->heap = 1;
+	return (kma_heap_t*)ctl;
+}
+
+void
+kma_heap_destroy(kma_heap_t *heap)
+{
+	release_pages((struct bud_ctl*)heap);
+}
+
+void*
+kma_heap_malloc(kma_heap_t *heap, kma_size_t size)
+{
+	struct bud_ctl *ctl = (struct bud_ctl*)heap;
+	void *blk;
+	if(size + sizeof(void*) > PAGESIZE)
+		return NULL;
+	blk = (void*)get_free_block(ctl, get_list_index_by_size(ctl->MultiplyDeBruijnBitPosition, __roundup_pow2(size)), 0);
+	if(blk)
+		ctl->total_alloc++;
+	return blk;
 }
 
+void
+kma_heap_free(kma_heap_t *heap, void* ptr, kma_size_t size)
+{
+	put_block((struct bud_ctl*)heap, ptr, size);
+}
 
 #endif // KMA_LZBUD
@@ -34,6 +34,7 @@
  ***************************************************************************/
 #ifdef KMA_MCK2
 #define __KMA_IMPL__
+#define __KMA_MCK2_IMPL__
 
 /************System include***********************************************/
 #include <assert.h>
@@ -44,6 +45,7 @@
 /************Private include**********************************************/
 #include "kma_page.h"
 #include "kma.h"
+#include "kma_mck2.h"
 
 /************Defines and Typedefs*****************************************/
 /*  #defines and typedefs should have their names in all caps.
@@ -60,11 +62,17 @@
 
 /**************Implementation***********************************************/
 
-#define SIZE_NUM	(20)
+// the most size classes, and the smallest class, which every class is a
+// multiple of
+#define SIZE_NUM	(28)
 #define SIZE_OFFSET	(4)
+#define CLASS_LEN	(PAGESIZE / (1 << SIZE_OFFSET) + 1)
 #define MAX_SIZE	PAGESIZE
 #define PAGE_INDEX_MASK	(~(PAGESIZE-1))
 #define PAGE_BIT_LEN	((PAGESIZE==8192)?(13):((PAGESIZE==4096)?12:11))
+// empty pages kept for the next requests, the pages that empty beyond
+// them are given back at once
+#define EMPTY_KEEP	(2)
 
 
 // a fast helper to calculate the nearest power of 2
@@ -92,33 +100,43 @@ inline void *get_page_end(void *addr) {
 
 // the entry point of the first page
 static kma_page_t *first_page = NULL;
+// the classes the next control unit is set up with, see kma_mck2_set_classes
+static int class_steps = 4;
 struct page_map {
 	struct page_item *page;
 };
 
+struct free_block {
+	void *next;
+};
+
 struct page_item {
 	kma_page_t *page;
 	int order;
+	int live;		// blocks of the page handed out
+	struct free_block *free;	// the blocks of the page handed out and freed
+	char *bump;		// the first block never handed out, NULL past the last
 	struct page_item *prev;
 	struct page_item *next;
 };
 
-struct free_block {
-	void *next;
-};
-
-struct block_list {
-	struct free_block *next;
-};
-
 // the control unit of this allocator
 struct mck2_ctl {
+	kma_page_t *page;	// the page the unit is on
 	int total_alloc;
 	int total_free;
-	struct block_list free_list[SIZE_NUM];
+	// the pages of every size, those with free blocks first. the KMA_TEMP
+	// lists follow the others, so their pages never mix
+	struct page_item free_list[2 * SIZE_NUM];
 	struct page_item unused_list;
-	struct page_item page_list;
+	struct page_item page_list;		// pages of page items
 	struct page_item page_map_list;
+	int heap;		// only kma_heap_destroy releases the pages
+	int empty;		// data pages with no block handed out
+	int class_num;
+	int class_size[SIZE_NUM];
+	// the class of every size, by the size in units of the smallest class
+	unsigned char class_of[CLASS_LEN];
 };
 
 inline struct mck2_ctl *get_mck2_ctl() {
@@ -160,13 +178,13 @@ static inline int get_page_map_index(void *ptr) {
 	return (((unsigned long)ptr)>>PAGE_BIT_LEN)&(PAGESIZE/sizeof(struct page_map)-1);
 }
 
-extern struct page_item *get_unused_page_item();
+extern struct page_item *get_unused_page_item(struct mck2_ctl *ctl);
+extern void release_pages(struct mck2_ctl *ctl);
 
 // to insert a page item into the page map
-static void insert_page_map(struct page_item *item) {
+static void insert_page_map(struct mck2_ctl *ctl, struct page_item *item) {
 	int idx;
 	struct page_item *cur;
-	struct mck2_ctl *ctl = get_mck2_ctl();
 	struct page_map *map_arr;
 	int found = 0;
 	assert(item);
@@ -181,7 +199,7 @@ static void insert_page_map(struct page_item *item) {
 		cur = cur->next;
 	}
 	if(!found) {
-		cur = get_unused_page_item(0);
+		cur = get_unused_page_item(ctl);
 		cur->page = get_page();
 		memset(cur->page->ptr, 0, cur->page->size);
 		list_append(cur, &(ctl->page_map_list));
@@ -190,10 +208,25 @@ static void insert_page_map(struct page_item *item) {
 	map_arr[idx].page = item;
 }
 
+// remove a page item from the page map when its page is given back
+static void remove_page_map(struct mck2_ctl *ctl, struct page_item *item) {
+	struct page_item *cur;
+	struct page_map *map_arr;
+	int idx = get_page_map_index(item->page->ptr);
+	cur = ctl->page_map_list.next;
+	while(cur != &(ctl->page_map_list)) {
+		map_arr = (struct page_map*)cur->page->ptr;
+		if(map_arr[idx].page == item) {
+			map_arr[idx].page = NULL;
+			return;
+		}
+		cur = cur->next;
+	}
+}
+
 // find a page item using a specified address
-static struct page_item *find_page_item_by_addr(void *ptr) {
+static struct page_item *find_page_item_by_addr(struct mck2_ctl *ctl, void *ptr) {
 	struct page_item *cur;
-	struct mck2_ctl *ctl = get_mck2_ctl();
 	struct page_map *map_arr;
 	int idx;
 	assert(ptr);
@@ -212,8 +245,7 @@ static struct page_item *find_page_item_by_addr(void *ptr) {
 }
 
 // add and initialize all the list items in a new allocated page
-void add_page_for_page_item() {
-	struct mck2_ctl *ctl = get_mck2_ctl();
+void add_page_for_page_item(struct mck2_ctl *ctl) {
 	struct page_item *cur, *end;
 	kma_page_t *page;
 	assert(ctl);
@@ -224,46 +256,68 @@ void add_page_for_page_item() {
 	for(; cur + 1 < end; cur++) {
 		list_append(cur, &(ctl->unused_list));
 	}
-	cur = get_unused_page_item();
+	cur = get_unused_page_item(ctl);
 	cur->page = page;
+	cur->order = -1;
 	list_append(cur, &(ctl->page_list));
 }
 
-// add the free blocks in one page to a specified free list
-void add_page_for_idx(int idx) {
-	struct mck2_ctl *ctl = get_mck2_ctl();
-	// set the target size
-	int sz = 1 << (idx + SIZE_OFFSET);
-	char *cur, *end;
-	struct free_block *block;
+// add a new page to the front of a specified free list. its blocks are
+// cut from the page start one at a time as they are handed out, so the
+// page is not written until then
+void add_page_for_idx(struct mck2_ctl *ctl, int idx) {
 	kma_page_t *page;
 	struct page_item *item;
 	assert(ctl);
 	page = get_page();
-	cur = (char*)(page->ptr);
-	end = (char*)get_page_end(cur);
-	// add to free list
-	for(; cur + sz <= end; cur += sz) {
-		block = (struct free_block*)cur;
-		block->next = ctl->free_list[idx].next;
-		ctl->free_list[idx].next = block;
-	}
-	item = get_unused_page_item();
+	item = get_unused_page_item(ctl);
 	assert(item);
 	item->page = page;
-	list_append(item, &(ctl->page_list));
 	item->order = idx;
-	insert_page_map(item);
+	item->free = NULL;
+	item->bump = (char*)(page->ptr);
+	// empty until the caller takes a block
+	item->live = 0;
+	ctl->empty++;
+	list_insert_head(item, &(ctl->free_list[idx]));
+	insert_page_map(ctl, item);
 }
 
-// initialize the first control page
-void init_first_page() {
+// the classes between two powers of two are spaced evenly, and each
+// one is grown as long as it fits as many blocks in a page. the powers
+// of two divide the page, so they stay as they are
+static void init_classes(struct mck2_ctl *ctl) {
+	int pow, step, sz, fit, i = 0;
+	ctl->class_num = 0;
+	for(pow = 1 << SIZE_OFFSET; pow < PAGESIZE; pow <<= 1) {
+		for(step = 0; step < class_steps; step++) {
+			sz = pow + pow / class_steps * step;
+			fit = (PAGESIZE / (PAGESIZE / sz)) & ~((1 << SIZE_OFFSET) - 1);
+			if(ctl->class_num == 0 || fit > ctl->class_size[ctl->class_num - 1])
+				ctl->class_size[ctl->class_num++] = fit;
+		}
+	}
+	// the sizes over half a page may already have grown to a whole one
+	if(ctl->class_size[ctl->class_num - 1] < PAGESIZE)
+		ctl->class_size[ctl->class_num++] = PAGESIZE;
+	assert(ctl->class_num <= SIZE_NUM);
+	// a size takes the smallest class it fits in
+	for(sz = 0; sz < CLASS_LEN; sz++) {
+		while(ctl->class_size[i] < sz << SIZE_OFFSET)
+			i++;
+		ctl->class_of[sz] = i;
+	}
+}
+
+// set up a control unit on a new page, with the classes set for it
+struct mck2_ctl *init_ctl() {
 	struct mck2_ctl *ctl;
 	struct page_item *cur, *end;
+	kma_page_t *page = get_page();
 	int i;
-	first_page = get_page();
-	memset(first_page->ptr, 0, first_page->size);
-	ctl = (struct mck2_ctl*)(first_page->ptr);
+	memset(page->ptr, 0, page->size);
+	ctl = (struct mck2_ctl*)(page->ptr);
+	ctl->page = page;
 	ctl->total_alloc = 0;
 	ctl->total_free = 0;
 
@@ -279,121 +333,453 @@ void init_first_page() {
 	}
 
 	// initialize all the free list
-	for(i = 0; i < SIZE_NUM; i++) {
-		ctl->free_list[i].next = NULL;
+	for(i = 0; i < 2 * SIZE_NUM; i++)
+		ctl->free_list[i].prev = ctl->free_list[i].next = &(ctl->free_list[i]);
+	init_classes(ctl);
+	return ctl;
+}
+
+// the default heap, which the first request sets up. NULL if the page
+// for it cannot be had
+static struct mck2_ctl *get_default_ctl(int flags) {
+	if(!first_page) {
+		if((flags & KMA_NOWAIT) || !page_reserve(1))
+			return NULL;
+		first_page = init_ctl()->page;
 	}
+	return get_mck2_ctl();
 }
 
 // get unused list item
-struct page_item *get_unused_page_item() {
-	struct mck2_ctl *ctl = get_mck2_ctl();
+struct page_item *get_unused_page_item(struct mck2_ctl *ctl) {
 	struct page_item *node;
 	assert(ctl);
 	if(ctl->unused_list.prev == &(ctl->unused_list))
-		add_page_for_page_item();
+		add_page_for_page_item(ctl);
 	node = ctl->unused_list.next;
 	list_remove(node);
 	return node;
 };
 
 // return the list item to unused list
-void put_unused_page_item(struct page_item *node) {
-	struct mck2_ctl *ctl = get_mck2_ctl();
+void put_unused_page_item(struct mck2_ctl *ctl, struct page_item *node) {
 	assert(node);
 	list_insert_head(node, &(ctl->unused_list));
 }
 
 
-// calculate the log2
-int get_list_index_by_size(int sz) {
-	int ret = 3;
-	sz >>= 3;
-	while(sz != 1) {
-		sz >>= 1;
-		ret++;
+// the free list a size is served from
+static inline int get_list_index_by_size(struct mck2_ctl *ctl, int sz) {
+	return ctl->class_of[(sz + (1 << SIZE_OFFSET) - 1) >> SIZE_OFFSET];
+}
+
+// the block size of the pages of an order
+static inline int get_order_size(struct mck2_ctl *ctl, int order) {
+	return ctl->class_size[order % SIZE_NUM];
+}
+
+
+// the first page of a free list, NULL if none of its pages has a free block
+static inline struct page_item *get_free_page(struct mck2_ctl *ctl, int idx) {
+	struct page_item *item = ctl->free_list[idx].next;
+	return item != &(ctl->free_list[idx]) && (item->free || item->bump) ? item : NULL;
+}
+
+// take a block from the first page of the list, which has one. freed
+// blocks go first, then the next block is cut from the rest of the page.
+// a page that runs out goes behind the others. zero is set if the block
+// was never written
+static inline void *take_block(struct mck2_ctl *ctl, int idx, int *zero) {
+	struct page_item *item = ctl->free_list[idx].next;
+	struct free_block *block = item->free;
+	int sz;
+	if(block) {
+		item->free = block->next;
+		*zero = 0;
+	} else {
+		sz = get_order_size(ctl, idx);
+		block = (struct free_block*)item->bump;
+		item->bump += sz;
+		if(item->bump + sz > (char*)get_page_end(block))
+			item->bump = NULL;
+		*zero = item->page->zero;
+	}
+	if(item->live++ == 0)
+		ctl->empty--;
+	if(!item->free && !item->bump) {
+		list_remove(item);
+		list_append(item, &(ctl->free_list[idx]));
+	}
+	return (void*)block;
+}
+
+// give a page back, with all of its blocks free
+static void release_page(struct mck2_ctl *ctl, struct page_item *item) {
+	remove_page_map(ctl, item);
+	list_remove(item);
+	free_page(item->page);
+	put_unused_page_item(ctl, item);
+}
+
+// put a block back on its page, which goes in front of the others so
+// the next request takes the block while it is still cached. a page that
+// empties is given back unless EMPTY_KEEP others are kept already
+static inline void put_block(struct mck2_ctl *ctl, struct page_item *item, void *ptr) {
+	struct free_block *block = (struct free_block*)ptr;
+	if(ctl->free_list[item->order].next != item) {
+		list_remove(item);
+		list_insert_head(item, &(ctl->free_list[item->order]));
 	}
-	ret -= SIZE_OFFSET;
-	return ret <= 0 ? 0 : ret;
+	block->next = item->free;
+	item->free = block;
+	if(--item->live > 0)
+		return;
+	if(ctl->empty < EMPTY_KEEP)
+		ctl->empty++;
+	else
+		release_page(ctl, item);
 }
 
+// the default heap is set up by its first request, and goes again when
+// the page limit refuses that request before it holds any block
+static void release_idle(struct mck2_ctl *ctl) {
+	if(ctl->total_alloc == ctl->total_free && !ctl->heap)
+		release_pages(ctl);
+}
+
+// pop a block from the free list of its size. zero is set if the block
+// was never written. flags pick the KMA_TEMP lists and
+// forbid new pages with KMA_NOWAIT
+void *get_block(struct mck2_ctl *ctl, kma_size_t size, int flags, int *zero) {
+	int idx;
+
+	idx = get_list_index_by_size(ctl, size);
+	if(flags & KMA_TEMP)
+		idx += SIZE_NUM;
+
+	// add page if the target free list is empty
+	if(!get_free_page(ctl, idx)) {
+		// the page may need a page item and a page map page as well
+		if((flags & KMA_NOWAIT) || !page_reserve(3)) {
+			release_idle(ctl);
+			return NULL;
+		}
+		add_page_for_idx(ctl, idx);
+	}
+	ctl->total_alloc++;
+	
+	return take_block(ctl, idx, zero);
+}
 
 void*
 kma_malloc(kma_size_t size)
 {
 	struct mck2_ctl *ctl;
-	int sz, idx;
-	struct free_block *block;
-	if(size + sizeof(void*) > PAGESIZE)
+	int zero;
+	if(size + sizeof(void*) > PAGESIZE || !(ctl = get_default_ctl(0)))
 		return NULL;
-	if(!first_page) {
-		init_first_page();
+	return get_block(ctl, size, 0, &zero);
+}
+
+void*
+kma_malloc_flags(kma_size_t size, int flags)
+{
+	struct mck2_ctl *ctl;
+	void *ptr;
+	int zero;
+	if(size + sizeof(void*) > PAGESIZE || !(ctl = get_default_ctl(flags)))
+		return NULL;
+	ptr = get_block(ctl, size, flags, &zero);
+	if(ptr && (flags & KMA_ZERO) && !zero)
+		zero_block(ptr, size);
+	return ptr;
+}
+
+// free all the pages of a control unit, the unit too
+void release_pages(struct mck2_ctl *ctl) {
+	struct page_item *cur;
+	int count = 0, i;
+	kma_page_t *page_array[MAXPAGES];
+
+	// traverse the data pages of every size
+	for(i = 0; i < 2 * SIZE_NUM; i++) {
+		for(cur = ctl->free_list[i].next; cur != &(ctl->free_list[i]); cur = cur->next) {
+			assert(cur->page->ptr);
+			page_array[count++] = cur->page;
+		}
+	}
+	// traverse the control page list
+	cur = ctl->page_list.next;
+	while(cur != &(ctl->page_list)) {
+		assert(cur->page->ptr);
+		page_array[count++] = cur->page;
+		cur = cur->next;
+	}
+	// traverse the page map list
+	cur = ctl->page_map_list.next;
+	while(cur != &(ctl->page_map_list)) {
+		assert(cur->page->ptr);
+		page_array[count++] = cur->page;
+		cur = cur->next;
 	}
+	for(count = count - 1; count >= 0; count--)
+		free_page(page_array[count]);
+	if(ctl->page == first_page)
+		first_page = NULL;
+	free_page(ctl->page);
+}
+
+// give back the pages with no block handed out, the kept ones too
+int
+kma_reclaim()
+{
+	struct mck2_ctl *ctl;
+	struct page_item *cur, *next;
+	int i, count = 0;
+	if(!first_page || get_mck2_ctl()->empty == 0)
+		return -1;
 	ctl = get_mck2_ctl();
 
-	sz = roundup_pow2(size);
+	for(i = 0; i < 2 * SIZE_NUM; i++) {
+		for(cur = ctl->free_list[i].next; cur != &(ctl->free_list[i]); cur = next) {
+			next = cur->next;
+			if(cur->live > 0)
+				continue;
+			release_page(ctl, cur);
+			count++;
+		}
+	}
+	ctl->empty = 0;
+	return count;
+}
 
-	idx = get_list_index_by_size(sz);
+// a page holds blocks of one size only, and knows how many of them are
+// handed out
+void
+kma_get_stats(kma_stats_t* stats)
+{
+	struct mck2_ctl *ctl;
+	struct page_item *cur;
+	kma_class_stat_t *cls;
+	int i;
+	memset(stats, 0, sizeof(kma_stats_t));
+	if(!first_page)
+		return;
+	ctl = get_mck2_ctl();
 
-	// add page if the target free list is empty
-	if(ctl->free_list[idx].next == NULL) {
-		add_page_for_idx(idx);
+	stats->meta_pages = 1;
+	for(cur = ctl->page_map_list.next; cur != &(ctl->page_map_list); cur = cur->next)
+		stats->meta_pages++;
+	// pages of page items
+	for(cur = ctl->page_list.next; cur != &(ctl->page_list); cur = cur->next)
+		stats->meta_pages++;
+	stats->num_classes = ctl->class_num;
+	for(i = 0; i < stats->num_classes; i++)
+		stats->classes[i].size = ctl->class_size[i];
+	for(i = 0; i < 2 * SIZE_NUM; i++) {
+		cls = &(stats->classes[i % SIZE_NUM]);
+		for(cur = ctl->free_list[i].next; cur != &(ctl->free_list[i]); cur = cur->next) {
+			stats->data_pages++;
+			cls->used += cur->live;
+			cls->free += PAGESIZE / cls->size - cur->live;
+		}
+	}
+	for(i = 0; i < stats->num_classes; i++) {
+		stats->used_bytes += (long long)stats->classes[i].used * stats->classes[i].size;
+		stats->free_bytes += (long long)stats->classes[i].free * stats->classes[i].size;
 	}
-	block = ctl->free_list[idx].next;
-	assert(block);
-	ctl->free_list[idx].next = block->next;
-	block->next = (void*)&(ctl->free_list[idx]);
+}
 
-	ctl->total_alloc++;
-	
-	return (void*)block;
+// free a block of a control unit, which goes with its last block unless
+// it is a heap
+static void free_block(struct mck2_ctl *ctl, void *ptr) {
+	struct page_item *node;
+	assert(ctl);
+
+	node = find_page_item_by_addr(ctl, ptr);
+	put_block(ctl, node, ptr);
+
+	ctl->total_free++;
+
+	if(ctl->total_alloc == ctl->total_free && !ctl->heap)
+		release_pages(ctl);
 }
 
 void
 kma_free(void* ptr, kma_size_t size)
 {
-	struct mck2_ctl *ctl = get_mck2_ctl();
-	struct page_item *cur, *node;
-	struct free_block *block;
-	struct block_list *list;
-	int count = 0;
-	kma_page_t *page_array[MAXPAGES];
-	assert(ctl);
+	free_block(get_mck2_ctl(), ptr);
+}
 
-	block = (struct free_block*)ptr;
+void*
+kma_realloc(void* ptr, kma_size_t size, kma_size_t new_size)
+{
+	struct mck2_ctl *ctl;
+	struct page_item *node;
+	void *new_ptr;
+	if(!ptr)
+		return kma_malloc(new_size);
+	if(new_size + sizeof(void*) > PAGESIZE)
+		return NULL;
+	if(size == KMA_UNSIZED)
+		size = kma_usable_size(ptr);
 
-	node = find_page_item_by_addr(ptr);
-	//list = &(ctl->free_list[get_list_index_by_size(roundup_pow2(size))]);	
-	list = &(ctl->free_list[node->order]);
+	// all the blocks on a page have the size of the page's order
+	ctl = get_mck2_ctl();
+	node = find_page_item_by_addr(ctl, ptr);
+	if(new_size <= get_order_size(ctl, node->order))
+		return ptr;
+
+	new_ptr = kma_malloc(new_size);
+	if(new_ptr) {
+		memcpy(new_ptr, ptr, size < new_size ? size : new_size);
+		kma_free(ptr, size);
+	}
+	return new_ptr;
+}
 
-	block->next = list->next;
-	list->next = block;
+void*
+kma_calloc(kma_size_t nmemb, kma_size_t size)
+{
+	long long total = (long long)nmemb * size;
+	struct mck2_ctl *ctl;
+	void *ptr;
+	int zero;
+	if(total + sizeof(void*) > PAGESIZE || !(ctl = get_default_ctl(0)))
+		return NULL;
+	ptr = get_block(ctl, total, 0, &zero);
+	// a block cut from a fresh page was never written
+	if(ptr && !zero)
+		zero_block(ptr, total);
+	return ptr;
+}
 
-	ctl->total_free++;
+void*
+kma_malloc_aligned(kma_size_t size, kma_size_t align)
+{
+	struct mck2_ctl *ctl;
+	int zero;
+	if(align == 0 || (align & (align - 1)) || size + align + sizeof(void*) > PAGESIZE)
+		return NULL;
+	if(!(ctl = get_default_ctl(0)))
+		return NULL;
+	// blocks are carved from the page start in steps of their size, so
+	// every block is aligned to the smallest class, and the blocks of a
+	// power of two to their size. kma_free finds the class by page
+	if(align <= (1 << SIZE_OFFSET))
+		return get_block(ctl, size, 0, &zero);
+	return get_block(ctl, roundup_pow2(size > align ? size : align), 0, &zero);
+}
 
-	// free all the pages after all the requests have been done
-	if(ctl->total_alloc == ctl->total_free) {
-		// traverse the control page list
-		cur = ctl->page_list.next;
-		while(cur != &(ctl->page_list)) {
-			assert(cur->page->ptr);
-			page_array[count++] = cur->page;
-			cur = cur->next;
+kma_size_t
+kma_usable_size(void* ptr)
+{
+	// all the blocks on a page have the size of the page's order
+	struct mck2_ctl *ctl = get_mck2_ctl();
+	return get_order_size(ctl, find_page_item_by_addr(ctl, ptr)->order);
+}
+
+// order the batch by address, batches are short enough for an insertion sort
+static void sort_addr(void **ptrs, int n) {
+	void *p;
+	int i, j;
+	for(i = 1; i < n; i++) {
+		p = ptrs[i];
+		for(j = i; j > 0 && (char*)ptrs[j - 1] > (char*)p; j--)
+			ptrs[j] = ptrs[j - 1];
+		ptrs[j] = p;
+	}
+}
+
+int
+kma_malloc_batch(kma_size_t size, int n, void* ptrs[])
+{
+	struct mck2_ctl *ctl;
+	int idx, i, zero;
+	if(size + sizeof(void*) > PAGESIZE || !(ctl = get_default_ctl(0)))
+		return 0;
+
+	// take the blocks off one list, a page at a time when it runs dry
+	idx = get_list_index_by_size(ctl, size);
+	for(i = 0; i < n; i++) {
+		if(!get_free_page(ctl, idx)) {
+			if(!page_reserve(3))
+				break;
+			add_page_for_idx(ctl, idx);
 		}
-		// traverse the page map list
-		cur = ctl->page_map_list.next;
-		while(cur != &(ctl->page_map_list)) {
-			assert(cur->page->ptr);
-			page_array[count++] = cur->page;
-			cur = cur->next;
+		ptrs[i] = take_block(ctl, idx, &zero);
+	}
+	ctl->total_alloc += i;
+	if(i == 0)
+		release_idle(ctl);
+	return i;
+}
+
+void
+kma_free_batch(void* ptrs[], int n)
+{
+	struct mck2_ctl *ctl = get_mck2_ctl();
+	struct page_item *node = NULL;
+	void *start = NULL;
+	int i;
+	assert(ctl);
+
+	// in address order the blocks of one page share one page map lookup
+	sort_addr(ptrs, n);
+	for(i = 0; i < n; i++) {
+		if(get_page_start(ptrs[i]) != start) {
+			start = get_page_start(ptrs[i]);
+			node = find_page_item_by_addr(ctl, ptrs[i]);
 		}
-		for(count = count - 1; count >= 0; count--)
-			free_page(page_array[count]);
-		free_page(first_page);
-		first_page = NULL;
+		put_block(ctl, node, ptrs[i]);
 	}
+	ctl->total_free += n;
+
+	if(ctl->total_alloc == ctl->total_free && !ctl->heap)
+		release_pages(ctl);
+}
+
+// a heap has free lists and a page map of its own, cut into the classes
+// set when it is made. its handle is the control unit
+kma_heap_t*
+kma_heap_create()
+{
+	struct mck2_ctl *ctl;
+	if(!page_reserve(1))
+		return NULL;
+	ctl = init_ctl();
+	ctl->heap = 1;
+	return (kma_heap_t*)ctl;
+}
+
+void
+kma_heap_destroy(kma_heap_t *heap)
+{
+	release_pages((struct mck2_ctl*)heap);
 }
 
+void*
+kma_heap_malloc(kma_heap_t *heap, kma_size_t size)
+{
+	int zero;
+	if(size + sizeof(void*) > PAGESIZE)
+		return NULL;
+	return get_block((struct mck2_ctl*)heap, size, 0, &zero);
+}
 
+void
+kma_heap_free(kma_heap_t *heap, void* ptr, kma_size_t size)
+{
+	free_block((struct mck2_ctl*)heap, ptr);
+}
 
+int
+kma_mck2_set_classes(int steps)
+{
+	if(steps != 1 && steps != 2 && steps != 4)
+		return FALSE;
+	class_steps = steps;
+	return TRUE;
+}
 
 #endif // KMA_MCK2
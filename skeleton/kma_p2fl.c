@@ -34,6 +34,7 @@
  ***************************************************************************/
 #ifdef KMA_P2FL
 #define __KMA_IMPL__
+#define __KMA_P2FL_IMPL__
 
 /************System include***********************************************/
 #include <assert.h>
@@ -44,6 +45,7 @@
 /************Private include**********************************************/
 #include "kma_page.h"
 #include "kma.h"
+#include "kma_p2fl.h"
 
 /************Defines and Typedefs*****************************************/
 /*  #defines and typedefs should have their names in all caps.
@@ -60,8 +62,22 @@
 
 /**************Implementation***********************************************/
 
+#define PAGE_BIT_LEN	((PAGESIZE==8192)?(13):((PAGESIZE==4096)?12:11))
 #define SIZE_NUM	(20)
 #define SIZE_OFFSET	(4)
+// the data pages are listed by the room left at their end: list k > 0
+// holds the pages with 2^(k+SIZE_OFFSET-1) bytes left or more, but less
+// than twice that, list 0 the pages with no room for the smallest block
+#define ROOM_NUM	(SIZE_NUM + 1)
+// low bit of the header of an aligned block, free lists are word aligned
+#define ALIGNED_TAG	(1UL)
+// page items per page of the page map
+#define MAP_LEN		(PAGESIZE / sizeof(struct page_item*))
+// empty pages are given back once EMPTY_SWEEP of them pile up, all but
+// EMPTY_KEEP, so a page on the edge is not given back and taken again on
+// every other call, and the free lists are only walked now and then
+#define EMPTY_SWEEP	(32)
+#define EMPTY_KEEP	(2)
 
 
 // a fast helper to round up the size
@@ -90,10 +106,16 @@ inline void *get_page_end(void *addr) {
 // the entry point of the first page
 static kma_page_t *first_page = NULL;
 
+// the mode the next control unit is set up in, see kma_p2fl_set_headerless
+static int headerless = FALSE;
+
 // save the information of page
 struct page_item {
 	kma_page_t *page;
 	int start;
+	int idx;		// without headers, the list of all blocks on the page
+	int live;		// blocks of the page handed out, -1 while it is given back
+	unsigned long lists;	// bit i for free list i having carved blocks here
 	struct page_item *prev;
 	struct page_item *next;
 };
@@ -105,15 +127,22 @@ struct free_block {
 struct block_list {
 	int size;
 	struct free_block *next;
+	int carved;		// blocks carved for the list, handed out or not
 };
 
 struct p2fl_ctl {
+	kma_page_t *page;	// the page the unit is on
 	int total_alloc;
 	int total_free;
-	struct block_list free_list[SIZE_NUM];		// different size of free lists
+	struct block_list free_list[2 * SIZE_NUM];	// different size of free lists, then the KMA_TEMP ones
 	struct page_item unused_list;
-	struct page_item page_list;
+	struct page_item room_list[2][ROOM_NUM];	// data pages by room left, then those for KMA_TEMP
+	unsigned int room_mask[2];	// the room lists that are not empty
 	struct page_item ctl_page_list;
+	int heap;		// only kma_heap_destroy releases the pages
+	int headerless;	// blocks have no header, a page has blocks of one list
+	int empty;		// data pages with no block handed out
+	struct page_item **page_map[MAXPAGES / MAP_LEN];	// the item of every data page
 };
 
 // get the control unit of P2FL
@@ -122,6 +151,24 @@ struct p2fl_ctl *get_p2fl_ctl() {
 	return (struct p2fl_ctl*)(first_page->ptr);
 }
 
+// the page map entry of a pointer. the page pool is MAXPAGES pages in
+// a row, so their numbers modulo MAXPAGES all differ
+static inline int get_page_map_index(void *ptr) {
+	return (((unsigned long)ptr)>>PAGE_BIT_LEN)&(MAXPAGES-1);
+}
+
+// the page item of the data page a block is on
+static inline struct page_item *find_page_item(struct p2fl_ctl *ctl, void *ptr) {
+	int i = get_page_map_index(ptr);
+	return ctl->page_map[i / MAP_LEN][i % MAP_LEN];
+}
+
+// the bytes in front of a block, none without headers
+static int get_header_size() {
+	int on = first_page ? get_p2fl_ctl()->headerless : headerless;
+	return on ? 0 : sizeof(struct free_block);
+}
+
 /*
  * list operations helpers
  */
@@ -151,11 +198,11 @@ void list_remove(struct page_item *item) {
 	item->next->prev = item->prev;
 }
 
-extern struct page_item *get_unused_page_item();
+extern struct page_item *get_unused_page_item(struct p2fl_ctl *ctl);
+extern void release_pages(struct p2fl_ctl *ctl);
 
 // allocate new page for more list item
-void add_page_for_page_item() {
-	struct p2fl_ctl *ctl = get_p2fl_ctl();
+void add_page_for_page_item(struct p2fl_ctl *ctl) {
 	struct page_item *cur, *end;
 	kma_page_t *page;
 	assert(ctl);
@@ -165,24 +212,44 @@ void add_page_for_page_item() {
 	for(; cur + 1 < end; cur++) {
 		list_append(cur, &(ctl->unused_list));
 	}
-	cur = get_unused_page_item();
+	cur = get_unused_page_item(ctl);
 	cur->page = page;
 	list_append(cur, &(ctl->ctl_page_list));
 }
 
-// initialize the first page
-void init_first_page() {
+// put the item of a data page in the page map, which takes a page per
+// MAP_LEN entries when the first of them is used
+void set_page_item(struct p2fl_ctl *ctl, struct page_item *item) {
+	struct page_item *cur;
+	int i = get_page_map_index(item->page->ptr);
+	if(!ctl->page_map[i / MAP_LEN]) {
+		cur = get_unused_page_item(ctl);
+		cur->page = get_page();
+		memset(cur->page->ptr, 0, cur->page->size);
+		list_append(cur, &(ctl->ctl_page_list));
+		ctl->page_map[i / MAP_LEN] = (struct page_item**)(cur->page->ptr);
+	}
+	ctl->page_map[i / MAP_LEN][i % MAP_LEN] = item;
+}
+
+// set up a control unit on a new page, in the mode set for the next one
+struct p2fl_ctl *init_ctl() {
 	struct p2fl_ctl *ctl;
 	struct page_item *cur, *end;
+	kma_page_t *page = get_page();
 	int i;
-	first_page = get_page();
-	memset(first_page->ptr, 0, first_page->size);
-	ctl = (struct p2fl_ctl*)(first_page->ptr);
+	memset(page->ptr, 0, page->size);
+	ctl = (struct p2fl_ctl*)(page->ptr);
+	ctl->page = page;
 	ctl->total_alloc = 0;
 	ctl->total_free = 0;
+	ctl->headerless = headerless;
 
 	ctl->unused_list.prev = ctl->unused_list.next = &(ctl->unused_list);
-	ctl->page_list.prev = ctl->page_list.next = &(ctl->page_list);
+	for(i = 0; i < 2 * ROOM_NUM; i++) {
+		cur = &(ctl->room_list[i / ROOM_NUM][i % ROOM_NUM]);
+		cur->prev = cur->next = cur;
+	}
 	ctl->ctl_page_list.prev = ctl->ctl_page_list.next = &(ctl->ctl_page_list);
 	cur = (struct page_item*)((char*)ctl + sizeof(struct p2fl_ctl));
 	end = (struct page_item*)get_page_end((void*)cur);
@@ -192,27 +259,37 @@ void init_first_page() {
 	}
 
 	// initialize the free lists
-	for(i = 0; i < SIZE_NUM; i++) {
-		ctl->free_list[i].size = (1<< (i+SIZE_OFFSET));
+	for(i = 0; i < 2 * SIZE_NUM; i++) {
+		ctl->free_list[i].size = (1<< (i%SIZE_NUM+SIZE_OFFSET));
 		ctl->free_list[i].next = NULL;
 	}
+	return ctl;
+}
+
+// the default heap, which the first request sets up. NULL if the page
+// for it cannot be had
+static struct p2fl_ctl *get_default_ctl(int flags) {
+	if(!first_page) {
+		if((flags & KMA_NOWAIT) || !page_reserve(1))
+			return NULL;
+		first_page = init_ctl()->page;
+	}
+	return get_p2fl_ctl();
 }
 
 // get the unused list item
-struct page_item *get_unused_page_item() {
-	struct p2fl_ctl *ctl = get_p2fl_ctl();
+struct page_item *get_unused_page_item(struct p2fl_ctl *ctl) {
 	struct page_item *node;
 	assert(ctl);
 	if(ctl->unused_list.prev == &(ctl->unused_list))
-		add_page_for_page_item();
+		add_page_for_page_item(ctl);
 	node = ctl->unused_list.next;
 	list_remove(node);
 	return node;
 };
 
 // return the unused list item to the unused list item list
-void put_unused_page_item(struct page_item *node) {
-	struct p2fl_ctl *ctl = get_p2fl_ctl();
+void put_unused_page_item(struct p2fl_ctl *ctl, struct page_item *node) {
 	assert(node);
 	list_insert_head(node, &(ctl->unused_list));
 }
@@ -229,97 +306,492 @@ int get_list_index_by_size(int sz) {
 	return ret <= 0 ? 0 : ret;
 }
 
+// the room list of a page. without headers a page is listed by its
+// class while one more block of it fits
+inline int get_room_index(struct p2fl_ctl *ctl, struct page_item *item) {
+	int room = item->page->size - item->start;
+	if(ctl->headerless)
+		return room < ctl->free_list[item->idx].size ? 0 : item->idx % SIZE_NUM + 1;
+	return room < (1 << SIZE_OFFSET) ? 0 : 31 - __builtin_clz(room) - SIZE_OFFSET + 1;
+}
 
-void*
-kma_malloc(kma_size_t size)
-{
-	struct p2fl_ctl *ctl;
-	int sz, idx;
+// put a page on the room list for what is left of it
+void file_page(struct p2fl_ctl *ctl, struct page_item *item, int pool) {
+	int k = get_room_index(ctl, item);
+	list_append(item, &(ctl->room_list[pool][k]));
+	ctl->room_mask[pool] |= 1U << k;
+}
+
+// take a page off its room list, before start moves
+void unfile_page(struct p2fl_ctl *ctl, struct page_item *item, int pool) {
+	int k = get_room_index(ctl, item);
+	list_remove(item);
+	if(ctl->room_list[pool][k].next == &(ctl->room_list[pool][k]))
+		ctl->room_mask[pool] &= ~(1U << k);
+}
+
+// carve up to count blocks of sz bytes onto the free list, from a page
+// on the lowest room list that is sure to fit one, or from a new page.
+// without headers only the list of its own class will do.
+// returns whether the carved blocks have not been handed out before,
+// or -1 if a new page was needed and nowait is set. the KMA_TEMP lists
+// carve from pages of their own
+int carve_blocks(struct p2fl_ctl *ctl, int idx, int sz, int count, int nowait) {
 	struct page_item *item;
 	kma_page_t *page;
 	struct free_block *block;
-	int found = 0;
-	if(size + sizeof(void*) > PAGESIZE)
-		return NULL;
-	if(!first_page) {
-		init_first_page();
+	int pool = idx >= SIZE_NUM;
+	unsigned int mask;
+	if(ctl->headerless)
+		mask = ctl->room_mask[pool] & (1U << (idx % SIZE_NUM + 1));
+	else
+		mask = ctl->room_mask[pool] & (~0U << (idx % SIZE_NUM + 1));
+	if(mask) {
+		item = ctl->room_list[pool][__builtin_ctz(mask)].next;
+		unfile_page(ctl, item, pool);
+	} else {
+		// the page items and the page map can need a page too
+		if(nowait || !page_reserve(3))
+			return -1;
+		page = get_page();
+		item = get_unused_page_item(ctl);
+		item->page = page;
+		item->start = 0;
+		item->idx = idx;
+		item->lists = 0;
+		// empty until the caller takes a block
+		item->live = 0;
+		ctl->empty++;
+		set_page_item(ctl, item);
 	}
-	ctl = get_p2fl_ctl();
+	do {
+		block = (struct free_block*)((char*)item->page->ptr + item->start);
+		item->start += sz;
+		block->next = (void*)ctl->free_list[idx].next;
+		ctl->free_list[idx].next = block;
+		ctl->free_list[idx].carved++;
+	} while(--count > 0 && item->start + sz <= item->page->size);
+	item->lists |= 1UL << idx;
+	file_page(ctl, item, pool);
+	// the page beyond start has not been handed out yet
+	return item->page->zero;
+}
 
-	sz = roundup_pow2(size+sizeof(struct free_block));
+// give back the empty pages but keep of them. their blocks are still on
+// the free lists, so the lists are walked once to take them off first
+int release_empty_pages(struct p2fl_ctl *ctl, int keep) {
+	struct page_item *cur, *next, *pages;
+	struct free_block **link;
+	unsigned long lists = 0;
+	int n = ctl->empty - keep, i, k, count = 0;
+	if(n <= 0)
+		return 0;
+
+	for(i = 0; i < 2 * ROOM_NUM && n > 0; i++) {
+		pages = &(ctl->room_list[i / ROOM_NUM][i % ROOM_NUM]);
+		for(cur = pages->next; cur != pages && n > 0; cur = cur->next)
+			if(cur->live == 0) {
+				cur->live = -1;
+				lists |= cur->lists;
+				n--;
+			}
+	}
+	// only the lists that carved from the pages can have blocks on them
+	for(i = 0; i < 2 * SIZE_NUM; i++) {
+		if(!(lists & (1UL << i)))
+			continue;
+		link = &(ctl->free_list[i].next);
+		while(*link) {
+			if(find_page_item(ctl, *link)->live < 0) {
+				*link = (struct free_block*)((*link)->next);
+				ctl->free_list[i].carved--;
+			} else
+				link = (struct free_block**)&((*link)->next);
+		}
+	}
+	for(i = 0; i < 2 * ROOM_NUM; i++) {
+		pages = &(ctl->room_list[i / ROOM_NUM][i % ROOM_NUM]);
+		for(cur = pages->next; cur != pages; cur = next) {
+			next = cur->next;
+			if(cur->live >= 0)
+				continue;
+			list_remove(cur);
+			k = get_page_map_index(cur->page->ptr);
+			ctl->page_map[k / MAP_LEN][k % MAP_LEN] = NULL;
+			free_page(cur->page);
+			put_unused_page_item(ctl, cur);
+			ctl->empty--;
+			count++;
+		}
+		// the list may be empty now
+		if(pages->next == pages)
+			ctl->room_mask[i / ROOM_NUM] &= ~(1U << (i % ROOM_NUM));
+	}
+	return count;
+}
+
+// the block a request takes, a power of two of at least the smallest list
+int get_block_size(struct p2fl_ctl *ctl, kma_size_t size) {
+	if(!ctl->headerless)
+		return roundup_pow2(size+sizeof(struct free_block));
+	return size < (1 << SIZE_OFFSET) ? (1 << SIZE_OFFSET) : roundup_pow2(size);
+}
+
+// a request the page limit turned down may have been the one that set up
+// the default heap, which then holds nothing and is dropped again
+static void release_idle(struct p2fl_ctl *ctl) {
+	if(ctl->total_alloc == ctl->total_free && !ctl->heap)
+		release_pages(ctl);
+}
+
+// get a free block of size from the list, carve a new one if it is empty.
+// flags pick the KMA_TEMP lists and forbid new pages with KMA_NOWAIT
+void *get_block(struct p2fl_ctl *ctl, kma_size_t size, int flags, int *zero) {
+	int sz, idx;
+	struct free_block *block;
+	*zero = 0;
+
+	sz = get_block_size(ctl, size);
 	idx = get_list_index_by_size(sz);
+	if(flags & KMA_TEMP)
+		idx += SIZE_NUM;
 	// if there is no available free block, then allocate a new page
 	if(ctl->free_list[idx].next == NULL) {
-		item = ctl->page_list.next;
-		while(item != &(ctl->page_list)) {
-			if(item->start + sz < item->page->size) {
-				found = 1;
-				break;
-			}
-			item = item->next;
-		}
-		if(!found) {
-			page = get_page();
-			item = get_unused_page_item();
-			item->page = page;
-			item->start = 0;
-			list_append(item, &(ctl->page_list));
+		*zero = carve_blocks(ctl, idx, sz, 1, flags & KMA_NOWAIT);
+		if(*zero < 0) {
+			release_idle(ctl);
+			return NULL;
 		}
-		block = (struct free_block*)((char*)item->page->ptr + item->start);
-		item->start += sz;
-		block->next = (void*)ctl->free_list[idx].next;
-		ctl->free_list[idx].next = block;	
 	}
 	block = ctl->free_list[idx].next;
 	ctl->free_list[idx].next = block->next;
-	block->next = (void*)&(ctl->free_list[idx]);
-
 	ctl->total_alloc++;
+	if(find_page_item(ctl, block)->live++ == 0)
+		ctl->empty--;
+	// without a header the link was the only word written to the block
+	if(ctl->headerless) {
+		block->next = NULL;
+		return (void*)block;
+	}
+	block->next = (void*)&(ctl->free_list[idx]);
 	
 	// if have header, then return the actual address to user
 	return (void*)(block+1);
 }
 
-void
-kma_free(void* ptr, kma_size_t size)
+void*
+kma_malloc(kma_size_t size)
 {
-	struct p2fl_ctl *ctl = get_p2fl_ctl();
-	struct page_item *cur;
+	struct p2fl_ctl *ctl;
+	int zero;
+	if(size + get_header_size() > PAGESIZE || !(ctl = get_default_ctl(0)))
+		return NULL;
+	return get_block(ctl, size, 0, &zero);
+}
+
+void*
+kma_malloc_flags(kma_size_t size, int flags)
+{
+	struct p2fl_ctl *ctl;
+	void *ptr;
+	int zero;
+	if(size + get_header_size() > PAGESIZE || !(ctl = get_default_ctl(flags)))
+		return NULL;
+	ptr = get_block(ctl, size, flags, &zero);
+	if(ptr && (flags & KMA_ZERO) && !zero)
+		zero_block(ptr, size);
+	return ptr;
+}
+
+// put a block back on the list its header, or its page, points to. the
+// empty pages are given back once enough of them pile up. the last
+// block of the default heap takes all its pages with it
+void put_block(struct p2fl_ctl *ctl, void *ptr) {
+	struct page_item *item = find_page_item(ctl, ptr);
 	struct free_block *block;
 	struct block_list *list;
-	int count = 0;
-	kma_page_t *page_array[MAXPAGES];
-	assert(ctl);
 
 	block = (struct free_block*)ptr;
-	block -= 1;
-	list = (struct block_list*)(block->next);
+	if(ctl->headerless) {
+		list = &(ctl->free_list[item->idx]);
+	} else {
+		block -= 1;
+		list = (struct block_list*)(block->next);
+		// an aligned block tags its list and keeps its real start in front
+		if((unsigned long)list & ALIGNED_TAG) {
+			list = (struct block_list*)((unsigned long)list & ~ALIGNED_TAG);
+			block = *((struct free_block**)block - 1);
+		}
+	}
 
 	block->next = list->next;
 	list->next = block;
-
-	
+	if(--item->live == 0 && ++ctl->empty >= EMPTY_SWEEP)
+		release_empty_pages(ctl, EMPTY_KEEP);
 	ctl->total_free++;
 
-	// free all the pages after all the requests have been done
-	if(ctl->total_alloc == ctl->total_free) {
-		cur = ctl->page_list.next;
-		while(cur != &(ctl->page_list)) {
-			assert(cur->page->ptr);
-			page_array[count++] = cur->page;
-			cur = cur->next;
-		}
-		cur = ctl->ctl_page_list.next;
-		while(cur != &(ctl->ctl_page_list)) {
+	if(ctl->total_alloc == ctl->total_free && !ctl->heap)
+		release_pages(ctl);
+}
+
+// free all the pages of a control unit, the unit too
+void release_pages(struct p2fl_ctl *ctl) {
+	struct page_item *cur, *pages;
+	int count = 0, i;
+	kma_page_t *page_array[MAXPAGES];
+
+	for(i = 0; i < 2 * ROOM_NUM; i++) {
+		pages = &(ctl->room_list[i / ROOM_NUM][i % ROOM_NUM]);
+		for(cur = pages->next; cur != pages; cur = cur->next) {
 			assert(cur->page->ptr);
 			page_array[count++] = cur->page;
-			cur = cur->next;
 		}
-		for(count = count - 1; count >= 0; count--)
-			free_page(page_array[count]);
-		free_page(first_page);
+	}
+	cur = ctl->ctl_page_list.next;
+	while(cur != &(ctl->ctl_page_list)) {
+		assert(cur->page->ptr);
+		page_array[count++] = cur->page;
+		cur = cur->next;
+	}
+	for(count = count - 1; count >= 0; count--)
+		free_page(page_array[count]);
+	if(ctl->page == first_page)
 		first_page = NULL;
+	free_page(ctl->page);
+}
+
+// give back the pages with no block handed out, their carved blocks
+// are all on the free lists
+int
+kma_reclaim()
+{
+	if(!first_page || get_p2fl_ctl()->empty == 0)
+		return -1;
+	return release_empty_pages(get_p2fl_ctl(), 0);
+}
+
+// the carved blocks of a list that are not on it are handed out. the
+// rest of a page beyond start is free too
+void
+kma_get_stats(kma_stats_t* stats)
+{
+	struct p2fl_ctl *ctl;
+	struct page_item *cur, *pages;
+	struct free_block *block;
+	kma_class_stat_t *cls;
+	int i, n;
+	memset(stats, 0, sizeof(kma_stats_t));
+	if(!first_page)
+		return;
+	ctl = get_p2fl_ctl();
+
+	stats->meta_pages = 1;
+	for(cur = ctl->ctl_page_list.next; cur != &(ctl->ctl_page_list); cur = cur->next)
+		stats->meta_pages++;
+	for(i = 0; i < 2 * ROOM_NUM; i++) {
+		pages = &(ctl->room_list[i / ROOM_NUM][i % ROOM_NUM]);
+		for(cur = pages->next; cur != pages; cur = cur->next) {
+			stats->data_pages++;
+			stats->free_bytes += cur->page->size - cur->start;
+		}
 	}
+	// the KMA_TEMP lists add to the class of the same size
+	stats->num_classes = get_list_index_by_size(PAGESIZE) + 1;
+	for(i = 0; i < 2 * SIZE_NUM; i++) {
+		n = 0;
+		for(block = ctl->free_list[i].next; block; block = (struct free_block*)block->next)
+			n++;
+		cls = &(stats->classes[i % SIZE_NUM]);
+		cls->size = ctl->free_list[i].size;
+		cls->free += n;
+		cls->used += ctl->free_list[i].carved - n;
+		stats->used_bytes += (long long)(ctl->free_list[i].carved - n) * cls->size;
+		stats->free_bytes += (long long)n * cls->size;
+	}
+}
+
+void
+kma_free(void* ptr, kma_size_t size)
+{
+	put_block(get_p2fl_ctl(), ptr);
+}
+
+void*
+kma_realloc(void* ptr, kma_size_t size, kma_size_t new_size)
+{
+	void *new_ptr;
+	if(!ptr)
+		return kma_malloc(new_size);
+	if(new_size + get_header_size() > PAGESIZE)
+		return NULL;
+	if(size == KMA_UNSIZED)
+		size = kma_usable_size(ptr);
+
+	// the free list, which knows the block size, may have room already
+	if(new_size <= kma_usable_size(ptr))
+		return ptr;
+
+	new_ptr = kma_malloc(new_size);
+	if(new_ptr) {
+		memcpy(new_ptr, ptr, size < new_size ? size : new_size);
+		kma_free(ptr, size);
+	}
+	return new_ptr;
+}
+
+void*
+kma_calloc(kma_size_t nmemb, kma_size_t size)
+{
+	long long total = (long long)nmemb * size;
+	struct p2fl_ctl *ctl;
+	void *ptr;
+	int zero;
+	if(total + get_header_size() > PAGESIZE || !(ctl = get_default_ctl(0)))
+		return NULL;
+	// only the header of a newly carved block has been written
+	ptr = get_block(ctl, total, 0, &zero);
+	if(ptr && !zero)
+		zero_block(ptr, total);
+	return ptr;
+}
+
+void*
+kma_malloc_aligned(kma_size_t size, kma_size_t align)
+{
+	struct p2fl_ctl *ctl;
+	struct free_block *block;
+	void **ptr;
+	unsigned long mask = (unsigned long)align - 1;
+	int zero;
+	if(align == 0 || (align & mask))
+		return NULL;
+	// without headers a block is aligned to its size, which the page
+	// starts and the blocks of the page are carved at
+	if(get_header_size() == 0)
+		return align > PAGESIZE ? NULL : kma_malloc(size > align ? size : align);
+	if(size + align + sizeof(void*) > PAGESIZE)
+		return NULL;
+	if(align <= sizeof(struct free_block))
+		return kma_malloc(size);
+	// room to move the start up to the alignment
+	if(!(ctl = get_default_ctl(0)) || !(ptr = (void**)get_block(ctl, size + align, 0, &zero)))
+		return NULL;
+	block = (struct free_block*)ptr - 1;
+	if(!(((unsigned long)(block + 1)) & mask))
+		return (void*)(block + 1);
+	// the moved start is at least two words in, for the tagged list
+	// pointer kma_free reads and the real start of the block
+	ptr = (void**)(((unsigned long)(block + 1) + mask) & ~mask);
+	ptr[-1] = (void*)((unsigned long)block->next | ALIGNED_TAG);
+	ptr[-2] = (void*)block;
+	return (void*)ptr;
+}
+
+kma_size_t
+kma_usable_size(void* ptr)
+{
+	struct p2fl_ctl *ctl = get_p2fl_ctl();
+	struct free_block *block = (struct free_block*)ptr - 1;
+	struct block_list *list;
+	if(ctl->headerless)
+		return ctl->free_list[find_page_item(ctl, ptr)->idx].size;
+	list = (struct block_list*)(block->next);
+	// the block runs from its real start to the size of its free list
+	if((unsigned long)list & ALIGNED_TAG) {
+		list = (struct block_list*)((unsigned long)list & ~ALIGNED_TAG);
+		block = *((struct free_block**)block - 1);
+	}
+	return (char*)block + list->size - (char*)ptr;
+}
+
+int
+kma_malloc_batch(kma_size_t size, int n, void* ptrs[])
+{
+	struct p2fl_ctl *ctl;
+	struct block_list *list;
+	struct free_block *block;
+	int sz, idx, i;
+	if(size + get_header_size() > PAGESIZE || !(ctl = get_default_ctl(0)))
+		return 0;
+
+	// one list for the whole batch, and an empty list is refilled with
+	// as many blocks as the batch still needs
+	sz = get_block_size(ctl, size);
+	idx = get_list_index_by_size(sz);
+	list = &(ctl->free_list[idx]);
+	for(i = 0; i < n; i++) {
+		if(list->next == NULL && carve_blocks(ctl, idx, sz, n - i, 0) < 0)
+			break;
+		block = list->next;
+		list->next = block->next;
+		if(find_page_item(ctl, block)->live++ == 0)
+			ctl->empty--;
+		if(ctl->headerless) {
+			block->next = NULL;
+			ptrs[i] = (void*)block;
+			continue;
+		}
+		block->next = (void*)list;
+		ptrs[i] = (void*)(block+1);
+	}
+	ctl->total_alloc += i;
+	if(i == 0)
+		release_idle(ctl);
+	return i;
+}
+
+void
+kma_free_batch(void* ptrs[], int n)
+{
+	struct p2fl_ctl *ctl = get_p2fl_ctl();
+	int i;
+
+	// the headers or the page class map know the lists, so no sorting.
+	// only the last block can release the unit
+	for(i = 0; i < n; i++)
+		put_block(ctl, ptrs[i]);
+}
+
+// a heap keeps its own lists and pages, in the headerless mode set
+// when it is made. its handle is the control unit
+kma_heap_t*
+kma_heap_create()
+{
+	struct p2fl_ctl *ctl;
+	if(!page_reserve(1))
+		return NULL;
+	ctl = init_ctl();
+	ctl->heap = 1;
+	return (kma_heap_t*)ctl;
+}
+
+void
+kma_heap_destroy(kma_heap_t *heap)
+{
+	release_pages((struct p2fl_ctl*)heap);
+}
+
+void*
+kma_heap_malloc(kma_heap_t *heap, kma_size_t size)
+{
+	struct p2fl_ctl *ctl = (struct p2fl_ctl*)heap;
+	int zero;
+	if(size + (ctl->headerless ? 0 : sizeof(struct free_block)) > PAGESIZE)
+		return NULL;
+	return get_block(ctl, size, 0, &zero);
+}
+
+void
+kma_heap_free(kma_heap_t *heap, void* ptr, kma_size_t size)
+{
+	put_block((struct p2fl_ctl*)heap, ptr);
+}
+
+int
+kma_p2fl_set_headerless(int on)
+{
+	headerless = on ? TRUE : FALSE;
+	return TRUE;
 }
 
 #endif // KMA_P2FL
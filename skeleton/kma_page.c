@@ -45,10 +45,15 @@
 #include <string.h>
 #include <strings.h>
 #include <stdio.h>
+#include <sys/mman.h>
+#if defined(__SSE2__) && defined(STREAM_ZERO)
+#include <emmintrin.h>
+#endif
 
 /************Private include**********************************************/
 #include "kma_page.h"
 #include "kma.h"
+#include "kma_bench.h"
 
 /************Defines and Typedefs*****************************************/
 /*  #defines and typedefs should have their names in all caps.
@@ -57,15 +62,39 @@
  *  structures and arrays, line everything up in neat columns.
  */
 
+// With -DSTREAM_ZERO, blocks at least this large are cleared with
+// non-temporal stores. That only pays off when the block is cold: a
+// recycled block that is still in the cache clears much faster with
+// memset, so it is off by default.
+#define STREAM_MIN (PAGESIZE / 2)
+
 /************Global Variables*********************************************/
-static kma_page_stat_t kma_page_stats = { 0, 0, 0, PAGESIZE };
+static kma_page_stat_t kma_page_stats = { 0, 0, 0, PAGESIZE, MAXPAGES };
 
+static void* mapping = NULL;
 static void* pool = NULL;
 static void* next_free_page = NULL;
+// pages from here on have never been handed out
+static int pool_top = 0;
+
+// the returned pages are on a doubly linked list, kept in the pages, and
+// have their bit set here, so that a run of them is found and taken off
+// the list again
+#define WORD_BITS (8 * sizeof(unsigned long))
+static unsigned long free_bits[MAXPAGES / WORD_BITS];
+
+typedef struct
+{
+  void* next;
+  void* prev;
+} free_link_t;
 
 /************Function Prototypes******************************************/
-void* allocPage();
+void* allocPage(int*);
+void* allocRun(int, int*);
 void freePage(void*);
+void pushPage(void*);
+void unlinkPage(void*);
 void initPages();
 
 /************External Declaration*****************************************/
@@ -84,24 +113,50 @@ get_page()
   res = (kma_page_t*) malloc(sizeof(kma_page_t));
   res->id = id++;
   res->size = kma_page_stats.page_size;
-  res->ptr = allocPage();
+  res->ptr = allocPage(&res->zero);
   
   assert(res->ptr != NULL);
   
   return res;	
 }
 
+kma_page_t*
+get_pages(int n)
+{
+  static int id = 0;
+  kma_page_t* res;
+  
+  assert(n > 0 && n <= MAXRUN && (n & (n - 1)) == 0);
+  
+  kma_page_stats.num_requested += n;
+  kma_page_stats.num_in_use += n;
+  
+  res = (kma_page_t*) malloc(sizeof(kma_page_t));
+  res->id = id++;
+  res->size = n * kma_page_stats.page_size;
+  res->ptr = allocRun(n, &res->zero);
+  
+  assert(res->ptr != NULL);
+  
+  return res;
+}
+
 void
 free_page(kma_page_t* ptr)
 {
+  int i;
+  
   assert(ptr != NULL);
   assert(ptr->ptr != NULL);
-  assert(kma_page_stats.num_in_use > 0);
+  assert(kma_page_stats.num_in_use >= ptr->size / PAGESIZE);
   
-  kma_page_stats.num_freed++;
-  kma_page_stats.num_in_use--;
-  
-  freePage(ptr->ptr);
+  // a run goes back page by page, the pool is dropped after the last
+  for (i = 0; i < ptr->size / PAGESIZE; i++)
+    {
+      kma_page_stats.num_freed++;
+      kma_page_stats.num_in_use--;
+      freePage((char*) ptr->ptr + i * PAGESIZE);
+    }
   free(ptr);
 }
 
@@ -113,8 +168,63 @@ page_stats()
   return memcpy(&stats, &kma_page_stats, sizeof(kma_page_stat_t));
 }
 
+void
+kma_set_limit(int pages)
+{
+  kma_page_stats.limit = pages > 0 && pages < MAXPAGES ? pages : MAXPAGES;
+}
+
+int
+page_reserve(int n)
+{
+  long long start;
+  int n_reclaimed;
+  
+  if (kma_page_stats.num_in_use + n <= kma_page_stats.limit)
+    return TRUE;
+  
+  // give the allocator a chance to return what it only caches, an
+  // allocator with nothing cached says so and is not counted
+  start = bench_now_ns();
+  n_reclaimed = kma_reclaim();
+  if (n_reclaimed >= 0)
+    {
+      kma_page_stats.num_reclaimed += n_reclaimed;
+      kma_page_stats.reclaim_ns += bench_now_ns() - start;
+      kma_page_stats.num_reclaims++;
+    }
+  
+  return kma_page_stats.num_in_use + n <= kma_page_stats.limit;
+}
+
+void
+zero_block(void* ptr, int size)
+{
+#if defined(__SSE2__) && defined(STREAM_ZERO)
+  if (size >= STREAM_MIN)
+    {
+      char* cur = (char*) (((unsigned long) ptr + 15) & ~15UL);
+      char* end = (char*) ptr + size;
+      __m128i zero = _mm_setzero_si128();
+      
+      memset(ptr, 0, cur - (char*) ptr);
+      for (; cur + 64 <= end; cur += 64)
+	{
+	  _mm_stream_si128((__m128i*) cur, zero);
+	  _mm_stream_si128((__m128i*) (cur + 16), zero);
+	  _mm_stream_si128((__m128i*) (cur + 32), zero);
+	  _mm_stream_si128((__m128i*) (cur + 48), zero);
+	}
+      _mm_sfence();
+      memset(cur, 0, end - cur);
+      return;
+    }
+#endif
+  memset(ptr, 0, size);
+}
+
 void*
-allocPage()
+allocPage(int* zero)
 {
   void* res;
   
@@ -123,58 +233,149 @@ allocPage()
       initPages();
     }
   
+  // reuse a returned page first, so fresh ones stay untouched
   res = next_free_page;
   
-  if (res == NULL)
+  if (res != NULL)
+    {
+      unlinkPage(res);
+      *zero = 0;
+      return res;
+    }
+  
+  if (pool_top == MAXPAGES)
     {
       error("error: all pages already allocated", "");
     }
   
-  next_free_page = *((void**)next_free_page);
+  res = pool + pool_top * PAGESIZE;
+  pool_top++;
+  *zero = 1;
+  
+  return res;
+}
+
+void*
+allocRun(int n, int* zero)
+{
+  unsigned long mask = n == WORD_BITS ? ~0UL : (1UL << n) - 1;
+  void* res;
+  int i, k;
+  
+  if (pool == NULL)
+    {
+      initPages();
+    }
+  
+  // a run of returned pages first. runs start at a multiple of n, so
+  // the bits of one never span two words
+  for (i = 0; i + n <= pool_top; i += n)
+    {
+      if (((free_bits[i / WORD_BITS] >> (i % WORD_BITS)) & mask) == mask)
+	{
+	  res = pool + i * PAGESIZE;
+	  for (k = 0; k < n; k++)
+	    {
+	      unlinkPage((char*) res + k * PAGESIZE);
+	    }
+	  *zero = 0;
+	  return res;
+	}
+    }
+  
+  // the fresh pages passed over to get to a multiple of n can still go
+  // out one by one
+  while (pool_top % n && pool_top < MAXPAGES)
+    {
+      pushPage(pool + pool_top * PAGESIZE);
+      pool_top++;
+    }
+  
+  if (pool_top + n > MAXPAGES)
+    {
+      error("error: all pages already allocated", "");
+    }
   
-  assert(res != NULL);
+  res = pool + pool_top * PAGESIZE;
+  pool_top += n;
+  *zero = 1;
   
   return res;
 }
 
+void
+pushPage(void* ptr)
+{
+  free_link_t* link = (free_link_t*) ptr;
+  int i = ((char*) ptr - (char*) pool) / PAGESIZE;
+  
+  link->next = next_free_page;
+  link->prev = NULL;
+  if (next_free_page != NULL)
+    {
+      ((free_link_t*) next_free_page)->prev = ptr;
+    }
+  next_free_page = ptr;
+  free_bits[i / WORD_BITS] |= 1UL << (i % WORD_BITS);
+}
+
+void
+unlinkPage(void* ptr)
+{
+  free_link_t* link = (free_link_t*) ptr;
+  int i = ((char*) ptr - (char*) pool) / PAGESIZE;
+  
+  if (link->prev != NULL)
+    {
+      ((free_link_t*) link->prev)->next = link->next;
+    }
+  else
+    {
+      next_free_page = link->next;
+    }
+  if (link->next != NULL)
+    {
+      ((free_link_t*) link->next)->prev = link->prev;
+    }
+  free_bits[i / WORD_BITS] &= ~(1UL << (i % WORD_BITS));
+}
+
 void
 freePage(void* ptr)
 {
   assert(ptr != NULL);
   
-  *((void**)ptr) = next_free_page;
-  next_free_page = ptr;
+  pushPage(ptr);
   
   if (kma_page_stats.num_in_use == 0)
     {
-      free(pool);
+      munmap(mapping, (MAXPAGES + MAXRUN) * PAGESIZE);
+      mapping = NULL;
       pool = NULL;
       next_free_page = NULL;
+      pool_top = 0;
+      memset(free_bits, 0, sizeof(free_bits));
     }
 }
 
 void
 initPages()
 {
-  int i;
-  
   assert(next_free_page == NULL);
   assert(pool == NULL);
   
-  //pool = calloc(MAXPAGES, PAGESIZE);
-  int result = posix_memalign(&pool, PAGESIZE, MAXPAGES * PAGESIZE);
-  if(result)
-    error("Error using posix_memalign to allocate memory", "");
-  next_free_page = pool;
-  
-  // use ptr to point to the next free page struct
-  for (i = 0; i < (MAXPAGES - 1); i++)
-    {
-      void* ptr = (pool + i * PAGESIZE);
-      void* next = ptr + PAGESIZE;
-      
-      *((void**) ptr) = next;
-    }
+  // anonymous memory reads as zero until it is written, and only the
+  // pages that are handed out get faulted in. Map MAXRUN pages extra to
+  // align the pool to the longest run, so a run of n pages is aligned
+  // to n * PAGESIZE.
+  mapping = mmap(NULL, (MAXPAGES + MAXRUN) * PAGESIZE, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapping == MAP_FAILED)
+    error("Error using mmap to allocate memory", "");
+  pool = (void*) (((unsigned long) mapping + MAXRUN * PAGESIZE - 1) & ~(MAXRUN * PAGESIZE - 1UL));
   
-  *((void**)(pool + (MAXPAGES - 1) * PAGESIZE)) = NULL;
+  // pages are carved from the top of the pool, the free list only
+  // holds pages that came back
+  next_free_page = NULL;
+  pool_top = 0;
 }
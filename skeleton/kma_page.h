@@ -66,6 +66,9 @@
 
 #define MAXPAGES 4096
 
+// the longest run of pages get_pages() hands out
+#define MAXRUN 8
+
 /***********************************************************************
  *  Title: Base Address Macro
  * ---------------------------------------------------------------------
@@ -81,6 +84,7 @@ typedef struct
   int id;
   void* ptr;
   int size;
+  int zero; // never handed out before, so all bytes are still zero
 } kma_page_t;
 
 typedef struct
@@ -89,6 +93,10 @@ typedef struct
   int num_freed;
   int num_in_use;
   int page_size;
+  int limit; // the page budget, MAXPAGES unless kma_set_limit lowered it
+  int num_reclaims; // kma_reclaim calls that found something cached
+  int num_reclaimed; // pages those calls gave back
+  long long reclaim_ns; // time they took
 } kma_page_stat_t;
 
 /************Global Variables*********************************************/
@@ -104,6 +112,18 @@ typedef struct
  ***********************************************************************/
 EXTERN kma_page_t* get_page();
 
+/***********************************************************************
+ *  Title: Allocates a run of memory pages
+ * ---------------------------------------------------------------------
+ *    Purpose: Allocates n pages next to each other, n a power of two
+ *             up to MAXRUN. The run starts at a multiple of n pages
+ *             from the start of the pool, and free_page() releases
+ *             all of it
+ *    Input: the number of pages
+ *    Output: the run, its size is n * PAGESIZE
+ ***********************************************************************/
+EXTERN kma_page_t* get_pages(int n);
+
 /***********************************************************************
  *  Title: Releases a memory page 
  * ---------------------------------------------------------------------
@@ -122,6 +142,37 @@ EXTERN void free_page(kma_page_t*);
  ***********************************************************************/
 EXTERN kma_page_stat_t* page_stats();
 
+/***********************************************************************
+ *  Title: Limits the pages in use
+ * ---------------------------------------------------------------------
+ *    Purpose: Sets the page budget page_reserve() checks against
+ *    Input: the number of pages, 0 for all MAXPAGES
+ *    Output: none
+ ***********************************************************************/
+EXTERN void kma_set_limit(int);
+
+/***********************************************************************
+ *  Title: Reserves memory pages
+ * ---------------------------------------------------------------------
+ *    Purpose: Checks that n more pages fit the page budget, before an
+ *             allocator takes them. If they do not, kma_reclaim() is
+ *             run first to give cached pages back
+ *    Input: the number of pages
+ *    Output: TRUE if the pages can be taken
+ ***********************************************************************/
+EXTERN int page_reserve(int);
+
+/***********************************************************************
+ *  Title: Zeroes a memory block
+ * ---------------------------------------------------------------------
+ *    Purpose: Clears a block of memory. Built with STREAM_ZERO, it
+ *             uses non-temporal stores for large blocks so they do not
+ *             push everything else out of the cache
+ *    Input: the pointer to the block, the size of the block
+ *    Output: none
+ ***********************************************************************/
+EXTERN void zero_block(void*, int);
+
 /************External Declaration*****************************************/
 
 /**************Definition***************************************************/
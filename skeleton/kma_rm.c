@@ -33,16 +33,22 @@
  ***************************************************************************/
 #ifdef KMA_RM
 #define __KMA_IMPL__
+#define __KMA_RM_IMPL__
 
 /************System include***********************************************/
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stddef.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 /************Private include**********************************************/
 #include "kma_page.h"
 #include "kma.h"
+#include "kma_rm.h"
 
 /************Defines and Typedefs*****************************************/
 /*  #defines and typedefs should have their names in all caps.
@@ -73,28 +79,114 @@ inline void *get_page_end(void *addr) {
 
 kma_page_t *first_page = NULL;
 
+// the free map and the policy the next control page is set up with
+static int map_kind = RM_MAP_TREE;
+static int fit_kind = RM_FIT_FIRST;
+static int region_pages = 4;
+
+// blocks are handed out in whole units, so they stay word aligned and
+// one end bit per unit is enough to find the size of a block
+#define UNIT		(8)
+#define ENDS_LEN	(PAGESIZE / (UNIT * 8 * sizeof(unsigned long)))
+
+// round a request up to whole units, a zero request still takes one
+inline int round_unit(int size) {
+	return size ? (size + UNIT - 1) & ~(UNIT - 1) : UNIT;
+}
+
+// the record of a region we allocate from, kept off the region so that
+// all of it but one word can be handed out. a region is a run of pages
+// that the free ranges span as one address range
+struct page_rec {
+	kma_page_t *page;				// NULL once kma_reclaim gave the region back
+	struct free_map *map;			// the free map the region's ranges go to
+	struct page_rec *next_free;		// records kma_reclaim freed, for reuse
+	unsigned long ends[];			// set for the last unit of every allocated block,
+									// ENDS_LEN words per page of the region
+};
+
 // wrap the page information structure
 struct page_info {
-	kma_page_t *page;
+	union {
+		kma_page_t *page;		// pages holding control data
+		struct page_rec *rec;	// pages we allocate from
+	};
 //	int ref_count;
 };
 
 // list item in resource map's free list
-// will be order by address
+// will be order by address. the tree links come last, a unit without
+// trees carves its items short of them
 struct free_node {
 	void *addr;
 	int size;
+	int zero;		// the range has never been written
 	struct free_node *prev;
 	struct free_node *next;
+	struct free_node *left;		// the tree by address, RM_MAP_TREE only
+	struct free_node *right;
+	int max;					// the largest size in the subtree
+	struct free_node *sleft;	// the tree by size, for best fit
+	struct free_node *sright;
+};
+
+// a page of the packed extent array: the ranges of a stretch of the free
+// list, in address order, with their sizes side by side so that a first
+// fit scan compares four of them at a time
+#define CHUNK_LEN	(((PAGESIZE - 16) / (sizeof(int) + 2 * sizeof(void*))) & ~3)
+
+struct extent_chunk {
+	int count;
+	int pad;
+	int sizes[CHUNK_LEN];
+	void *addrs[CHUNK_LEN];
+	struct free_node *nodes[CHUNK_LEN];
+};
+
+// the chunks of the array in address order, on a page of its own
+#define DIR_LEN		((PAGESIZE - 24) / sizeof(void*))
+
+struct extent_dir {
+	int count;
+	struct extent_chunk *spare;		// chunks that emptied, for reuse
+	struct extent_chunk *chunks[DIR_LEN];
+};
+
+// the free ranges of a pool. the list is always there, the trees are
+// only kept for RM_MAP_TREE, the one by size only for RM_FIT_BEST and
+// RM_FIT_ADAPTIVE too, the extent array only for RM_MAP_ARRAY
+struct free_map {
+	struct rm_ctl *ctl;			// the control unit the map is in
+	struct free_node list;
+	struct free_node *by_addr;
+	struct free_node *by_size;
+	struct extent_dir *dir;
+	struct free_node *rover;	// where the next fit search starts
+	int count;					// ranges in the map
+	long free_bytes;			// and their bytes
+	int empty;					// ranges that fill a whole region
+	int avg_request;			// moving average of the requests
+	int kind;
+	int fit;
 };
 
 // control meta data for resource map allocator
 struct rm_ctl {
+	kma_page_t *page;				// the page the unit is on
 	int total_alloc;
 	int total_free;
-	struct free_node free_list;
+	struct free_map free_map;
+	struct free_map temp_map;		// ranges of the pages for KMA_TEMP
 	struct free_node unused_list;
 	struct free_node page_list;
+	struct free_node rec_list;		// pages holding page records
+	struct page_rec *rec_next;		// unused page records
+	struct page_rec *rec_end;
+	struct page_rec *rec_free;		// records of pages kma_reclaim gave back
+	int region;						// pages per region
+	int rec_size;					// bytes per page record, with its end bits
+	int node_size;					// bytes per list item, with the tree links or not
+	int heap;						// only kma_heap_destroy releases the pages
 };
 
 // a helper to get resource map's control unit
@@ -103,6 +195,16 @@ struct rm_ctl *get_rm_ctl() {
 	return (struct rm_ctl*)((char*)first_page->ptr + sizeof(struct page_info));
 }
 
+// regions are aligned to their size, so the start of the one an address
+// is in is a mask away
+inline void *get_region_start(struct rm_ctl *ctl, void *addr) {
+	return (void*)((unsigned long)addr & ~((unsigned long)ctl->region * PAGESIZE - 1));
+}
+
+inline void *get_region_end(struct rm_ctl *ctl, void *addr) {
+	return (void*)((char*)get_region_start(ctl, addr) + ctl->region * PAGESIZE);
+}
+
 /*
  * a lot of list operation functions
  */
@@ -132,205 +234,1273 @@ void list_remove(struct free_node *item) {
 	item->next->prev = item->prev;
 }
 
-extern struct free_node *get_unused_free_node();
+/*
+ * the trees of the free map are treaps. the priority of a node is a hash
+ * of where the node is, which stays put while the range it holds moves
+ */
+static inline unsigned long node_prio(struct free_node *node) {
+	return (unsigned long)node * 0x9E3779B97F4A7C15UL;
+}
+
+static inline void fix_max(struct free_node *t) {
+	t->max = t->size;
+	if(t->left && t->left->max > t->max)
+		t->max = t->left->max;
+	if(t->right && t->right->max > t->max)
+		t->max = t->right->max;
+}
+
+// split the tree into the ranges below addr and the rest
+static void addr_split(struct free_node *t, void *addr, struct free_node **l, struct free_node **r) {
+	if(!t) {
+		*l = *r = NULL;
+		return;
+	}
+	if(t->addr < addr) {
+		addr_split(t->right, addr, &(t->right), r);
+		*l = t;
+	} else {
+		addr_split(t->left, addr, l, &(t->left));
+		*r = t;
+	}
+	fix_max(t);
+}
+
+static struct free_node *addr_merge(struct free_node *l, struct free_node *r) {
+	if(!l)
+		return r;
+	if(!r)
+		return l;
+	if(node_prio(l) > node_prio(r)) {
+		l->right = addr_merge(l->right, r);
+		fix_max(l);
+		return l;
+	}
+	r->left = addr_merge(l, r->left);
+	fix_max(r);
+	return r;
+}
+
+static struct free_node *addr_insert(struct free_node *t, struct free_node *node) {
+	if(!t || node_prio(node) > node_prio(t)) {
+		addr_split(t, node->addr, &(node->left), &(node->right));
+		fix_max(node);
+		return node;
+	}
+	if(node->addr < t->addr)
+		t->left = addr_insert(t->left, node);
+	else
+		t->right = addr_insert(t->right, node);
+	fix_max(t);
+	return t;
+}
+
+static struct free_node *addr_remove(struct free_node *t, struct free_node *node) {
+	if(t == node)
+		return addr_merge(t->left, t->right);
+	if(node->addr < t->addr)
+		t->left = addr_remove(t->left, node);
+	else
+		t->right = addr_remove(t->right, node);
+	fix_max(t);
+	return t;
+}
+
+// fix the sizes on the way down to a node whose range was cut or grown.
+// a range never moves past its neighbours, so it is found by address
+static void addr_update(struct free_node *t, struct free_node *node) {
+	if(t != node)
+		addr_update(node->addr < t->addr ? t->left : t->right, node);
+	fix_max(t);
+}
+
+// the last range at or below addr
+static struct free_node *addr_floor(struct free_node *t, void *addr) {
+	struct free_node *found = NULL;
+	while(t) {
+		if(t->addr <= addr) {
+			found = t;
+			t = t->right;
+		} else
+			t = t->left;
+	}
+	return found;
+}
+
+// the lowest range at or above addr with room for size
+static struct free_node *addr_fit(struct free_node *t, void *addr, int size) {
+	struct free_node *found;
+	if(!t || t->max < size)
+		return NULL;
+	if(t->addr < addr)
+		return addr_fit(t->right, addr, size);
+	if((found = addr_fit(t->left, addr, size)))
+		return found;
+	if(t->size >= size)
+		return t;
+	return addr_fit(t->right, addr, size);
+}
+
+// the tree by size breaks ties by address
+static inline int size_less(struct free_node *a, struct free_node *b) {
+	return a->size < b->size || (a->size == b->size && a->addr < b->addr);
+}
+
+static void size_split(struct free_node *t, struct free_node *node, struct free_node **l, struct free_node **r) {
+	if(!t) {
+		*l = *r = NULL;
+		return;
+	}
+	if(size_less(t, node)) {
+		size_split(t->sright, node, &(t->sright), r);
+		*l = t;
+	} else {
+		size_split(t->sleft, node, l, &(t->sleft));
+		*r = t;
+	}
+}
+
+static struct free_node *size_merge(struct free_node *l, struct free_node *r) {
+	if(!l)
+		return r;
+	if(!r)
+		return l;
+	if(node_prio(l) > node_prio(r)) {
+		l->sright = size_merge(l->sright, r);
+		return l;
+	}
+	r->sleft = size_merge(l, r->sleft);
+	return r;
+}
+
+static struct free_node *size_insert(struct free_node *t, struct free_node *node) {
+	if(!t || node_prio(node) > node_prio(t)) {
+		size_split(t, node, &(node->sleft), &(node->sright));
+		return node;
+	}
+	if(size_less(node, t))
+		t->sleft = size_insert(t->sleft, node);
+	else
+		t->sright = size_insert(t->sright, node);
+	return t;
+}
+
+static struct free_node *size_remove(struct free_node *t, struct free_node *node) {
+	if(t == node)
+		return size_merge(t->sleft, t->sright);
+	if(size_less(node, t))
+		t->sleft = size_remove(t->sleft, node);
+	else
+		t->sright = size_remove(t->sright, node);
+	return t;
+}
+
+// the smallest range with room for size, the lowest of equal ones
+static struct free_node *size_fit(struct free_node *t, int size) {
+	struct free_node *found = NULL;
+	while(t) {
+		if(t->size >= size) {
+			found = t;
+			t = t->sleft;
+		} else
+			t = t->sright;
+	}
+	return found;
+}
+
+extern struct free_node *get_unused_free_node(struct rm_ctl*);
+extern void put_unused_free_node(struct rm_ctl*, struct free_node*);
+extern void *get_control_page(struct rm_ctl*);
+extern void release_pages(struct rm_ctl*);
+
+/*
+ * the packed extent array. a position is a chunk and an index in it
+ */
+static struct extent_chunk *get_chunk(struct rm_ctl *ctl, struct extent_dir *dir) {
+	struct extent_chunk *chunk = dir->spare;
+	if(chunk)
+		dir->spare = *(struct extent_chunk**)chunk;
+	else
+		chunk = (struct extent_chunk*)get_control_page(ctl);
+	chunk->count = 0;
+	return chunk;
+}
+
+// the last range at or below addr, FALSE if there is none
+static int ext_floor(struct extent_dir *dir, void *addr, int *c, int *i) {
+	struct extent_chunk *chunk;
+	int lo = 0, hi = dir->count - 1, mid;
+	if(hi < 0 || dir->chunks[0]->addrs[0] > addr)
+		return FALSE;
+	while(lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if(dir->chunks[mid]->addrs[0] <= addr)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	chunk = dir->chunks[lo];
+	*c = lo;
+	hi = chunk->count - 1;
+	lo = 0;
+	while(lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if(chunk->addrs[mid] <= addr)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	*i = lo;
+	return TRUE;
+}
+
+static void ext_insert(struct rm_ctl *ctl, struct extent_dir *dir, struct free_node *node) {
+	struct extent_chunk *chunk, *upper;
+	int c = 0, i = 0, n;
+	if(ext_floor(dir, node->addr, &c, &i))
+		i++;
+	if(dir->count == 0) {
+		dir->chunks[0] = get_chunk(ctl, dir);
+		dir->count = 1;
+	}
+	chunk = dir->chunks[c];
+	// a full chunk gives its upper half to a new one
+	if(chunk->count == CHUNK_LEN) {
+		assert(dir->count < DIR_LEN);
+		upper = get_chunk(ctl, dir);
+		n = CHUNK_LEN / 2;
+		upper->count = CHUNK_LEN - n;
+		memcpy(upper->sizes, chunk->sizes + n, upper->count * sizeof(int));
+		memcpy(upper->addrs, chunk->addrs + n, upper->count * sizeof(void*));
+		memcpy(upper->nodes, chunk->nodes + n, upper->count * sizeof(void*));
+		chunk->count = n;
+		memmove(dir->chunks + c + 2, dir->chunks + c + 1, (dir->count - c - 1) * sizeof(void*));
+		dir->chunks[c + 1] = upper;
+		dir->count++;
+		if(i > n) {
+			chunk = upper;
+			i -= n;
+		}
+	}
+	n = chunk->count - i;
+	memmove(chunk->sizes + i + 1, chunk->sizes + i, n * sizeof(int));
+	memmove(chunk->addrs + i + 1, chunk->addrs + i, n * sizeof(void*));
+	memmove(chunk->nodes + i + 1, chunk->nodes + i, n * sizeof(void*));
+	chunk->sizes[i] = node->size;
+	chunk->addrs[i] = node->addr;
+	chunk->nodes[i] = node;
+	chunk->count++;
+}
+
+static void ext_remove(struct extent_dir *dir, struct free_node *node) {
+	struct extent_chunk *chunk;
+	int c, i, n;
+	if(!ext_floor(dir, node->addr, &c, &i))
+		assert(0);
+	chunk = dir->chunks[c];
+	n = chunk->count - i - 1;
+	memmove(chunk->sizes + i, chunk->sizes + i + 1, n * sizeof(int));
+	memmove(chunk->addrs + i, chunk->addrs + i + 1, n * sizeof(void*));
+	memmove(chunk->nodes + i, chunk->nodes + i + 1, n * sizeof(void*));
+	// an empty chunk leaves the directory
+	if(--chunk->count == 0) {
+		memmove(dir->chunks + c, dir->chunks + c + 1, (dir->count - c - 1) * sizeof(void*));
+		dir->count--;
+		*(struct extent_chunk**)chunk = dir->spare;
+		dir->spare = chunk;
+	}
+}
+
+// a range moved from old_addr without passing its neighbours
+static void ext_update(struct extent_dir *dir, struct free_node *node, void *old_addr) {
+	int c, i;
+	if(!ext_floor(dir, old_addr, &c, &i))
+		assert(0);
+	dir->chunks[c]->sizes[i] = node->size;
+	dir->chunks[c]->addrs[i] = node->addr;
+}
+
+// the first index from i on with a size of at least size, or count
+static inline int scan_sizes(int *sizes, int i, int count, int size) {
+#ifdef __SSE2__
+	__m128i want = _mm_set1_epi32(size - 1);
+	int mask;
+	for(; i + 4 <= count; i += 4) {
+		mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(
+				_mm_loadu_si128((__m128i*)(sizes + i)), want)));
+		if(mask)
+			return i + __builtin_ctz(mask);
+	}
+#endif
+	for(; i < count; i++)
+		if(sizes[i] >= size)
+			break;
+	return i;
+}
+
+// first fit behind after, or from the start if after is NULL
+static struct free_node *ext_first_fit(struct extent_dir *dir, struct free_node *after, int size) {
+	struct extent_chunk *chunk;
+	int c = 0, i = 0;
+	if(after && ext_floor(dir, after->addr, &c, &i))
+		i++;
+	for(; c < dir->count; c++, i = 0) {
+		chunk = dir->chunks[c];
+		i = scan_sizes(chunk->sizes, i, chunk->count, size);
+		if(i < chunk->count)
+			return chunk->nodes[i];
+	}
+	return NULL;
+}
+
+static struct free_node *ext_best_fit(struct extent_dir *dir, int size) {
+	struct extent_chunk *chunk;
+	int c, i, best = 0, found = -1;
+	struct free_node *node = NULL;
+	for(c = 0; c < dir->count; c++) {
+		chunk = dir->chunks[c];
+		for(i = 0; i < chunk->count; i++)
+			if(chunk->sizes[i] >= size && (found < 0 || chunk->sizes[i] < best)) {
+				best = chunk->sizes[i];
+				found = i;
+				node = chunk->nodes[i];
+			}
+	}
+	return node;
+}
+
+/*
+ * the free map, in address order whatever its kind
+ */
+void map_init(struct rm_ctl *ctl, struct free_map *map) {
+	map->ctl = ctl;
+	map->list.prev = map->list.next = &(map->list);
+	map->by_addr = map->by_size = NULL;
+	map->dir = NULL;
+	map->rover = NULL;
+	map->count = 0;
+	map->free_bytes = 0;
+	map->empty = 0;
+	map->avg_request = 0;
+	map->kind = map_kind;
+	map->fit = fit_kind;
+}
+
+// a range this size is all of a region, nothing in it is allocated
+static inline int is_whole_region(struct rm_ctl *ctl, int size) {
+	return size == ctl->region * PAGESIZE - sizeof(struct page_info);
+}
+
+// the tree by size is only kept for the policies that look for best fits
+static inline int map_by_size(struct free_map *map) {
+	return map->kind == RM_MAP_TREE && (map->fit == RM_FIT_BEST || map->fit == RM_FIT_ADAPTIVE);
+}
+
+// the last range at or below addr, or NULL
+struct free_node *map_floor(struct free_map *map, void *addr) {
+	struct free_node *cur, *found = NULL;
+	int c, i;
+	if(map->kind == RM_MAP_TREE)
+		return addr_floor(map->by_addr, addr);
+	if(map->kind == RM_MAP_ARRAY)
+		return map->dir && ext_floor(map->dir, addr, &c, &i) ? map->dir->chunks[c]->nodes[i] : NULL;
+	for(cur = map->list.next; cur != &(map->list) && cur->addr <= addr; cur = cur->next)
+		found = cur;
+	return found;
+}
+
+// put a range in the map, at its place by address
+void map_insert(struct free_map *map, struct free_node *node) {
+	struct free_node *next;
+	if(map->kind == RM_MAP_TREE) {
+		next = addr_floor(map->by_addr, node->addr);
+		next = next ? next->next : map->list.next;
+		map->by_addr = addr_insert(map->by_addr, node);
+		if(map_by_size(map))
+			map->by_size = size_insert(map->by_size, node);
+	} else if(map->kind == RM_MAP_ARRAY) {
+		if(!map->dir) {
+			map->dir = (struct extent_dir*)get_control_page(map->ctl);
+			memset(map->dir, 0, sizeof(struct extent_dir));
+		}
+		next = map_floor(map, node->addr);
+		next = next ? next->next : map->list.next;
+		ext_insert(map->ctl, map->dir, node);
+	} else {
+		next = map->list.next;
+		while(next != &(map->list) && next->addr < node->addr)
+			next = next->next;
+	}
+	list_insert_before(node, next);
+	map->count++;
+	map->free_bytes += node->size;
+	map->empty += is_whole_region(map->ctl, node->size);
+}
+
+void map_remove(struct free_map *map, struct free_node *node) {
+	// next fit goes on with the range behind
+	if(map->rover == node)
+		map->rover = node->next != &(map->list) ? node->next : NULL;
+	list_remove(node);
+	map->count--;
+	map->free_bytes -= node->size;
+	map->empty -= is_whole_region(map->ctl, node->size);
+	if(map->kind == RM_MAP_TREE) {
+		map->by_addr = addr_remove(map->by_addr, node);
+		if(map_by_size(map))
+			map->by_size = size_remove(map->by_size, node);
+	} else if(map->kind == RM_MAP_ARRAY) {
+		ext_remove(map->dir, node);
+	}
+}
+
+// move a range to addr and size, without passing its neighbours. a range
+// that is used up leaves the map
+void map_resize(struct free_map *map, struct free_node *node, void *addr, int size) {
+	void *old_addr = node->addr;
+	if(size == 0) {
+		map_remove(map, node);
+		put_unused_free_node(map->ctl, node);
+		return;
+	}
+	if(map_by_size(map))
+		map->by_size = size_remove(map->by_size, node);
+	map->free_bytes += size - node->size;
+	map->empty += is_whole_region(map->ctl, size) - is_whole_region(map->ctl, node->size);
+	node->addr = addr;
+	node->size = size;
+	if(map->kind == RM_MAP_TREE) {
+		addr_update(map->by_addr, node);
+		if(map_by_size(map))
+			map->by_size = size_insert(map->by_size, node);
+	} else if(map->kind == RM_MAP_ARRAY) {
+		ext_update(map->dir, node, old_addr);
+	}
+}
+
+// the first range behind after, or from the start if after is NULL, with
+// room for size
+struct free_node *map_first_fit(struct free_map *map, struct free_node *after, int size) {
+	struct free_node *cur;
+	if(map->kind == RM_MAP_TREE)
+		return addr_fit(map->by_addr, after ? (char*)after->addr + 1 : NULL, size);
+	if(map->kind == RM_MAP_ARRAY)
+		return map->dir ? ext_first_fit(map->dir, after, size) : NULL;
+	for(cur = after ? after->next : map->list.next; cur != &(map->list); cur = cur->next)
+		if(cur->size >= size)
+			return cur;
+	return NULL;
+}
+
+// the smallest range with room for size
+struct free_node *map_best_fit(struct free_map *map, int size) {
+	struct free_node *cur, *found = NULL;
+	if(map->kind == RM_MAP_TREE)
+		return size_fit(map->by_size, size);
+	if(map->kind == RM_MAP_ARRAY)
+		return map->dir ? ext_best_fit(map->dir, size) : NULL;
+	for(cur = map->list.next; cur != &(map->list); cur = cur->next)
+		if(cur->size >= size && (!found || cur->size < found->size))
+			found = cur;
+	return found;
+}
+
+// the largest range, if it has room for size
+struct free_node *map_worst_fit(struct free_map *map, int size) {
+	struct free_node *cur, *found = NULL;
+	if(map->kind == RM_MAP_TREE)
+		return map->by_addr && map->by_addr->max >= size ?
+			addr_fit(map->by_addr, NULL, map->by_addr->max) : NULL;
+	for(cur = map->list.next; cur != &(map->list); cur = cur->next)
+		if(!found || cur->size > found->size)
+			found = cur;
+	return found && found->size >= size ? found : NULL;
+}
+
+// the first fit from the rover on, wrapping around to the start
+struct free_node *map_next_fit(struct free_map *map, int size) {
+	struct free_node *after = NULL, *found;
+	if(map->rover && map->rover->prev != &(map->list))
+		after = map->rover->prev;
+	found = map_first_fit(map, after, size);
+	if(!found && after)
+		found = map_first_fit(map, NULL, size);
+	map->rover = found;
+	return found;
+}
+
+// good fit: the first range in address order that leaves at most an
+// eighth of the request over, or else the tightest of the first few
+// that fit
+#define GOOD_SCAN	(16)
+
+struct free_node *map_good_fit(struct free_map *map, int size) {
+	struct free_node *cur, *found = NULL;
+	int i;
+	cur = map_first_fit(map, NULL, size);
+	for(i = 0; cur && i < GOOD_SCAN; i++) {
+		if(cur->size - size <= size / 8)
+			return cur;
+		if(!found || cur->size < found->size)
+			found = cur;
+		cur = map_first_fit(map, cur, size);
+	}
+	return found;
+}
+
+// the adaptive policy looks at the map before each request: while the
+// free ranges are few, or large next to the requests, first fit is as
+// good as any and the fastest. once they are many and small, best fit
+// keeps the large ones from being cut into pieces
+#define ADAPT_MIN	(32)
+
+struct free_node *map_adaptive_fit(struct free_map *map, int size) {
+	if(map->count >= ADAPT_MIN && map->free_bytes / map->count < 4L * map->avg_request)
+		return map_best_fit(map, size);
+	return map_first_fit(map, NULL, size);
+}
+
+// the range a request of size is cut from under the policy of the map
+struct free_node *map_fit(struct free_map *map, int size) {
+	map->avg_request += (size - map->avg_request) / 16;
+	switch(map->fit) {
+	case RM_FIT_BEST:
+		return map_best_fit(map, size);
+	case RM_FIT_NEXT:
+		return map_next_fit(map, size);
+	case RM_FIT_WORST:
+		return map_worst_fit(map, size);
+	case RM_FIT_GOOD:
+		return map_good_fit(map, size);
+	case RM_FIT_ADAPTIVE:
+		return map_adaptive_fit(map, size);
+	}
+	return map_first_fit(map, NULL, size);
+}
+
+// cut the memory up to end into list items of the unit's size
+static void add_free_nodes(struct rm_ctl *ctl, char *start, char *end) {
+	for(; start + ctl->node_size < end; start += ctl->node_size)
+		list_append((struct free_node*)start, &(ctl->unused_list));
+}
 
 // allocate more pages for list item
-void add_page_for_free_node() {
-	struct rm_ctl *ctl = get_rm_ctl();
-	struct free_node *cur, *end;
+void add_page_for_free_node(struct rm_ctl *ctl) {
+	struct free_node *cur;
 	struct page_info *info;
 	kma_page_t *page;
 	assert(ctl);
 	page = get_page();
 	info = (struct page_info*)page->ptr;
 	info->page = page;
-	cur = (struct free_node*)((char*)info + sizeof(struct page_info));
-	end = (struct free_node*)get_page_end(cur);
-	for(; cur + 1 < end; cur++) {
-		list_append(cur, &(ctl->unused_list));
-	}
-	cur = get_unused_free_node();
+	add_free_nodes(ctl, (char*)info + sizeof(struct page_info), (char*)get_page_end(info));
+	cur = get_unused_free_node(ctl);
+	cur->addr = (void*)page;
+	list_append(cur, &(ctl->page_list));
+}
+
+// a page for the extent array, released along with the list item pages
+void *get_control_page(struct rm_ctl *ctl) {
+	struct free_node *cur;
+	struct page_info *info;
+	kma_page_t *page;
+	page = get_page();
+	info = (struct page_info*)page->ptr;
+	info->page = page;
+	cur = get_unused_free_node(ctl);
 	cur->addr = (void*)page;
 	list_append(cur, &(ctl->page_list));
+	return (void*)((char*)info + sizeof(struct page_info));
 }
 
-// to initialize the first page on which the control meta data will be
-void init_first_page() {
+// set up a control unit on a new page, with regions of the given pages
+struct rm_ctl *init_ctl(int region) {
 	struct page_info *info;
 	struct rm_ctl *ctl;
-	struct free_node *cur, *end;
-	first_page = get_page();
-	memset(first_page->ptr, 0, first_page->size);
-	info = (struct page_info*)first_page->ptr;
-	ctl = (struct rm_ctl*)((char*)first_page->ptr + sizeof(struct page_info));
-	info->page = first_page;
+	kma_page_t *page = get_page();
+	memset(page->ptr, 0, page->size);
+	info = (struct page_info*)page->ptr;
+	ctl = (struct rm_ctl*)((char*)page->ptr + sizeof(struct page_info));
+	info->page = page;
+	ctl->page = page;
 	ctl->total_alloc = 0;
 	ctl->total_free = 0;
-	ctl->free_list.prev = ctl->free_list.next = &(ctl->free_list);
+	ctl->region = region;
+	ctl->rec_size = sizeof(struct page_rec) + region * ENDS_LEN * sizeof(unsigned long);
+	map_init(ctl, &(ctl->free_map));
+	map_init(ctl, &(ctl->temp_map));
+	// the list and the extent array never touch the tree links
+	if(map_kind == RM_MAP_TREE)
+		ctl->node_size = sizeof(struct free_node);
+	else
+		ctl->node_size = offsetof(struct free_node, left);
 	ctl->unused_list.prev = ctl->unused_list.next = &(ctl->unused_list);
 	ctl->page_list.prev = ctl->page_list.next = &(ctl->page_list);
-	cur = (struct free_node*)((char*)ctl + sizeof(struct rm_ctl));
-	end = (struct free_node*)get_page_end((void*)cur);
+	ctl->rec_list.prev = ctl->rec_list.next = &(ctl->rec_list);
 	// use the rest of memory as list item
-	for(; cur + 1 < end; cur++) {
-		list_append(cur, &(ctl->unused_list));
+	add_free_nodes(ctl, (char*)ctl + sizeof(struct rm_ctl), (char*)get_page_end(ctl));
+	return ctl;
+}
+
+// the default heap, which the first request sets up. that request takes
+// a region as well, with a page for records and one for list items, so
+// they are reserved with the control page. a budget too small for them
+// gets smaller regions, NULL if not even a page fits
+static struct rm_ctl *get_default_ctl(int flags) {
+	int region = region_pages;
+	if(!first_page) {
+		if(flags & KMA_NOWAIT)
+			return NULL;
+		while(!page_reserve(1 + region + 2))
+			if((region >>= 1) == 0)
+				return NULL;
+		first_page = init_ctl(region)->page;
 	}
+	return get_rm_ctl();
 }
 
 // get a list item which could be append to the free list when memory is freed
-struct free_node *get_unused_free_node() {
-	struct rm_ctl *ctl = get_rm_ctl();
+struct free_node *get_unused_free_node(struct rm_ctl *ctl) {
 	struct free_node *node;
 	assert(ctl);
 	if(ctl->unused_list.prev == &(ctl->unused_list))
-		add_page_for_free_node();
+		add_page_for_free_node(ctl);
 	node = ctl->unused_list.next;
 	list_remove(node);
 	return node;
 };
 
 // return a list item if the corresponding memory is allocated
-void put_unused_free_node(struct free_node *node) {
-	struct rm_ctl *ctl = get_rm_ctl();
+void put_unused_free_node(struct rm_ctl *ctl, struct free_node *node) {
 	assert(node);
 	list_insert_head(node, &(ctl->unused_list));
 }
 
-// this is my resource map's strategy--- First Fit
-void *first_fit(kma_size_t size) {
-	struct free_node *cur, *node;
-	kma_page_t *page;
+// get a record for a new region, records of reclaimed ones are used first
+struct page_rec *get_page_rec(struct rm_ctl *ctl) {
+	struct free_node *cur;
 	struct page_info *info;
-	void *ptr;
-	int found = 0;
-	struct rm_ctl *ctl = get_rm_ctl();
+	kma_page_t *page;
+	struct page_rec *rec;
 	assert(ctl);
-	cur = ctl->free_list.next;
-	// to find a block fitting the size first
-	while(cur != &(ctl->free_list)) {
-		if(cur->size >= size) {
-			found = 1;
-			break;
-		}
-		cur = cur->next;
+	if(ctl->rec_free) {
+		rec = ctl->rec_free;
+		ctl->rec_free = rec->next_free;
+		memset(rec, 0, ctl->rec_size);
+		return rec;
 	}
-	// if couldn't find a fit free block, then allocate a new page
-	if(!found) {
+	if((char*)ctl->rec_next + ctl->rec_size > (char*)ctl->rec_end) {
 		page = get_page();
 		info = (struct page_info*)page->ptr;
 		info->page = page;
-		cur = get_unused_free_node();
-		cur->addr = (void*)((char*)page->ptr + sizeof(struct page_info));
-		cur->size = page->size - sizeof(struct page_info);
+		ctl->rec_next = (struct page_rec*)((char*)info + sizeof(struct page_info));
+		ctl->rec_end = (struct page_rec*)get_page_end(info);
+		cur = get_unused_free_node(ctl);
+		cur->addr = (void*)page;
+		list_append(cur, &(ctl->rec_list));
+	}
+	rec = ctl->rec_next;
+	memset(rec, 0, ctl->rec_size);
+	ctl->rec_next = (struct page_rec*)((char*)rec + ctl->rec_size);
+	return rec;
+}
+
+// the record behind rec on its page
+inline struct page_rec *next_rec(struct rm_ctl *ctl, struct page_rec *rec) {
+	return (struct page_rec*)((char*)rec + ctl->rec_size);
+}
+
+// find the unit of an address and the end bits of its region
+inline unsigned long *get_block_ends(struct rm_ctl *ctl, void *ptr, int *unit) {
+	struct page_info *info = (struct page_info*)get_region_start(ctl, ptr);
+	*unit = ((char*)ptr - (char*)info) / UNIT;
+	return info->rec->ends;
+}
+
+// the free map of the pool a block was handed out from
+inline struct free_map *get_block_map(struct rm_ctl *ctl, void *ptr) {
+	return ((struct page_info*)get_region_start(ctl, ptr))->rec->map;
+}
+
+// mark the last unit of a block that is handed out, or clear it again
+void set_block_end(struct rm_ctl *ctl, void *ptr, int size) {
+	int unit;
+	unsigned long *ends = get_block_ends(ctl, (char*)ptr + size - 1, &unit);
+	ends[unit / (8 * sizeof(unsigned long))] |= 1UL << (unit % (8 * sizeof(unsigned long)));
+}
+
+void clear_block_end(struct rm_ctl *ctl, void *ptr, int size) {
+	int unit;
+	unsigned long *ends = get_block_ends(ctl, (char*)ptr + size - 1, &unit);
+	ends[unit / (8 * sizeof(unsigned long))] &= ~(1UL << (unit % (8 * sizeof(unsigned long))));
+}
+
+// the size of an allocated block reaches to the first end bit behind its start
+int get_block_size(struct rm_ctl *ctl, void *ptr) {
+	int unit, w;
+	unsigned long bits;
+	unsigned long *ends = get_block_ends(ctl, ptr, &unit);
+	w = unit / (8 * sizeof(unsigned long));
+	bits = ends[w] & (~0UL << (unit % (8 * sizeof(unsigned long))));
+	while(!bits)
+		bits = ends[++w];
+	return (w * 8 * sizeof(unsigned long) + __builtin_ctzl(bits) - unit + 1) * UNIT;
+}
+
+// get a new region and put all of it but the page info into the free map
+struct free_node *add_page_extent(struct rm_ctl *ctl, struct free_map *map) {
+	struct free_node *cur;
+	kma_page_t *page;
+	struct page_info *info;
+	page = get_pages(ctl->region);
+	info = (struct page_info*)page->ptr;
+	info->rec = get_page_rec(ctl);
+	info->rec->page = page;
+	info->rec->map = map;
+	cur = get_unused_free_node(ctl);
+	cur->addr = (void*)((char*)page->ptr + sizeof(struct page_info));
+	cur->size = page->size - sizeof(struct page_info);
+	cur->zero = page->zero;
+	map_insert(map, cur);
+	return cur;
+}
+
+// a region refused by the page limit leaves the default heap as empty as
+// the first request found it, and it is dropped again
+static void release_idle(struct rm_ctl *ctl) {
+	if(ctl->total_alloc == ctl->total_free && !ctl->heap)
+		release_pages(ctl);
+}
+
+// cut a block from the range the placement policy picks. KMA_TEMP blocks
+// are cut from pages of their own, KMA_NOWAIT gets NULL rather than a
+// new page
+void *place_block(struct rm_ctl *ctl, kma_size_t size, int flags, int *zero) {
+	struct free_node *cur;
+	struct free_map *map;
+	void *ptr;
+	assert(ctl);
+	map = flags & KMA_TEMP ? &(ctl->temp_map) : &(ctl->free_map);
+	cur = map_fit(map, size);
+	// if couldn't find a fit free block, then allocate a new region, which
+	// can take a page for records and one for list items along
+	if(!cur) {
+		if((flags & KMA_NOWAIT) || !page_reserve(ctl->region + 2)) {
+			release_idle(ctl);
+			return NULL;
+		}
+		cur = add_page_extent(ctl, map);
 	}
-	assert(cur);
 	ptr = cur->addr;
-	cur->addr = (void*)((char*)cur->addr + size);
-	cur->size -= size;
-	// remove the free block from free list if the remaining size is zero
-	if(cur->size == 0) {
-		if(found)
-			list_remove(cur);
-		put_unused_free_node(cur);
+	*zero = cur->zero;
+	// the range leaves the map if nothing is left of it
+	map_resize(map, cur, (char*)cur->addr + size, cur->size - size);
+	set_block_end(ctl, ptr, size);
+	ctl->total_alloc++;
+	return ptr;
+}
+
+// up to count blocks of size, all cut in a row from the range the
+// placement policy picks for one of them. returns how many it cut
+int place_run(struct rm_ctl *ctl, kma_size_t size, int count, void **ptrs) {
+	struct free_node *cur;
+	int i;
+	assert(ctl);
+	cur = map_fit(&(ctl->free_map), size);
+	if(!cur) {
+		if(!page_reserve(ctl->region + 2)) {
+			release_idle(ctl);
+			return 0;
+		}
+		cur = add_page_extent(ctl, &(ctl->free_map));
+	}
+	if(count > cur->size / size)
+		count = cur->size / size;
+	for(i = 0; i < count; i++) {
+		ptrs[i] = (void*)((char*)cur->addr + i * size);
+		set_block_end(ctl, ptrs[i], size);
+	}
+	map_resize(&(ctl->free_map), cur, (char*)cur->addr + count * size, cur->size - count * size);
+	ctl->total_alloc += count;
+	return count;
+}
+
+// first fit for a block starting at a multiple of align, the gap in
+// front of the block stays in the free map
+void *aligned_fit(struct rm_ctl *ctl, kma_size_t size, kma_size_t align) {
+	struct free_node *cur, *node;
+	char *ptr, *end;
+	unsigned long mask = (unsigned long)align - 1;
+	assert(ctl);
+	// the ranges big enough for the block are tried until the gap fits too
+	cur = map_first_fit(&(ctl->free_map), NULL, size);
+	while(cur) {
+		ptr = (char*)(((unsigned long)cur->addr + mask) & ~mask);
+		if(cur->size >= (ptr - (char*)cur->addr) + size)
+			break;
+		cur = map_first_fit(&(ctl->free_map), cur, size);
+	}
+	if(!cur) {
+		if(!page_reserve(ctl->region + 2)) {
+			release_idle(ctl);
+			return NULL;
+		}
+		cur = add_page_extent(ctl, &(ctl->free_map));
+	}
+	ptr = (char*)(((unsigned long)cur->addr + mask) & ~mask);
+	end = (char*)cur->addr + cur->size;
+	if(ptr == (char*)cur->addr) {
+		// no gap, cut the block off the front as first fit does
+		map_resize(&(ctl->free_map), cur, ptr + size, cur->size - size);
 	} else {
-		if(!found) {
-			node = ctl->free_list.next;
-			while(node != &(ctl->free_list)) {
-				if(cur->addr < node->addr) {
-					break;
-				}
-				node = node->next;
-			}
-			list_insert_before(cur, node);
+		map_resize(&(ctl->free_map), cur, cur->addr, ptr - (char*)cur->addr);
+		if(ptr + size < end) {
+			node = get_unused_free_node(ctl);
+			node->addr = (void*)(ptr + size);
+			node->size = end - (ptr + size);
+			node->zero = cur->zero;
+			map_insert(&(ctl->free_map), node);
 		}
 	}
+	set_block_end(ctl, ptr, size);
 	ctl->total_alloc++;
-	return ptr;
+	return (void*)ptr;
 }
 
 void*
 kma_malloc(kma_size_t size)
 {
-	if(size + sizeof(void*) > PAGESIZE)
+	struct rm_ctl *ctl;
+	int zero;
+	if(size + sizeof(void*) > PAGESIZE || !(ctl = get_default_ctl(0)))
 		return NULL;
-	if(!first_page) {
-		init_first_page();
-	}
-	// use first fit strategy
-	return first_fit(size);
+	// cut it from the range the placement policy picks
+	return place_block(ctl, round_unit(size), 0, &zero);
 }
 
-void
-kma_free(void* ptr, kma_size_t size)
+void*
+kma_malloc_flags(kma_size_t size, int flags)
 {
-	struct rm_ctl *ctl = get_rm_ctl();
+	struct rm_ctl *ctl;
+	void *ptr;
+	int zero;
+	if(size + sizeof(void*) > PAGESIZE || !(ctl = get_default_ctl(flags)))
+		return NULL;
+	ptr = place_block(ctl, round_unit(size), flags, &zero);
+	if(ptr && (flags & KMA_ZERO) && !zero)
+		zero_block(ptr, size);
+	return ptr;
+}
+
+// regions left free from end to end are given back as soon as a map
+// holds more than EMPTY_KEEP of them, so the one kept takes the next
+// requests instead of a region being freed and taken again in turns
+#define EMPTY_KEEP	(1)
+
+// give the region of a range that fills all of it back
+void release_region(struct rm_ctl *ctl, struct free_map *map, struct free_node *cur) {
+	struct page_rec *rec;
+	rec = ((struct page_info*)get_region_start(ctl, cur->addr))->rec;
+	map_resize(map, cur, cur->addr, 0);
+	free_page(rec->page);
+	rec->page = NULL;
+	rec->next_free = ctl->rec_free;
+	ctl->rec_free = rec;
+}
+
+// put a free range back to the free map of its region, coalescing with
+// its neighbours in the same region. a region that empties goes back
+// unless it is the one its map keeps
+void put_free_range(struct rm_ctl *ctl, void *ptr, kma_size_t size) {
 	void *base_addr;
-	struct free_node *cur, *node;
-	struct page_info *info;
-	int done = 0, count = 0;
+	struct free_node *prev, *next, *node;
+	struct free_map *map;
+
+	base_addr = get_region_start(ctl, ptr);
+	map = get_block_map(ctl, ptr);
+	prev = map_floor(map, ptr);
+	next = prev ? prev->next : map->list.next;
+	// keep the neighbours that touch the range
+	if(prev && (base_addr != get_region_start(ctl, prev->addr) ||
+			ptr != (void*)((char*)prev->addr + prev->size)))
+		prev = NULL;
+	if(next == &(map->list) || base_addr != get_region_start(ctl, next->addr) ||
+			next->addr != (void*)((char*)ptr + size))
+		next = NULL;
+	if(prev) {
+		// merge the next free block too if the freed one fills the gap
+		if(next) {
+			size += next->size;
+			map_resize(map, next, next->addr, 0);
+		}
+		prev->zero = 0;
+		map_resize(map, prev, prev->addr, prev->size + size);
+		node = prev;
+	} else if(next) {
+		// merge the freed block with the block behind it
+		next->zero = 0;
+		map_resize(map, next, ptr, next->size + size);
+		node = next;
+	} else {
+		// if we couldn't coalesc the fragment, then insert the block at the right place
+		node = get_unused_free_node(ctl);
+		node->addr = ptr;
+		node->size = size;
+		node->zero = 0;
+		map_insert(map, node);
+	}
+	if(map->empty > EMPTY_KEEP && is_whole_region(ctl, node->size))
+		release_region(ctl, map, node);
+}
+
+// clean up all the resource of a control unit, the unit too
+void release_pages(struct rm_ctl *ctl) {
+	struct free_node *cur;
+	struct page_rec *rec, *end;
+	int count = 0;
 	kma_page_t *page_array[MAXPAGES/2];
-	assert(ctl);
 
+	// every region we allocate from has a record, so the records find all
+	// of them, even the ones a heap is destroyed with live blocks on
+	cur = ctl->rec_list.next;
+	while(cur != &(ctl->rec_list)) {
+		rec = (struct page_rec*)((char*)((kma_page_t*)cur->addr)->ptr + sizeof(struct page_info));
+		end = cur->next == &(ctl->rec_list) ? ctl->rec_next : (struct page_rec*)get_page_end(rec);
+		for(; (char*)next_rec(ctl, rec) <= (char*)end; rec = next_rec(ctl, rec)) {
+			if(!rec->page)
+				continue;
+			assert(rec->page->ptr);
+			free_page(rec->page);
+		}
+		page_array[count++] = (kma_page_t*)cur->addr;
+		cur = cur->next;
+	}
+	cur = ctl->page_list.next;
+	while(cur != &(ctl->page_list)) {
+		assert(((kma_page_t*)cur->addr)->ptr);
+		page_array[count++] = (kma_page_t*)cur->addr;
+		cur = cur->next;
+	}
+	for(count = count - 1; count >= 0; count--)
+		free_page(page_array[count]);
+	if(ctl->page == first_page)
+		first_page = NULL;
+	free_page(ctl->page);
+}
+
+int
+kma_rm_set_map(int map)
+{
+	if(map != RM_MAP_LIST && map != RM_MAP_TREE && map != RM_MAP_ARRAY)
+		return FALSE;
+	map_kind = map;
+	return TRUE;
+}
+
+int
+kma_rm_set_fit(int fit)
+{
+	if(fit < RM_FIT_FIRST || fit > RM_FIT_ADAPTIVE)
+		return FALSE;
+	fit_kind = fit;
+	return TRUE;
+}
+
+int
+kma_rm_set_region(int pages)
+{
+	if(pages <= 0 || pages > MAXRUN || (pages & (pages - 1)))
+		return FALSE;
+	region_pages = pages;
+	return TRUE;
+}
+
+// order page records by the address of their page
+static int compare_recs(const void *lhs, const void *rhs) {
+	char *l = (char*)(*(struct page_rec**)lhs)->page->ptr;
+	char *r = (char*)(*(struct page_rec**)rhs)->page->ptr;
+	return l < r ? -1 : l > r;
+}
+
+// the power of two class a range of size bytes is counted in
+static kma_class_stat_t *get_class_stat(kma_stats_t *stats, int size) {
+	int k = 0;
+	while((UNIT << k) < size)
+		k++;
+	return &(stats->classes[k]);
+}
+
+// the free lists are ordered by address, so with the pages in the same
+// order every page is walked range by range: a range at the head of its
+// free list is free, anything else is a block with an end bit
+void
+kma_get_stats(kma_stats_t* stats)
+{
+	struct rm_ctl *ctl;
+	struct free_node *cur, *node[2];
+	struct page_rec *recs[MAXPAGES], *rec, *end;
+	char *ptr;
+	int n = 0, i, k, size;
+	memset(stats, 0, sizeof(kma_stats_t));
+	if(!first_page)
+		return;
+	ctl = get_rm_ctl();
+
+	stats->meta_pages = 1;
+	for(cur = ctl->page_list.next; cur != &(ctl->page_list); cur = cur->next)
+		stats->meta_pages++;
+	for(cur = ctl->rec_list.next; cur != &(ctl->rec_list); cur = cur->next) {
+		stats->meta_pages++;
+		rec = (struct page_rec*)((char*)((kma_page_t*)cur->addr)->ptr + sizeof(struct page_info));
+		end = cur->next == &(ctl->rec_list) ? ctl->rec_next : (struct page_rec*)get_page_end(rec);
+		for(; (char*)next_rec(ctl, rec) <= (char*)end; rec = next_rec(ctl, rec))
+			if(rec->page)
+				recs[n++] = rec;
+	}
+	stats->data_pages = n * ctl->region;
+	for(k = 0; (UNIT << k) <= ctl->region * PAGESIZE; k++)
+		stats->classes[k].size = UNIT << k;
+	stats->num_classes = k;
+	qsort(recs, n, sizeof(struct page_rec*), compare_recs);
 
-	base_addr = get_page_start(ptr);
-	cur = ctl->free_list.next;
-	while(cur != &(ctl->free_list)) {
-		// try to coalesc the adjacent fragment if possible
-		if(base_addr == get_page_start(cur->addr) &&
-				(ptr == (void*)((char*)cur->addr + cur->size))) {
-			done = 1;
-			node = cur->next;
-			cur->size += size;
-			// merge the next free block
-			if(node != &(ctl->free_list) &&
-					base_addr == get_page_start(node->addr) &&
-					((void*)((char*)cur->addr + (long)cur->size) == node->addr)) {
-				cur->size += node->size;
-				list_remove(node);
-				put_unused_free_node(node);
+	node[0] = ctl->free_map.list.next;
+	node[1] = ctl->temp_map.list.next;
+	for(i = 0; i < n; i++) {
+		k = recs[i]->map == &(ctl->temp_map);
+		ptr = (char*)(recs[i]->page->ptr) + sizeof(struct page_info);
+		while(ptr < (char*)recs[i]->page->ptr + recs[i]->page->size) {
+			if(node[k] != &(recs[i]->map->list) && node[k]->addr == (void*)ptr) {
+				size = node[k]->size;
+				get_class_stat(stats, size)->free++;
+				stats->free_bytes += size;
+				node[k] = node[k]->next;
+			} else {
+				size = get_block_size(ctl, ptr);
+				get_class_stat(stats, size)->used++;
+				stats->used_bytes += size;
 			}
-			break;
-		} else if(base_addr == get_page_start(cur->addr) &&
-				(cur->addr == (void*)((char*)ptr + size))) {
-			// merge the freed block with the block behind it
-			cur->addr = ptr;
-			cur->size += size;
-			done = 1;
-			break;
-		} else if((void*)((char*)ptr + size) < cur->addr) {
-			break;
+			ptr += size;
 		}
-		cur = cur->next;
 	}
-	// if we couldn't coalesc the fragment, then insert the block at the right place
-	if(!done) {
-		node = get_unused_free_node();
-		node->addr = ptr;
-		node->size = size;
-		list_insert_before(node, cur);
+}
+
+// give back the regions that are one free range from end to end. their
+// records go on a chain for the next regions to reuse. the maps count
+// those ranges, so a walk only happens when there is one and stops at
+// the last of them
+int
+kma_reclaim()
+{
+	struct rm_ctl *ctl;
+	struct free_map *map;
+	struct free_node *cur, *next;
+	int i, count = 0;
+	if(!first_page)
+		return -1;
+	ctl = get_rm_ctl();
+	if(ctl->free_map.empty + ctl->temp_map.empty == 0)
+		return -1;
+
+	for(i = 0; i < 2; i++) {
+		map = i ? &(ctl->temp_map) : &(ctl->free_map);
+		for(cur = map->list.next; cur != &(map->list) && map->empty > 0; cur = next) {
+			next = cur->next;
+			if(!is_whole_region(ctl, cur->size))
+				continue;
+			release_region(ctl, map, cur);
+			count += ctl->region;
+		}
 	}
+	return count;
+}
+
+// free a block of a control unit, which goes with its last block unless
+// it is a heap
+void put_block(struct rm_ctl *ctl, void *ptr, kma_size_t size) {
+	assert(ctl);
+
+	// without the size, the end bits know where the block stops
+	size = size == KMA_UNSIZED ? get_block_size(ctl, ptr) : round_unit(size);
+	clear_block_end(ctl, ptr, size);
+	put_free_range(ctl, ptr, size);
 	ctl->total_free++;
 
-	// clean up all the allocated resource after all the things are done
-	if(ctl->total_alloc == ctl->total_free) {
-		cur = ctl->free_list.next;
-		while(cur != &(ctl->free_list)) {
-			info = (struct page_info*)get_page_start(cur->addr);
-			assert(info->page->ptr);
-			free_page(info->page);
-			cur = cur->next;
-		}
-		cur = ctl->page_list.next;
-		while(cur != &(ctl->page_list)) {
-			assert(((kma_page_t*)cur->addr)->ptr);
-			page_array[count++] = (kma_page_t*)cur->addr;
-			cur = cur->next;
+	if(ctl->total_alloc == ctl->total_free && !ctl->heap)
+		release_pages(ctl);
+}
+
+void
+kma_free(void* ptr, kma_size_t size)
+{
+	put_block(get_rm_ctl(), ptr, size);
+}
+
+void*
+kma_realloc(void* ptr, kma_size_t size, kma_size_t new_size)
+{
+	struct rm_ctl *ctl;
+	struct free_node *cur;
+	struct free_map *map;
+	void *end, *new_ptr;
+	if(!ptr)
+		return kma_malloc(new_size);
+	if(new_size + sizeof(void*) > PAGESIZE)
+		return NULL;
+	ctl = get_rm_ctl();
+	size = size == KMA_UNSIZED ? get_block_size(ctl, ptr) : round_unit(size);
+	new_size = round_unit(new_size);
+
+	// shrink by giving the tail back
+	if(new_size <= size) {
+		if(new_size < size) {
+			clear_block_end(ctl, ptr, size);
+			set_block_end(ctl, ptr, new_size);
+			put_free_range(ctl, (char*)ptr + new_size, size - new_size);
 		}
-		for(count = count - 1; count >= 0; count--)
-			free_page(page_array[count]);
-		free_page(first_page);
-		first_page = NULL;
+		return ptr;
+	}
+
+	// grow into the free range right behind the block if it is big enough
+	end = (void*)((char*)ptr + size);
+	map = get_block_map(ctl, ptr);
+	cur = map_floor(map, end);
+	if(cur && cur->addr == end && cur->size >= new_size - size) {
+		map_resize(map, cur, (char*)cur->addr + (new_size - size), cur->size - (new_size - size));
+		clear_block_end(ctl, ptr, size);
+		set_block_end(ctl, ptr, new_size);
+		return ptr;
+	}
+
+	// otherwise move it
+	new_ptr = kma_malloc(new_size);
+	if(new_ptr) {
+		memcpy(new_ptr, ptr, size);
+		kma_free(ptr, size);
 	}
+	return new_ptr;
+}
+
+void*
+kma_calloc(kma_size_t nmemb, kma_size_t size)
+{
+	long long total = (long long)nmemb * size;
+	struct rm_ctl *ctl;
+	void *ptr;
+	int zero;
+	if(total + sizeof(void*) > PAGESIZE || !(ctl = get_default_ctl(0)))
+		return NULL;
+	// skip the clearing when the range was carved from a fresh page
+	ptr = place_block(ctl, round_unit(total), 0, &zero);
+	if(ptr && !zero)
+		zero_block(ptr, total);
+	return ptr;
+}
+
+void*
+kma_malloc_aligned(kma_size_t size, kma_size_t align)
+{
+	struct rm_ctl *ctl;
+	if(align == 0 || (align & (align - 1)) || size + align + sizeof(void*) > PAGESIZE)
+		return NULL;
+	if(!(ctl = get_default_ctl(0)))
+		return NULL;
+	return aligned_fit(ctl, round_unit(size), align);
+}
+
+kma_size_t
+kma_usable_size(void* ptr)
+{
+	return get_block_size(get_rm_ctl(), ptr);
+}
+
+// order the batch by address, batches are short enough for an insertion sort
+static void sort_addr(void **ptrs, int n) {
+	void *p;
+	int i, j;
+	for(i = 1; i < n; i++) {
+		p = ptrs[i];
+		for(j = i; j > 0 && (char*)ptrs[j - 1] > (char*)p; j--)
+			ptrs[j] = ptrs[j - 1];
+		ptrs[j] = p;
+	}
+}
+
+int
+kma_malloc_batch(kma_size_t size, int n, void* ptrs[])
+{
+	struct rm_ctl *ctl;
+	int i = 0, count;
+	if(size + sizeof(void*) > PAGESIZE || !(ctl = get_default_ctl(0)))
+		return 0;
+	// one search of the free map per run of blocks instead of per block
+	size = round_unit(size);
+	while(i < n && (count = place_run(ctl, size, n - i, ptrs + i)) > 0)
+		i += count;
+	return i;
+}
+
+void
+kma_free_batch(void* ptrs[], int n)
+{
+	struct rm_ctl *ctl = get_rm_ctl();
+	char *ptr;
+	int i, sz, len;
+	assert(ctl);
+
+	// in address order, blocks that touch on one page go back to the
+	// free list as one range with one walk of the list. the end bits
+	// of the region record give each size
+	sort_addr(ptrs, n);
+	for(i = 0; i < n; ) {
+		ptr = (char*)ptrs[i];
+		len = 0;
+		do {
+			sz = get_block_size(ctl, ptrs[i]);
+			clear_block_end(ctl, ptrs[i], sz);
+			len += sz;
+			i++;
+		} while(i < n && (char*)ptrs[i] == ptr + len &&
+				get_region_start(ctl, ptrs[i]) == get_region_start(ctl, ptr));
+		put_free_range(ctl, (void*)ptr, len);
+	}
+	ctl->total_free += n;
+
+	if(ctl->total_alloc == ctl->total_free && !ctl->heap)
+		release_pages(ctl);
+}
+
+// a heap has free maps and regions of its own, of the region size set
+// when it is made. its handle is the control unit
+kma_heap_t*
+kma_heap_create()
+{
+	struct rm_ctl *ctl;
+	if(!page_reserve(1))
+		return NULL;
+	ctl = init_ctl(region_pages);
+	ctl->heap = 1;
+	return (kma_heap_t*)ctl;
+}
+
+void
+kma_heap_destroy(kma_heap_t *heap)
+{
+	release_pages((struct rm_ctl*)heap);
+}
+
+void*
+kma_heap_malloc(kma_heap_t *heap, kma_size_t size)
+{
+	int zero;
+	if(size + sizeof(void*) > PAGESIZE)
+		return NULL;
+	return place_block((struct rm_ctl*)heap, round_unit(size), 0, &zero);
+}
+
+void
+kma_heap_free(kma_heap_t *heap, void* ptr, kma_size_t size)
+{
+	put_block((struct rm_ctl*)heap, ptr, size);
 }
 
 #endif // KMA_RM
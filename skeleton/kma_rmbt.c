@@ -0,0 +1,658 @@
+/***************************************************************************
+ *  Title: Kernel Memory Allocator
+ * -------------------------------------------------------------------------
+ *    Purpose: Kernel memory allocator based on the resource map algorithm,
+ *             with the free ranges kept in the pages themselves behind
+ *             boundary tags
+ *    Author: Yang Yang
+ *    Copyright: 2014 Northwestern University
+ ***************************************************************************/
+#ifdef KMA_RMBT
+#define __KMA_IMPL__
+
+/************System include***********************************************/
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+/************Private include**********************************************/
+#include "kma_page.h"
+#include "kma.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+
+
+inline void *get_page_start(void *addr) {
+	return (void*)((unsigned long)addr & ~((unsigned long)(PAGESIZE-1)));
+};
+
+inline void *get_page_end(void *addr) {
+	return (void*)((char*)get_page_start(addr) + PAGESIZE);
+}
+
+
+
+kma_page_t *first_page = NULL;
+
+// every block starts with a header word: its size, which is a multiple
+// of 8, with the low bits free for the flags below. a free block also
+// has its size in its last word, so the block behind it finds it
+#define UNIT		(8)
+#define HEAD		(sizeof(unsigned long))
+#define MIN_BLOCK	(32)		// header, two links and the footer
+#define SIZE_MASK	(~(unsigned long)(UNIT - 1))
+#define ALLOC_BIT	(1UL)		// the block is handed out
+#define PREV_FREE	(2UL)		// the block in front of it is free
+
+// every page starts with a page word, its bit0 is clear so that a word
+// in front of a block pointer tells a header from the start of a page
+#define TEMP_PAGE	(2UL)		// the page holds KMA_TEMP blocks
+#define BIG_PAGE	(4UL)		// the page is one block, with no header
+#define SLOT_SHIFT	(3)			// the page table slot is above the flags
+
+// the largest block a page holds behind its page word
+#define MAX_BLOCK	(PAGESIZE - HEAD)
+
+#define PAGE_BIT_LEN ((PAGESIZE==8192)?(13):((PAGESIZE==4096)?12:11))
+// the free blocks are binned by power of two, from MIN_BLOCK up
+#define BIN_NUM		(PAGE_BIT_LEN - 5)
+
+// the page table keeps the kma_page_t of every page we allocate from,
+// since the pages no longer say where they came from otherwise
+#define SLOT_NUM	(PAGESIZE / sizeof(kma_page_t*))
+#define TABLE_NUM	(MAXPAGES / SLOT_NUM + 1)
+
+// a free block, the links follow the header
+struct block {
+	unsigned long head;
+	struct block *prev;
+	struct block *next;
+};
+
+// control meta data for the boundary tag allocator, for the default
+// heap and for every kma_heap_create
+struct rmbt_ctl {
+	kma_page_t *page;					// the page the control data is on
+	int total_alloc;
+	int total_free;
+	struct block bins[2][BIN_NUM];		// the free blocks, then those for KMA_TEMP
+	unsigned int bin_mask[2];			// the bins that are not empty
+	kma_page_t *tables[TABLE_NUM];		// the pages of the page table
+	int next_slot;						// no slot from here on was used
+	long free_slot;						// chain of released slots, -1 if none
+	int heap;							// only kma_heap_destroy releases the pages
+};
+
+void release_pages(struct rmbt_ctl *ctl);
+
+// a helper to get the control unit
+struct rmbt_ctl *get_rmbt_ctl() {
+	assert(first_page);
+	return (struct rmbt_ctl*)first_page->ptr;
+}
+
+// round a request up to a whole block with its header
+inline int block_size(int size) {
+	size = (size + HEAD + UNIT - 1) & ~(UNIT - 1);
+	return size < MIN_BLOCK ? MIN_BLOCK : size;
+}
+
+inline int get_size(struct block *block) {
+	return (int)(block->head & SIZE_MASK);
+}
+
+inline struct block *get_block(void *ptr) {
+	return (struct block*)((char*)ptr - HEAD);
+}
+
+inline unsigned long get_page_word(void *addr) {
+	return *(unsigned long*)get_page_start(addr);
+}
+
+// the block behind, NULL at the end of the page
+inline struct block *get_next(struct block *block) {
+	char *next = (char*)block + get_size(block);
+	return next < (char*)get_page_end(block) ? (struct block*)next : NULL;
+}
+
+inline void set_footer(struct block *block) {
+	*(unsigned long*)((char*)block + get_size(block) - HEAD) = block->head & SIZE_MASK;
+}
+
+inline int get_bin(int size) {
+	return (31 - __builtin_clz(size)) - 5;
+}
+
+inline int get_pool(struct block *block) {
+	return (get_page_word(block) & TEMP_PAGE) != 0;
+}
+
+// a block goes to the tail of its bin: the longer it waits to be
+// reused, the more time its neighbours have to be freed and merge
+// with it. on the traces this keeps fewer pages than LIFO
+void bin_insert(struct rmbt_ctl *ctl, struct block *block) {
+	int pool = get_pool(block), bin = get_bin(get_size(block));
+	struct block *header = &(ctl->bins[pool][bin]);
+	block->next = header;
+	block->prev = header->prev;
+	header->prev->next = block;
+	header->prev = block;
+	ctl->bin_mask[pool] |= 1U << bin;
+}
+
+void bin_remove(struct rmbt_ctl *ctl, struct block *block) {
+	int pool, bin;
+	block->prev->next = block->next;
+	block->next->prev = block->prev;
+	// both links end at the bin header once it is empty
+	if(block->prev == block->next) {
+		pool = get_pool(block);
+		bin = get_bin(get_size(block));
+		ctl->bin_mask[pool] &= ~(1U << bin);
+	}
+}
+
+// to initialize a new page on which the control meta data will be
+struct rmbt_ctl *init_ctl() {
+	struct rmbt_ctl *ctl;
+	kma_page_t *page = get_page();
+	int i, j;
+	memset(page->ptr, 0, page->size);
+	ctl = (struct rmbt_ctl*)page->ptr;
+	ctl->page = page;
+	for(i = 0; i < 2; i++)
+		for(j = 0; j < BIN_NUM; j++)
+			ctl->bins[i][j].prev = ctl->bins[i][j].next = &(ctl->bins[i][j]);
+	ctl->free_slot = -1;
+	return ctl;
+}
+
+inline kma_page_t **get_slot(struct rmbt_ctl *ctl, long slot) {
+	return (kma_page_t**)ctl->tables[slot / SLOT_NUM]->ptr + slot % SLOT_NUM;
+}
+
+// note a page in the page table, released slots are used first. a
+// released slot holds the next one on the chain, tagged with bit0
+long take_slot(struct rmbt_ctl *ctl, kma_page_t *page) {
+	long slot;
+	if(ctl->free_slot >= 0) {
+		slot = ctl->free_slot;
+		ctl->free_slot = (long)*get_slot(ctl, slot) >> 1;
+	} else {
+		slot = ctl->next_slot++;
+		if(!ctl->tables[slot / SLOT_NUM])
+			ctl->tables[slot / SLOT_NUM] = get_page();
+	}
+	*get_slot(ctl, slot) = page;
+	return slot;
+}
+
+void put_slot(struct rmbt_ctl *ctl, void *addr) {
+	long slot = get_page_word(addr) >> SLOT_SHIFT;
+	*get_slot(ctl, slot) = (kma_page_t*)((ctl->free_slot << 1) | 1);
+	ctl->free_slot = slot;
+}
+
+// take a page and put all of it but the page word in the bins as one
+// free block
+struct block *add_page(struct rmbt_ctl *ctl, int pool) {
+	kma_page_t *page = get_page();
+	struct block *block = (struct block*)((char*)page->ptr + HEAD);
+	*(unsigned long*)page->ptr = (take_slot(ctl, page) << SLOT_SHIFT) | (pool ? TEMP_PAGE : 0);
+	block->head = MAX_BLOCK;
+	set_footer(block);
+	bin_insert(ctl, block);
+	return block;
+}
+
+// a page for a request too big to share one, the block is the page
+void *add_big_page(struct rmbt_ctl *ctl, kma_size_t align) {
+	kma_page_t *page = get_page();
+	char *ptr = (char*)page->ptr + HEAD;
+	*(unsigned long*)page->ptr = (take_slot(ctl, page) << SLOT_SHIFT) | BIG_PAGE;
+	if(align > HEAD) {
+		// keep a clear word in front of the block, like the page word
+		ptr = (char*)page->ptr + align;
+		*(unsigned long*)(ptr - HEAD) = 0;
+	}
+	ctl->total_alloc++;
+	return (void*)ptr;
+}
+
+// put a block back in the bins. the tags find both neighbours, so
+// it merges with them in constant time
+void free_block(struct rmbt_ctl *ctl, struct block *block) {
+	struct block *next = get_next(block), *prev;
+	unsigned long size = get_size(block);
+	if(next && !(next->head & ALLOC_BIT)) {
+		bin_remove(ctl, next);
+		size += get_size(next);
+	}
+	if(block->head & PREV_FREE) {
+		prev = (struct block*)((char*)block - *(unsigned long*)((char*)block - HEAD));
+		bin_remove(ctl, prev);
+		size += get_size(prev);
+		block = prev;
+	}
+	// a free block always has an allocated one or the page word in front
+	block->head = size;
+	set_footer(block);
+	if((next = get_next(block)))
+		next->head |= PREV_FREE;
+	bin_insert(ctl, block);
+}
+
+// trim an allocated block to size, the tail goes back as a free block
+void trim_block(struct rmbt_ctl *ctl, struct block *block, int size) {
+	struct block *tail;
+	int rest = get_size(block) - size;
+	if(rest < MIN_BLOCK)
+		return;
+	block->head = size | (block->head & ~SIZE_MASK);
+	tail = (struct block*)((char*)block + size);
+	tail->head = rest | ALLOC_BIT;
+	free_block(ctl, tail);
+}
+
+// hand out a free block, it still is in its bin
+void use_block(struct rmbt_ctl *ctl, struct block *block) {
+	struct block *next;
+	bin_remove(ctl, block);
+	block->head |= ALLOC_BIT;
+	if((next = get_next(block)))
+		next->head &= ~PREV_FREE;
+}
+
+// drop the default heap again when the page limit turned down the
+// request that set it up
+static void release_idle(struct rmbt_ctl *ctl) {
+	if(ctl->total_alloc == ctl->total_free && !ctl->heap)
+		release_pages(ctl);
+}
+
+// a free block of at least size bytes: the first that fits in its own
+// bin, or any of the next bin that is not empty, since all of those fit
+struct block *find_block(struct rmbt_ctl *ctl, int size, int flags) {
+	int pool = (flags & KMA_TEMP) != 0, bin = get_bin(size);
+	struct block *header = &(ctl->bins[pool][bin]), *cur;
+	unsigned int mask;
+	for(cur = header->next; cur != header; cur = cur->next)
+		if(get_size(cur) >= size)
+			return cur;
+	mask = bin + 1 < BIN_NUM ? ctl->bin_mask[pool] & (~0U << (bin + 1)) : 0;
+	if(mask)
+		return ctl->bins[pool][__builtin_ctz(mask)].next;
+	// take a new page, the page table may need one too
+	if((flags & KMA_NOWAIT) || !page_reserve(2)) {
+		release_idle(ctl);
+		return NULL;
+	}
+	return add_page(ctl, pool);
+}
+
+void *place_block(struct rmbt_ctl *ctl, kma_size_t size, int flags) {
+	struct block *block;
+	size = block_size(size);
+	if(size > MAX_BLOCK) {
+		if((flags & KMA_NOWAIT) || !page_reserve(2)) {
+			release_idle(ctl);
+			return NULL;
+		}
+		return add_big_page(ctl, 0);
+	}
+	if(!(block = find_block(ctl, size, flags)))
+		return NULL;
+	use_block(ctl, block);
+	trim_block(ctl, block, size);
+	ctl->total_alloc++;
+	return (void*)((char*)block + HEAD);
+}
+
+// the control unit of the default heap, set up by the first request
+static struct rmbt_ctl *get_default_ctl(int flags) {
+	if(first_page)
+		return get_rmbt_ctl();
+	if((flags & KMA_NOWAIT) || !page_reserve(1))
+		return NULL;
+	first_page = init_ctl()->page;
+	return get_rmbt_ctl();
+}
+
+void*
+kma_malloc(kma_size_t size)
+{
+	struct rmbt_ctl *ctl;
+	if(size + sizeof(void*) > PAGESIZE || !(ctl = get_default_ctl(0)))
+		return NULL;
+	return place_block(ctl, size, 0);
+}
+
+void*
+kma_malloc_flags(kma_size_t size, int flags)
+{
+	struct rmbt_ctl *ctl;
+	void *ptr;
+	if(size + sizeof(void*) > PAGESIZE || !(ctl = get_default_ctl(flags)))
+		return NULL;
+	ptr = place_block(ctl, size, flags);
+	if(ptr && (flags & KMA_ZERO))
+		zero_block(ptr, size);
+	return ptr;
+}
+
+// clean up all the allocated resource after all the things are done
+void release_pages(struct rmbt_ctl *ctl) {
+	kma_page_t *page;
+	long slot;
+	int i;
+
+	// the page table finds every page, even the ones a heap is
+	// destroyed with live blocks on
+	for(slot = 0; slot < ctl->next_slot; slot++) {
+		page = *get_slot(ctl, slot);
+		if(!((unsigned long)page & 1))
+			free_page(page);
+	}
+	for(i = TABLE_NUM - 1; i >= 0; i--)
+		if(ctl->tables[i])
+			free_page(ctl->tables[i]);
+	if(ctl->page == first_page)
+		first_page = NULL;
+	free_page(ctl->page);
+}
+
+// give back a page through its slot
+void release_page(struct rmbt_ctl *ctl, void *addr) {
+	kma_page_t *page = *get_slot(ctl, get_page_word(addr) >> SLOT_SHIFT);
+	put_slot(ctl, addr);
+	free_page(page);
+}
+
+// the power of two class a block of size bytes is counted in
+static kma_class_stat_t *get_class_stat(kma_stats_t *stats, int size) {
+	int k = 0;
+	while((MIN_BLOCK << k) < size)
+		k++;
+	return &(stats->classes[k]);
+}
+
+// the tags make every page a walk from block to block
+void
+kma_get_stats(kma_stats_t* stats)
+{
+	struct rmbt_ctl *ctl;
+	struct block *block;
+	kma_page_t *page;
+	long slot;
+	int i, size;
+	memset(stats, 0, sizeof(kma_stats_t));
+	if(!first_page)
+		return;
+	ctl = get_rmbt_ctl();
+
+	stats->meta_pages = 1;
+	for(i = 0; i < TABLE_NUM; i++)
+		if(ctl->tables[i])
+			stats->meta_pages++;
+	for(i = 0; (MIN_BLOCK << i) <= PAGESIZE; i++)
+		stats->classes[i].size = MIN_BLOCK << i;
+	stats->num_classes = i;
+
+	for(slot = 0; slot < ctl->next_slot; slot++) {
+		page = *get_slot(ctl, slot);
+		if((unsigned long)page & 1)
+			continue;
+		stats->data_pages++;
+		if(get_page_word(page->ptr) & BIG_PAGE) {
+			get_class_stat(stats, MAX_BLOCK)->used++;
+			stats->used_bytes += MAX_BLOCK;
+			continue;
+		}
+		for(block = (struct block*)((char*)page->ptr + HEAD); block; block = get_next(block)) {
+			size = get_size(block);
+			if(block->head & ALLOC_BIT) {
+				get_class_stat(stats, size)->used++;
+				stats->used_bytes += size;
+			} else {
+				get_class_stat(stats, size)->free++;
+				stats->free_bytes += size;
+			}
+		}
+	}
+}
+
+// give back the pages that are one free block from end to end
+int
+kma_reclaim()
+{
+	struct rmbt_ctl *ctl;
+	struct block *cur, *next;
+	int i, count = 0;
+	if(!first_page)
+		return -1;
+	ctl = get_rmbt_ctl();
+	if(!((ctl->bin_mask[0] | ctl->bin_mask[1]) & (1U << (BIN_NUM - 1))))
+		return -1;
+
+	// a whole page only fits in the last bin
+	for(i = 0; i < 2; i++) {
+		for(cur = ctl->bins[i][BIN_NUM - 1].next; cur != &(ctl->bins[i][BIN_NUM - 1]); cur = next) {
+			next = cur->next;
+			if(get_size(cur) != MAX_BLOCK)
+				continue;
+			bin_remove(ctl, cur);
+			release_page(ctl, cur);
+			count++;
+		}
+	}
+	return count;
+}
+
+// the size is not needed: the word in front of the block is its header,
+// or the clear word of a page that is a block of its own
+void put_block(struct rmbt_ctl *ctl, void *ptr) {
+	struct block *block = get_block(ptr);
+	assert(ctl);
+
+	if(block->head & ALLOC_BIT)
+		free_block(ctl, block);
+	else
+		release_page(ctl, ptr);
+	ctl->total_free++;
+
+	if(ctl->total_alloc == ctl->total_free && !ctl->heap)
+		release_pages(ctl);
+}
+
+void
+kma_free(void* ptr, kma_size_t size)
+{
+	put_block(get_rmbt_ctl(), ptr);
+}
+
+void*
+kma_realloc(void* ptr, kma_size_t size, kma_size_t new_size)
+{
+	struct rmbt_ctl *ctl;
+	struct block *block, *next, *after;
+	void *new_ptr;
+	int cur;
+	if(!ptr)
+		return kma_malloc(new_size);
+	if(new_size + sizeof(void*) > PAGESIZE)
+		return NULL;
+	ctl = get_rmbt_ctl();
+	block = get_block(ptr);
+
+	if(block->head & ALLOC_BIT) {
+		cur = get_size(block);
+		size = block_size(new_size);
+		// shrink by giving the tail back
+		if(size <= cur) {
+			trim_block(ctl, block, size);
+			return ptr;
+		}
+		// grow into the free block right behind if it is big enough
+		next = get_next(block);
+		if(next && !(next->head & ALLOC_BIT) && cur + get_size(next) >= size) {
+			bin_remove(ctl, next);
+			block->head += get_size(next);
+			if((after = get_next(block)))
+				after->head &= ~PREV_FREE;
+			trim_block(ctl, block, size);
+			return ptr;
+		}
+		cur -= HEAD;
+	} else {
+		// a page of its own holds anything up to its end
+		cur = (char*)get_page_end(ptr) - (char*)ptr;
+		if(new_size <= cur)
+			return ptr;
+	}
+
+	// otherwise move it
+	new_ptr = kma_malloc(new_size);
+	if(new_ptr) {
+		memcpy(new_ptr, ptr, cur);
+		kma_free(ptr, KMA_UNSIZED);
+	}
+	return new_ptr;
+}
+
+void*
+kma_calloc(kma_size_t nmemb, kma_size_t size)
+{
+	long long total = (long long)nmemb * size;
+	void *ptr;
+	if(total + sizeof(void*) > PAGESIZE)
+		return NULL;
+	// the links and tags of the free blocks are in the pages, so nothing
+	// but a fresh page is known to be clear
+	ptr = kma_malloc(total);
+	if(ptr)
+		zero_block(ptr, total);
+	return ptr;
+}
+
+void*
+kma_malloc_aligned(kma_size_t size, kma_size_t align)
+{
+	struct rmbt_ctl *ctl;
+	struct block *block, *front;
+	char *ptr;
+	int need;
+	if(align == 0 || (align & (align - 1)) || size + align + sizeof(void*) > PAGESIZE)
+		return NULL;
+	if(align <= UNIT)
+		return kma_malloc(size);
+	if(!(ctl = get_default_ctl(0)))
+		return NULL;
+
+	// room to put a gap of a whole free block in front if need be
+	size = block_size(size);
+	need = size + align + MIN_BLOCK;
+	if(need > MAX_BLOCK) {
+		if(!page_reserve(2)) {
+			release_idle(ctl);
+			return NULL;
+		}
+		return add_big_page(ctl, align);
+	}
+	if(!(block = find_block(ctl, need, 0)))
+		return NULL;
+	use_block(ctl, block);
+	ptr = (char*)(((unsigned long)block + HEAD + align - 1) & ~(unsigned long)(align - 1));
+	while(ptr > (char*)block + HEAD && ptr - ((char*)block + HEAD) < MIN_BLOCK)
+		ptr += align;
+	if(ptr > (char*)block + HEAD) {
+		front = block;
+		block = get_block(ptr);
+		block->head = (get_size(front) - ((char*)block - (char*)front)) | ALLOC_BIT;
+		front->head = ((char*)block - (char*)front) | ALLOC_BIT;
+		free_block(ctl, front);
+	}
+	trim_block(ctl, block, size);
+	ctl->total_alloc++;
+	return (void*)ptr;
+}
+
+kma_size_t
+kma_usable_size(void* ptr)
+{
+	struct block *block = get_block(ptr);
+	if(block->head & ALLOC_BIT)
+		return get_size(block) - HEAD;
+	return (char*)get_page_end(ptr) - (char*)ptr;
+}
+
+// nothing is shared between the blocks of a batch: each is one bin
+// lookup and each free merges with its neighbours on the spot
+int
+kma_malloc_batch(kma_size_t size, int n, void* ptrs[])
+{
+	int i;
+	for(i = 0; i < n; i++)
+		if(!(ptrs[i] = kma_malloc(size)))
+			break;
+	return i;
+}
+
+void
+kma_free_batch(void* ptrs[], int n)
+{
+	struct rmbt_ctl *ctl = get_rmbt_ctl();
+	int i;
+	// every block says its size in its header
+	for(i = 0; i < n; i++)
+		put_block(ctl, ptrs[i]);
+}
+
+// a heap has bins and a page table of its own, its handle is the
+// control data
+kma_heap_t*
+kma_heap_create()
+{
+	struct rmbt_ctl *ctl;
+	if(!page_reserve(1))
+		return NULL;
+	ctl = init_ctl();
+	ctl->heap = 1;
+	return (kma_heap_t*)ctl;
+}
+
+void
+kma_heap_destroy(kma_heap_t *heap)
+{
+	release_pages((struct rmbt_ctl*)heap);
+}
+
+void*
+kma_heap_malloc(kma_heap_t *heap, kma_size_t size)
+{
+	if(size + sizeof(void*) > PAGESIZE)
+		return NULL;
+	return place_block((struct rmbt_ctl*)heap, size, 0);
+}
+
+void
+kma_heap_free(kma_heap_t *heap, void* ptr, kma_size_t size)
+{
+	put_block((struct rmbt_ctl*)heap, ptr);
+}
+
+#endif // KMA_RMBT
@@ -0,0 +1,145 @@
+/***************************************************************************
+ *  Title: Kernel Memory Allocator
+ * -------------------------------------------------------------------------
+ *    Purpose: Kernel memory allocator based on arenas: blocks are bumped
+ *             off the current page and pages go back whole
+ *    Author: Yang Yang
+ *    Copyright: 2014 Northwestern University
+ ***************************************************************************/
+#ifdef KMA_ARENA
+#define __KMA_IMPL__
+#define __KMA_ARENA_IMPL__
+
+/************System include***********************************************/
+#include <assert.h>
+#include <stdlib.h>
+
+/************Private include**********************************************/
+#include "kma_page.h"
+#include "kma.h"
+#include "kma_arena.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+void*
+kma_malloc(kma_size_t size)
+{
+  return NULL;
+}
+
+void
+kma_free(void* ptr, kma_size_t size)
+{
+  ;
+}
+
+void*
+kma_realloc(void* ptr, kma_size_t size, kma_size_t new_size)
+{
+  return NULL;
+}
+
+void*
+kma_calloc(kma_size_t nmemb, kma_size_t size)
+{
+  return NULL;
+}
+
+void*
+kma_malloc_aligned(kma_size_t size, kma_size_t align)
+{
+  return NULL;
+}
+
+kma_size_t
+kma_usable_size(void* ptr)
+{
+  return 0;
+}
+
+int
+kma_malloc_batch(kma_size_t size, int n, void* ptrs[])
+{
+  return 0;
+}
+
+void
+kma_free_batch(void* ptrs[], int n)
+{
+  ;
+}
+
+kma_heap_t*
+kma_heap_create()
+{
+  return NULL;
+}
+
+void
+kma_heap_destroy(kma_heap_t* heap)
+{
+  ;
+}
+
+void*
+kma_heap_malloc(kma_heap_t* heap, kma_size_t size)
+{
+  return NULL;
+}
+
+void
+kma_heap_free(kma_heap_t* heap, void* ptr, kma_size_t size)
+{
+  ;
+}
+
+void*
+kma_malloc_flags(kma_size_t size, int flags)
+{
+  return NULL;
+}
+
+int
+kma_reclaim()
+{
+  return 0;
+}
+
+void
+kma_get_stats(kma_stats_t* stats)
+{
+  ;
+}
+
+kma_mark_t
+kma_arena_mark()
+{
+  return 0;
+}
+
+void
+kma_arena_rewind(kma_mark_t mark)
+{
+  ;
+}
+
+void
+kma_arena_reset()
+{
+  ;
+}
+
+#endif // KMA_ARENA
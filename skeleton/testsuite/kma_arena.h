@@ -0,0 +1,75 @@
+/***************************************************************************
+ *  Title: Arena Allocator
+ * -------------------------------------------------------------------------
+ *    Purpose: Calls only the arena backend has, for memory that shares
+ *             one lifetime and is dropped all at once
+ *    Author: Yang Yang
+ *    Copyright: 2014 Northwestern University
+ ***************************************************************************/
+
+#ifndef __KMA_ARENA_H__
+#define __KMA_ARENA_H__
+
+/************System include***********************************************/
+
+/************Private include**********************************************/
+#include "kma.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __KMA_ARENA_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+// a position in the arena, see kma_arena_mark
+typedef long kma_mark_t;
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Marks the arena
+ * ---------------------------------------------------------------------
+ *    Purpose: Remembers how far the arena has been handed out, so
+ *             that kma_arena_rewind() can drop everything allocated
+ *             after this call
+ *    Input: none
+ *    Output: the mark
+ ***********************************************************************/
+EXTERN kma_mark_t kma_arena_mark();
+
+/***********************************************************************
+ *  Title: Rewinds the arena
+ * ---------------------------------------------------------------------
+ *    Purpose: Frees every block allocated after the mark was taken,
+ *             without a kma_free for any of them. Pages that only
+ *             hold such blocks go back to the page pool
+ *    Input: the mark
+ *    Output: none
+ ***********************************************************************/
+EXTERN void kma_arena_rewind(kma_mark_t mark);
+
+/***********************************************************************
+ *  Title: Resets the arena
+ * ---------------------------------------------------------------------
+ *    Purpose: Frees every block of the arena and returns all of its
+ *             pages to the page pool in one pass
+ *    Input: none
+ *    Output: none
+ ***********************************************************************/
+EXTERN void kma_arena_reset();
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __KMA_ARENA_H__ */
@@ -0,0 +1,61 @@
+/***************************************************************************
+ *  Title: Benchmark Helpers
+ * -------------------------------------------------------------------------
+ *    Purpose: Timing and CPU pinning helpers shared by the test harness
+ *             and the benchmark drivers
+ *    Author: Yang Yang
+ *    Copyright: 2014 Northwestern University
+ ***************************************************************************/
+#define _GNU_SOURCE
+#define __KBENCH_IMPL__
+
+/************System include***********************************************/
+#include <sched.h>
+#include <time.h>
+
+/************Private include**********************************************/
+#include "kma_bench.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+long long bench_now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int bench_pin_cpu(int cpu) {
+	cpu_set_t set;
+	// stay on the cpu the scheduler already gave us
+	if(cpu < 0)
+		cpu = sched_getcpu();
+	if(cpu < 0)
+		return -1;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if(sched_setaffinity(0, sizeof(set), &set))
+		return -1;
+	return cpu;
+}
+
+unsigned long long bench_rand(unsigned long long *state) {
+	unsigned long long x = *state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545F4914F6CDD1DULL;
+}
@@ -0,0 +1,68 @@
+/***************************************************************************
+ *  Title: Benchmark Helpers
+ * -------------------------------------------------------------------------
+ *    Purpose: Timing and CPU pinning helpers shared by the test harness
+ *             and the benchmark drivers
+ *    Author: Yang Yang
+ *    Copyright: 2014 Northwestern University
+ ***************************************************************************/
+
+#ifndef __KBENCH_H__
+#define __KBENCH_H__
+
+/************System include***********************************************/
+
+/************Private include**********************************************/
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __KBENCH_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Monotonic clock
+ * ---------------------------------------------------------------------
+ *    Purpose: Read the monotonic clock with nanosecond resolution
+ *    Input: none
+ *    Output: the current time in nanoseconds
+ ***********************************************************************/
+EXTERN long long bench_now_ns();
+
+/***********************************************************************
+ *  Title: Pin to a CPU
+ * ---------------------------------------------------------------------
+ *    Purpose: Bind the calling process to one CPU so that repeated
+ *             runs do not migrate between cores and caches
+ *    Input: the CPU number, or -1 for the CPU we are running on
+ *    Output: the CPU we are pinned to, or -1 on failure
+ ***********************************************************************/
+EXTERN int bench_pin_cpu(int cpu);
+
+/***********************************************************************
+ *  Title: Random numbers
+ * ---------------------------------------------------------------------
+ *    Purpose: A small xorshift generator, so runs with the same seed
+ *             replay the same workload
+ *    Input: the generator state (any non-zero seed)
+ *    Output: the next 64-bit random number
+ ***********************************************************************/
+EXTERN unsigned long long bench_rand(unsigned long long *state);
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __KBENCH_H__ */
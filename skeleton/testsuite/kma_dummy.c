@@ -46,6 +46,7 @@
 /************System include***********************************************/
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
 /************Private include**********************************************/
 #include "kma_page.h"
@@ -70,7 +71,9 @@ void* kma_malloc(kma_size_t size)
 {
   kma_page_t* page;
   
-  // get one page
+  // get one page, unless the page limit is reached
+  if (!page_reserve(1))
+    return NULL;
   page = get_page();
   
   // add a pointer to the page structure at the beginning of the page
@@ -101,4 +104,192 @@ void kma_free(void* ptr, kma_size_t size)
   free_page(page);
 }
 
+void* kma_realloc(void* ptr, kma_size_t size, kma_size_t new_size)
+{
+  kma_page_t* page;
+  void* new_ptr;
+  
+  if (ptr == NULL)
+    return kma_malloc(new_size);
+  if (size == KMA_UNSIZED)
+    size = kma_usable_size(ptr);
+  
+  // every request has a page of its own, so anything that fits stays
+  page = *((kma_page_t**)(ptr - sizeof(kma_page_t*)));
+  if ((ptr - page->ptr) + new_size <= page->size)
+    return ptr;
+  
+  new_ptr = kma_malloc(new_size);
+  if (new_ptr != NULL)
+    {
+      memcpy(new_ptr, ptr, size < new_size ? size : new_size);
+      kma_free(ptr, size);
+    }
+  return new_ptr;
+}
+
+void* kma_calloc(kma_size_t nmemb, kma_size_t size)
+{
+  kma_page_t* page;
+  void* ptr;
+  long long total = (long long) nmemb * size;
+  
+  if (total + sizeof(kma_page_t*) > PAGESIZE)
+    return NULL;
+  
+  ptr = kma_malloc(total);
+  if (ptr == NULL)
+    return NULL;
+  
+  // only the page pointer was written to a fresh page
+  page = *((kma_page_t**)(ptr - sizeof(kma_page_t*)));
+  if (!page->zero)
+    zero_block(ptr, total);
+  
+  return ptr;
+}
+
+void* kma_malloc_aligned(kma_size_t size, kma_size_t align)
+{
+  kma_page_t* page;
+  void* ptr;
+  
+  if (align == 0 || (align & (align - 1)) != 0
+      || (size + align + sizeof(kma_page_t*)) > PAGESIZE)
+    return NULL;
+  if (!page_reserve(1))
+    return NULL;
+  
+  page = get_page();
+  
+  // move the start up to the alignment, the page pointer goes right
+  // in front of it where kma_free looks for it
+  ptr = page->ptr + sizeof(kma_page_t*);
+  ptr = (void*)(((unsigned long)ptr + align - 1) & ~((unsigned long)align - 1));
+  *((kma_page_t**)(ptr - sizeof(kma_page_t*))) = page;
+  
+  return ptr;
+}
+
+kma_size_t kma_usable_size(void* ptr)
+{
+  kma_page_t* page;
+  
+  // the block runs to the end of its page
+  page = *((kma_page_t**)(ptr - sizeof(kma_page_t*)));
+  return page->ptr + page->size - ptr;
+}
+
+int kma_malloc_batch(kma_size_t size, int n, void* ptrs[])
+{
+  int i;
+  
+  // a page per block, there is nothing the blocks could share
+  for (i = 0; i < n; i++)
+    {
+      ptrs[i] = kma_malloc(size);
+      if (ptrs[i] == NULL)
+	break;
+    }
+  
+  return i;
+}
+
+void kma_free_batch(void* ptrs[], int n)
+{
+  int i;
+  
+  for (i = 0; i < n; i++)
+    kma_free(ptrs[i], KMA_UNSIZED);
+}
+
+int kma_reclaim()
+{
+  // every page goes back with its block, nothing is ever cached
+  return -1;
+}
+
+void kma_get_stats(kma_stats_t* stats)
+{
+  // every page in use holds one block and nothing else, heaps aside
+  memset(stats, 0, sizeof(kma_stats_t));
+  stats->data_pages = page_stats()->num_in_use;
+  stats->used_bytes = (long long) stats->data_pages
+    * (PAGESIZE - sizeof(kma_page_t*));
+}
+
+void* kma_malloc_flags(kma_size_t size, int flags)
+{
+  // every request takes a new page, and a page holds one request, so
+  // KMA_TEMP is already apart and KMA_NOWAIT can never be served
+  if (flags & KMA_NOWAIT)
+    return NULL;
+  if (flags & KMA_ZERO)
+    return kma_calloc(1, size);
+  
+  return kma_malloc(size);
+}
+
+// a heap is a page listing the pages its blocks were given, the count
+// of them comes first
+#define HEAP_SLOTS (PAGESIZE / sizeof(kma_page_t*) - 1)
+
+kma_heap_t* kma_heap_create()
+{
+  kma_page_t* page;
+  
+  page = get_page();
+  *((long*)page->ptr) = 0;
+  
+  return (kma_heap_t*)page;
+}
+
+void kma_heap_destroy(kma_heap_t* heap)
+{
+  kma_page_t* page = (kma_page_t*)heap;
+  kma_page_t** pages = (kma_page_t**)page->ptr + 1;
+  long i;
+  
+  for (i = 0; i < *((long*)page->ptr); i++)
+    free_page(pages[i]);
+  free_page(page);
+}
+
+void* kma_heap_malloc(kma_heap_t* heap, kma_size_t size)
+{
+  kma_page_t* page = (kma_page_t*)heap;
+  kma_page_t** pages = (kma_page_t**)page->ptr + 1;
+  long* count = (long*)page->ptr;
+  void* ptr;
+  
+  if (*count == HEAP_SLOTS)
+    return NULL;
+  
+  ptr = kma_malloc(size);
+  if (ptr != NULL)
+    pages[(*count)++] = *((kma_page_t**)(ptr - sizeof(kma_page_t*)));
+  
+  return ptr;
+}
+
+void kma_heap_free(kma_heap_t* heap, void* ptr, kma_size_t size)
+{
+  kma_page_t* page = (kma_page_t*)heap;
+  kma_page_t** pages = (kma_page_t**)page->ptr + 1;
+  long* count = (long*)page->ptr;
+  kma_page_t* block_page;
+  long i;
+  
+  // move the last page into the slot of the freed one
+  block_page = *((kma_page_t**)(ptr - sizeof(kma_page_t*)));
+  for (i = 0; i < *count; i++)
+    if (pages[i] == block_page)
+      {
+	pages[i] = pages[--(*count)];
+	break;
+      }
+  
+  kma_free(ptr, size);
+}
+
 #endif // KMA_DUMMY
@@ -70,4 +70,82 @@ kma_free(void* ptr, kma_size_t size)
   ;
 }
 
+void*
+kma_realloc(void* ptr, kma_size_t size, kma_size_t new_size)
+{
+  return NULL;
+}
+
+void*
+kma_calloc(kma_size_t nmemb, kma_size_t size)
+{
+  return NULL;
+}
+
+void*
+kma_malloc_aligned(kma_size_t size, kma_size_t align)
+{
+  return NULL;
+}
+
+kma_size_t
+kma_usable_size(void* ptr)
+{
+  return 0;
+}
+
+int
+kma_malloc_batch(kma_size_t size, int n, void* ptrs[])
+{
+  return 0;
+}
+
+void
+kma_free_batch(void* ptrs[], int n)
+{
+  ;
+}
+
+kma_heap_t*
+kma_heap_create()
+{
+  return NULL;
+}
+
+void
+kma_heap_destroy(kma_heap_t* heap)
+{
+  ;
+}
+
+void*
+kma_heap_malloc(kma_heap_t* heap, kma_size_t size)
+{
+  return NULL;
+}
+
+void
+kma_heap_free(kma_heap_t* heap, void* ptr, kma_size_t size)
+{
+  ;
+}
+
+void*
+kma_malloc_flags(kma_size_t size, int flags)
+{
+  return NULL;
+}
+
+int
+kma_reclaim()
+{
+  return 0;
+}
+
+void
+kma_get_stats(kma_stats_t* stats)
+{
+  ;
+}
+
 #endif // KMA_LZBUD
@@ -0,0 +1,55 @@
+/***************************************************************************
+ *  Title: McKusick-Karels Allocator
+ * -------------------------------------------------------------------------
+ *    Purpose: Calls only the McKusick-Karels backend has, to pick the
+ *             block sizes its pages are cut into
+ *    Author: Yang Yang
+ *    Copyright: 2014 Northwestern University
+ ***************************************************************************/
+
+#ifndef __KMA_MCK2_H__
+#define __KMA_MCK2_H__
+
+/************System include***********************************************/
+
+/************Private include**********************************************/
+#include "kma.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __KMA_MCK2_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Picks the size classes
+ * ---------------------------------------------------------------------
+ *    Purpose: Sets how many size classes lie between two powers of
+ *             two: 1 keeps the powers of two, 2 and 4 add the sizes a
+ *             half and a quarter of the way. Each class is then grown
+ *             to the largest multiple of 16 that still fits as many
+ *             blocks in a page. Takes effect when the allocator sets
+ *             up its control page, so call it while no block is
+ *             allocated
+ *    Input: the classes per power of two, 1, 2 or 4
+ *    Output: TRUE if the number is valid
+ ***********************************************************************/
+EXTERN int kma_mck2_set_classes(int steps);
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __KMA_MCK2_H__ */
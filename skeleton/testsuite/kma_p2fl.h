@@ -0,0 +1,54 @@
+/***************************************************************************
+ *  Title: Power-of-two Free List Allocator
+ * -------------------------------------------------------------------------
+ *    Purpose: Calls only the power-of-two free list backend has, to pick
+ *             where a block keeps the list it goes back to
+ *    Author: Yang Yang
+ *    Copyright: 2014 Northwestern University
+ ***************************************************************************/
+
+#ifndef __KMA_P2FL_H__
+#define __KMA_P2FL_H__
+
+/************System include***********************************************/
+
+/************Private include**********************************************/
+#include "kma.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __KMA_P2FL_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Drops the block headers
+ * ---------------------------------------------------------------------
+ *    Purpose: Without headers a page only holds blocks of one size,
+ *             and kma_free finds the list from a class map of the
+ *             pages. A request of a power of two then fits its own
+ *             size, and every block is aligned to its size up to
+ *             PAGESIZE. Takes effect when the allocator sets up its
+ *             control page, so call it while no block is allocated
+ *    Input: TRUE for no headers
+ *    Output: TRUE
+ ***********************************************************************/
+EXTERN int kma_p2fl_set_headerless(int on);
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __KMA_P2FL_H__ */
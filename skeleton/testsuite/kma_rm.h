@@ -0,0 +1,94 @@
+/***************************************************************************
+ *  Title: Resource Map Allocator
+ * -------------------------------------------------------------------------
+ *    Purpose: Calls only the resource map backend has, to pick how it
+ *             keeps its free ranges and which one a request is cut from
+ *    Author: Yang Yang
+ *    Copyright: 2014 Northwestern University
+ ***************************************************************************/
+
+#ifndef __KMA_RM_H__
+#define __KMA_RM_H__
+
+/************System include***********************************************/
+
+/************Private include**********************************************/
+#include "kma.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __KMA_RM_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+// how the free ranges are kept, see kma_rm_set_map
+#define RM_MAP_LIST	0	// a list in address order, walked on every call
+#define RM_MAP_TREE	1	// the list, indexed by address and by size
+#define RM_MAP_ARRAY	2	// the list, with sizes and addresses packed in arrays
+
+// which free range a request is cut from, see kma_rm_set_fit
+#define RM_FIT_FIRST	0	// the one lowest in memory that is big enough
+#define RM_FIT_BEST	1	// the smallest one that is big enough
+#define RM_FIT_NEXT	2	// first fit from where the last search stopped
+#define RM_FIT_WORST	3	// the largest one
+#define RM_FIT_GOOD	4	// first fit that wastes at most an eighth
+#define RM_FIT_ADAPTIVE	5	// first or best fit, by how fragmented the map is
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Picks the free map
+ * ---------------------------------------------------------------------
+ *    Purpose: Sets how the free ranges are kept: RM_MAP_LIST walks
+ *             them on every malloc and free, RM_MAP_TREE finds them
+ *             in logarithmic time, RM_MAP_ARRAY scans their packed
+ *             sizes four at a time. Takes effect when the allocator
+ *             sets up its control page, so call it while no block is
+ *             allocated
+ *    Input: the kind of map
+ *    Output: TRUE if the kind is known
+ ***********************************************************************/
+EXTERN int kma_rm_set_map(int map);
+
+/***********************************************************************
+ *  Title: Picks the placement policy
+ * ---------------------------------------------------------------------
+ *    Purpose: Sets which free range a request is cut from, as for
+ *             kma_rm_set_map() from the next control page on. Aligned
+ *             requests always take the first range they fit in.
+ *             RM_FIT_ADAPTIVE switches to best fit while the free
+ *             ranges are many and small next to the requests
+ *    Input: the policy
+ *    Output: TRUE if the policy is known
+ ***********************************************************************/
+EXTERN int kma_rm_set_fit(int fit);
+
+/***********************************************************************
+ *  Title: Picks the region size
+ * ---------------------------------------------------------------------
+ *    Purpose: Sets how many pages the allocator takes at a time, as
+ *             for kma_rm_set_map() from the next control page on. The
+ *             pages of a region are next to each other and its free
+ *             ranges cross the page boundaries. The default heap takes
+ *             smaller regions if the page limit cannot fit one with
+ *             its first request
+ *    Input: the number of pages, a power of two up to MAXRUN
+ *    Output: TRUE if the number is valid
+ ***********************************************************************/
+EXTERN int kma_rm_set_region(int pages);
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __KMA_RM_H__ */
@@ -0,0 +1,34 @@
+#!/bin/bash
+#
+# Run the worst-case traces of stress_trace through every allocator and
+# print the tail latencies and the peak footprint of each run.
+
+if [[ "$#" -gt 1 ]]; then
+	echo -e "usage: $0 [bin_dir]";
+	exit 1;
+fi;
+
+BIN_DIR=`cd ${1:-..} && pwd`;
+ALGS="kma_rm kma_rmbt kma_p2fl kma_mck2 kma_bud kma_lzbud kma_arena";
+TRACES=`mktemp -d /tmp/cs343.stress.XXXXXX`;
+
+./stress_trace ${TRACES} > /dev/null || { rm -Rf ${TRACES}; exit 1; }
+
+printf "%-10s %-13s %-8s %8s %8s %8s %10s %6s\n" alg trace op p50 p99 p99.9 max pages;
+for TRACE in ${TRACES}/*.trace; do
+	for ALG in ${ALGS}; do
+		[[ -x ${BIN_DIR}/${ALG} ]] || continue;
+		OUT=`(cd ${TRACES} && ${BIN_DIR}/${ALG} -t ${TRACE} 2>&1)`;
+		NAME=`basename ${TRACE} .trace`;
+		if ! echo "${OUT}" | grep -q "Test: PASS"; then
+			printf "%-10s %-13s FAILED\n" ${ALG} ${NAME};
+			continue;
+		fi;
+		PAGES=`echo "${OUT}" | grep "Peak pages" | awk '{print $5}'`;
+		echo "${OUT}" | grep "^Tail" | while read TAIL OP NS P50 V50 P99 V99 P999 V999 MAX VMAX; do
+			printf "%-10s %-13s %-8s %8s %8s %8s %10s %6s\n" ${ALG} ${NAME} ${OP} ${V50} ${V99} ${V999} ${VMAX} ${PAGES};
+		done;
+	done;
+done;
+
+rm -Rf ${TRACES};
@@ -142,6 +142,34 @@ for f in ${EC_PROGS}; do
 	echo;
 done
 
+# A budget of a few pages refuses most requests, and a refused first
+# request must not leave the control page behind
+echo "TESTING SMALL PAGE LIMITS";
+
+for f in ${PROGS}; do
+	echo $f;
+	OK=1
+	for l in ${LIMITS}; do
+		for g in ${LIMIT_TRACES}; do
+		    ./$f -l $l $g > $f.$l.$g.out 2>&1
+		    if [[ ` cat $f.$l.$g.out | grep -c "Test: PASS"` -eq 0 ]]; then
+	            # failed
+	            echo "Limit $l, trace $g failed. Tail of output follows"
+	            echo "..."
+	            tail $f.$l.$g.out
+	            OK=0
+	            break 2
+		    fi
+		done
+	done
+	if [[ $OK -eq "1" ]]; then
+	    echo "Limits ${LIMITS}: PASSED"
+	else
+	    echo "Algorithm $f: FAILED"
+	fi
+	echo;
+done
+
 # Malloc
 echo "MALLOC USAGE";
 grep -H malloc *_*.c --exclude kma_rm.c --exclude kma_page.c | grep -v kma_malloc;
@@ -153,34 +181,21 @@ echo;
 COMPETITION_ALGORITHM=`make -s competitionAlgorithm`
 echo "COMPETITION: running ${COMPETITION_ALGORITHM} on ${COMPETITION_TRACE}"
 
-BEST_TIME=-1
-OK=1
-for i in {1..5}; do
-
-    bash -c "time -p ./${COMPETITION_BIN} ${COMPETITION_TRACE} > competition.out 2>&1" > competition.time 2>&1
-    
-    if [[ `cat competition.out | grep -c "Test: PASS"` -eq 0 ]]; then
-	OK=0
-	break
-    fi
-
-    RUNTIME=`cat competition.time | grep "real" | awk '{ print $2 }'`
-
-    BEST_TIME=`echo "if ( ( ${BEST_TIME} == -1) || ( ${RUNTIME} < ${BEST_TIME} )) { ${RUNTIME} } else { ${BEST_TIME} }" | bc`
-    
-done
+# The binary decodes the trace up front, pins itself to a cpu and times
+# only the kma_malloc/kma_free calls over repeated runs
+./${COMPETITION_BIN} -r ${COMPETITION_RUNS} ${COMPETITION_TRACE} > competition.out 2>&1
 
-if [[ ${OK} -eq 1 ]]; then
+if [[ `cat competition.out | grep -c "Test: PASS"` -eq 1 ]]; then
     echo "Competition binary successfully completed the trace"
 
     cat competition.out
 
-    INEFFICIENCY=`cat competition.out | grep "Competition average ratio" | awk '{ print $4 }' `
+    BEST_TIME=`cat competition.out | grep "Competition time" | awk '{ print $3 }' `
 
-    PERFORMANCE=`echo "${BEST_TIME} * (1 + ${INEFFICIENCY})" | bc`
+    PERFORMANCE=`cat competition.out | grep "Competition score" | awk '{ print $3 }' `
 
     echo
-    echo "Best time (out of 5 runs): ${BEST_TIME}"
+    echo "Best time (out of ${COMPETITION_RUNS} runs): ${BEST_TIME}"
     echo "Competition score: ${PERFORMANCE}"
 else
     echo "Competition binary failed to complete the trace. Tail of output follows..."